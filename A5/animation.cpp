@@ -0,0 +1,64 @@
+#include"animation.h"
+#include<string>
+#include<sstream>
+#include<vector>
+
+Animation::Animation() {
+	frames = 1;
+	key = 0;
+}
+
+void Animation::AddKey( std::vector<AnimationKey>& track , Vector3 value ) {
+	AnimationKey new_key;
+	new_key.frame = key;
+	new_key.value = value;
+
+	//keys stay sorted by frame, a repeated frame replaces the old value
+	std::vector<AnimationKey>::iterator iter = track.begin();
+	while ( iter != track.end() && iter->frame < key ) iter++;
+	if ( iter != track.end() && iter->frame == key ) *iter = new_key;
+	else track.insert( iter , new_key );
+}
+
+bool Animation::Interpolate( std::vector<AnimationKey>& track , int frame , Vector3& ret ) {
+	if ( track.empty() ) return false;
+	if ( frame <= track.front().frame ) { ret = track.front().value; return true; }
+	if ( frame >= track.back().frame ) { ret = track.back().value; return true; }
+
+	int k = 1;
+	while ( track[k].frame < frame ) k++;
+	double t = ( double ) ( frame - track[k - 1].frame ) / ( track[k].frame - track[k - 1].frame );
+	ret = track[k - 1].value * ( 1 - t ) + track[k].value * t;
+	return true;
+}
+
+bool Animation::GetOffset( int frame , std::string name , Vector3& ret ) {
+	std::map<std::string , std::vector<AnimationKey> >::iterator iter = offsets.find( name );
+	if ( iter == offsets.end() ) return false;
+	return Interpolate( iter->second , frame , ret );
+}
+
+std::vector<std::string> Animation::GetObjectNames() {
+	std::vector<std::string> ret;
+	for ( std::map<std::string , std::vector<AnimationKey> >::iterator iter = offsets.begin() ; iter != offsets.end() ; iter++ )
+		ret.push_back( iter->first );
+	return ret;
+}
+
+void Animation::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "frames=" ) fin >> frames;
+	if ( var == "key=" ) fin >> key;
+	if ( var == "camera_O=" ) {
+		Vector3 O; O.Input( fin );
+		AddKey( camera_O , O );
+	}
+	if ( var == "camera_N=" ) {
+		Vector3 N; N.Input( fin );
+		AddKey( camera_N , N );
+	}
+	if ( var == "move=" ) {
+		std::string name; fin >> name;
+		Vector3 D; D.Input( fin );
+		AddKey( offsets[name] , D );
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include"vector3.h"
+#include<string>
+#include<sstream>
+#include<vector>
+#include<map>
+
+struct AnimationKey {
+	int frame;
+	Vector3 value;
+};
+
+//keyframed camera and object offsets, linearly interpolated between keys
+class Animation {
+	int frames;
+	int key; //frame of the key being read
+	std::vector<AnimationKey> camera_O , camera_N;
+	std::map<std::string , std::vector<AnimationKey> > offsets; //by primitive name, relative to the scene file
+
+	void AddKey( std::vector<AnimationKey>& track , Vector3 value );
+	bool Interpolate( std::vector<AnimationKey>& track , int frame , Vector3& ret ); //false for an empty track
+
+public:
+	Animation();
+	~Animation() {}
+
+	int GetFrames() { return frames; }
+	bool GetCameraO( int frame , Vector3& ret ) { return Interpolate( camera_O , frame , ret ); }
+	bool GetCameraN( int frame , Vector3& ret ) { return Interpolate( camera_N , frame , ret ); }
+	bool GetOffset( int frame , std::string name , Vector3& ret );
+	std::vector<std::string> GetObjectNames();
+
+	void Input( std::string var , std::stringstream& fin );
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include"aov.h"
+#include<cstdio>
+
+const int AOV_CHANNELS = 9;
+const char* AOV_CHANNEL_NAME[AOV_CHANNELS] = {
+	"depth" , "normal.x" , "normal.y" , "normal.z" , "albedo.r" , "albedo.g" , "albedo.b" , "primitive" , "samples"
+};
+
+void AovSample::Set( CollidePrimitive& collide_primitive ) {
+	Primitive* primitive_hit = collide_primitive.collide_primitive;
+	N = collide_primitive.N;
+	depth = collide_primitive.dist;
+	albedo = primitive_hit->GetMaterial()->color;
+	if ( primitive_hit->GetMaterial()->texture != NULL ) albedo = albedo * collide_primitive.GetTexture();
+	primitive = primitive_hit->GetIndex();
+}
+
+void AovBuffer::Initialize( int H , int W ) {
+	this->H = H;
+	this->W = W;
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		albedo[c].assign( H * W , 0 );
+		normal[c].assign( H * W , 0 );
+	}
+	depth.assign( H * W , 0 );
+	primitive.assign( H * W , -1 );
+	samples.assign( H * W , 0 );
+}
+
+void AovBuffer::Add( int i , int j , AovSample& sample ) {
+	int k = i * W + j;
+	float n = ++samples[k];
+	albedo[0][k] += ( ( float ) sample.albedo.r - albedo[0][k] ) / n;
+	albedo[1][k] += ( ( float ) sample.albedo.g - albedo[1][k] ) / n;
+	albedo[2][k] += ( ( float ) sample.albedo.b - albedo[2][k] ) / n;
+	normal[0][k] += ( ( float ) sample.N.x - normal[0][k] ) / n;
+	normal[1][k] += ( ( float ) sample.N.y - normal[1][k] ) / n;
+	normal[2][k] += ( ( float ) sample.N.z - normal[2][k] ) / n;
+	depth[k] += ( ( float ) sample.depth - depth[k] ) / n;
+	if ( n == 1 ) primitive[k] = ( float ) sample.primitive;
+}
+
+//layout :: "AOV1\n<W> <H> <channels>\n<channel names>\n" then each channel as W*H little-endian floats, row 0 first
+void AovBuffer::Output( std::string file ) {
+	FILE *fpw = fopen( file.c_str() , "wb" );
+	if ( fpw == NULL ) return;
+
+	fprintf( fpw , "AOV1\n%d %d %d\n" , W , H , AOV_CHANNELS );
+	for ( int c = 0 ; c < AOV_CHANNELS ; c++ )
+		fprintf( fpw , c + 1 < AOV_CHANNELS ? "%s " : "%s\n" , AOV_CHANNEL_NAME[c] );
+
+	std::vector<float>* plane[AOV_CHANNELS] = {
+		&depth , &normal[0] , &normal[1] , &normal[2] , &albedo[0] , &albedo[1] , &albedo[2] , &primitive , &samples
+	};
+	for ( int c = 0 ; c < AOV_CHANNELS ; c++ )
+		fwrite( &( *plane[c] )[0] , sizeof( float ) , H * W , fpw );
+
+	fclose( fpw );
+}
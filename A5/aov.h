@@ -0,0 +1,43 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include"color.h"
+#include"vector3.h"
+#include"primitive.h"
+#include<vector>
+#include<string>
+
+extern const int AOV_CHANNELS;
+
+//features of the first surface a camera ray hits
+struct AovSample {
+	Color albedo;
+	Vector3 N;
+	double depth;
+	int primitive;
+	AovSample() { depth = 0; primitive = -1; }
+	void Set( CollidePrimitive& collide_primitive );
+};
+
+//planar per-pixel buffers, each a running mean over the samples of the pixel
+class AovBuffer {
+	int H , W;
+
+public:
+	std::vector<float> albedo[3];
+	std::vector<float> normal[3];
+	std::vector<float> depth; //0 where the camera ray escapes
+	std::vector<float> primitive; //index of the primitive hit by the first sample, -1 for none
+	std::vector<float> samples;
+
+	AovBuffer() : H( 0 ) , W( 0 ) {}
+	~AovBuffer() {}
+
+	int GetH() { return H; }
+	int GetW() { return W; }
+	void Initialize( int H , int W );
+	void Add( int i , int j , AovSample& sample );
+	void Output( std::string file );
+};
+
+#endif
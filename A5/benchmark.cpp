@@ -0,0 +1,1046 @@
+#include"benchmark.h"
+#include"raytracer.h"
+#include"imagecompare.h"
+#include<cstdio>
+#include<cmath>
+#include<chrono>
+#include<fstream>
+#include<sstream>
+#include<algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include<windows.h>
+#include<psapi.h>
+#pragma comment( lib , "psapi.lib" )
+#else
+#include<sys/resource.h>
+#endif
+#ifdef __linux__
+#include<linux/perf_event.h>
+#include<sys/syscall.h>
+#include<sys/ioctl.h>
+#include<unistd.h>
+#include<cstring>
+#endif
+
+const int STD_BENCHMARK_COUNT = 64;
+const int STD_BENCHMARK_WIDTH = 320;
+const int STD_BENCHMARK_HEIGHT = 180;
+const double STD_BENCHMARK_TOLERANCE = 0.1;
+const double BENCHMARK_MOVE_STEP = 0.25; //largest per-axis drift of a moving primitive per frame
+
+static long long PeakRss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess() , &pmc , sizeof( pmc ) ) ) return 0;
+	return ( long long ) pmc.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF , &usage ) != 0 ) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+//resident now, unlike the peak this drops again when a scene is freed
+static long long CurrentRss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess() , &pmc , sizeof( pmc ) ) ) return 0;
+	return ( long long ) pmc.WorkingSetSize / 1024;
+#else
+	FILE* fin = fopen( "/proc/self/statm" , "r" );
+	if ( fin == NULL ) return 0;
+	long long pages = 0 , resident = 0;
+	if ( fscanf( fin , "%lld %lld" , &pages , &resident ) != 2 ) resident = 0;
+	fclose( fin );
+	return resident * 4;
+#endif
+}
+
+//counts for this process and the threads it starts from now on, -1 where there are no perf events (other systems, most VMs and containers)
+static int StartHardwareCounter( HardwareCounter counter ) {
+#ifdef __linux__
+	if ( counter == COUNTER_NONE ) return -1;
+	struct perf_event_attr attr;
+	memset( &attr , 0 , sizeof( attr ) );
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof( attr );
+	attr.config = ( counter == COUNTER_BRANCH_MISSES ) ? PERF_COUNT_HW_BRANCH_MISSES : PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	int fd = ( int ) syscall( __NR_perf_event_open , &attr , 0 , -1 , -1 , 0 );
+	if ( fd >= 0 ) ioctl( fd , PERF_EVENT_IOC_ENABLE , 0 );
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+//the threads that counted must have exited, their counts are added to the parent then
+static long long StopHardwareCounter( int fd ) {
+#ifdef __linux__
+	if ( fd < 0 ) return -1;
+	long long count = -1;
+	ioctl( fd , PERF_EVENT_IOC_DISABLE , 0 );
+	if ( read( fd , &count , sizeof( count ) ) != sizeof( count ) ) count = -1;
+	close( fd );
+	return count;
+#else
+	return -1;
+#endif
+}
+
+static bool FileExists( std::string file ) {
+	FILE* fin = fopen( file.c_str() , "rb" );
+	if ( fin == NULL ) return false;
+	fclose( fin );
+	return true;
+}
+
+static std::string ImageName( std::string scene ) {
+	return "benchmark_" + scene + ".bmp";
+}
+
+static long long FileSize( std::string file ) {
+	FILE* fin = fopen( file.c_str() , "rb" );
+	if ( fin == NULL ) return 0;
+	fseek( fin , 0 , SEEK_END );
+	long long size = ftell( fin );
+	fclose( fin );
+	return size;
+}
+
+static unsigned int Checksum( std::string file ) {
+	unsigned int hash = 2166136261u;
+	FILE* fin = fopen( file.c_str() , "rb" );
+	if ( fin == NULL ) return 0;
+	int c;
+	while ( ( c = fgetc( fin ) ) != EOF )
+		hash = ( hash ^ ( unsigned int ) c ) * 16777619u;
+	fclose( fin );
+	return hash;
+}
+
+//one of a few fixed looks, picked by k
+static void WriteMaterial( std::ostream& fout , int k , double r , double g , double b ) {
+	switch ( k % 4 ) {
+		case 0:
+			fout << "\tcolor= " << r << " " << g << " " << b << "\n\tdiff= 0.8\n\tspec= 0.2\n";
+			break;
+		case 1:
+			fout << "\tcolor= " << r << " " << g << " " << b << "\n\tdiff= 0.2\n\tspec= 0.2\n\trefl= 0.6\n";
+			break;
+		case 2:
+			fout << "\tcolor= 1 1 1\n\trefr= 1\n\trindex= 1.5\n\tabsor= " << 1 - r << " " << 1 - g << " " << 1 - b << "\n";
+			break;
+		default:
+			fout << "\tcolor= " << r << " " << g << " " << b << "\n\tdiff= 0.7\n\trefl= 0.3\n";
+	}
+}
+
+Benchmark::Benchmark() {
+	engine = "whitted";
+	count = STD_BENCHMARK_COUNT;
+	threads = 0;
+	spp = 0;
+	W = STD_BENCHMARK_WIDTH;
+	H = STD_BENCHMARK_HEIGHT;
+	tolerance = STD_BENCHMARK_TOLERANCE;
+	random_state = 1;
+}
+
+double Benchmark::Random() {
+	random_state = random_state * 1103515245u + 12345u;
+	return ( double ) ( ( random_state >> 8 ) & 0xffff ) / 65536;
+}
+
+std::vector<std::string> Benchmark::GetSceneNames() {
+	std::vector<std::string> names;
+	names.push_back( "spheres" );
+	names.push_back( "cornell" );
+	names.push_back( "glass" );
+	names.push_back( "textured" );
+	names.push_back( "lathes" );
+	names.push_back( "cubes" );
+	return names;
+}
+
+void Benchmark::WriteCamera( std::ostream& fout , double ox , double oy , double oz , double tx , double ty , double tz ) {
+	fout << "background\n\tcolor= 0.1 0.1 0.1\nend\n\n";
+	fout << "camera\n";
+	fout << "\tO= " << ox << " " << oy << " " << oz << "\n";
+	fout << "\tN= " << tx - ox << " " << ty - oy << " " << tz - oz << "\n";
+	fout << "\tshade_quality= 1\n\tdrefl_quality= 1\n";
+	fout << "\timage_H= " << H << "\n\timage_W= " << W << "\n";
+	fout << "\tlens_H= " << ( double ) H / W << "\n\tlens_W= 1.0\n";
+	fout << "end\n\n";
+}
+
+//n x n grid of spheres over a mirror-ish floor
+void Benchmark::WriteSpheres( std::ostream& fout ) {
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	WriteCamera( fout , 0 , -1.3 * n , 0.9 * n , 0 , 0 , 0 );
+	fout << "light point\n\tO= " << n << " " << -n << " " << 2 * n << "\n\tcolor= 1.5 1.5 1.5\nend\n\n";
+	fout << "light sphere\n\tO= " << -n << " 0 " << n << "\n\tR= 0.3\n\tcolor= 0.6 0.6 0.6\nend\n\n";
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0;
+		fout << "primitive sphere\n\tO= " << x << " " << y << " 0\n\tR= 0.4\n";
+		WriteMaterial( fout , k , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() );
+		fout << "end\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= -0.4\n\tcolor= 1 1 1\n\tdiff= 0.7\n\trefl= 0.3\nend\n";
+}
+
+//open box with two area lights and spheres and cubes on the floor
+void Benchmark::WriteCornell( std::ostream& fout ) {
+	WriteCamera( fout , 0 , -3.4 , 1 , 0 , 0 , 1 );
+	fout << "light square\n\tO= -0.4 0 1.99\n\tDx= 0.25 0 0\n\tDy= 0 0.25 0\n\tcolor= 1 1 1\nend\n\n";
+	fout << "light square\n\tO= 0.4 0 1.99\n\tDx= 0.25 0 0\n\tDy= 0 0.25 0\n\tcolor= 1 0.9 0.8\nend\n\n";
+	const char* walls[5][4] = {
+		{ "0 0 0" , "1 0 0" , "0 1 0" , "0.8 0.8 0.8" } ,
+		{ "0 0 2" , "1 0 0" , "0 1 0" , "0.8 0.8 0.8" } ,
+		{ "0 1 1" , "1 0 0" , "0 0 1" , "0.8 0.8 0.8" } ,
+		{ "-1 0 1" , "0 1 0" , "0 0 1" , "0.8 0.2 0.2" } ,
+		{ "1 0 1" , "0 1 0" , "0 0 1" , "0.2 0.8 0.2" }
+	};
+	for ( int w = 0 ; w < 5 ; w++ )
+		fout << "primitive square\n\tO= " << walls[w][0] << "\n\tDx= " << walls[w][1] << "\n\tDy= " << walls[w][2] << "\n\tcolor= " << walls[w][3] << "\n\tdiff= 1\nend\n\n";
+
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	double cell = 1.8 / n , size = cell * 0.35;
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = -0.9 + cell * ( k % n + 0.5 ) , y = -0.9 + cell * ( k / n + 0.5 );
+		if ( k % 2 == 0 ) {
+			fout << "primitive sphere\n\tO= " << x << " " << y << " " << size << "\n\tR= " << size << "\n";
+		} else {
+			double angle = Random() * PI;
+			fout << "primitive cube\n\tO= " << x << " " << y << " " << size << "\n";
+			fout << "\tDx= " << cos( angle ) << " " << sin( angle ) << " 0\n\tDy= " << -sin( angle ) << " " << cos( angle ) << " 0\n";
+			fout << "\tx= " << size << "\n\ty= " << size << "\n\tz= " << size << "\n";
+		}
+		WriteMaterial( fout , k / 2 , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() );
+		fout << "end\n\n";
+	}
+}
+
+//groups of three concentric spheres :: two glass shells around a coloured core
+void Benchmark::WriteGlass( std::ostream& fout ) {
+	int groups = std::max( count / 3 , 1 );
+	int n = std::max( ( int ) ceil( sqrt( ( double ) groups ) ) , 1 );
+	WriteCamera( fout , 0 , -1.4 * n , 0.8 * n , 0 , 0 , 0 );
+	fout << "light point\n\tO= " << -n << " " << -n << " " << 2 * n << "\n\tcolor= 1.5 1.5 1.5\nend\n\n";
+	for ( int k = 0 ; k < groups ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0;
+		fout << "primitive sphere\n\tO= " << x << " " << y << " 0\n\tR= 0.45\n\tcolor= 1 1 1\n\trefr= 0.9\n\trefl= 0.1\n\trindex= 1.5\nend\n\n";
+		fout << "primitive sphere\n\tO= " << x << " " << y << " 0\n\tR= 0.3\n\tcolor= 1 1 1\n\trefr= 1\n\trindex= 1.33\n\tabsor= " << Random() << " " << Random() << " 0.2\nend\n\n";
+		fout << "primitive sphere\n\tO= " << x << " " << y << " 0\n\tR= 0.12\n\tcolor= " << Random() << " " << Random() << " 0.8\n\tdiff= 1\nend\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= -0.45\n\tcolor= 0.9 0.9 0.9\n\tdiff= 1\nend\n";
+}
+
+//tilted textured panels over a textured floor, textures are looked up in the working directory
+void Benchmark::WriteTextured( std::ostream& fout ) {
+	const char* textures[3] = { "marble.bmp" , "floor.bmp" , "blackwhite.bmp" };
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	WriteCamera( fout , 0 , -1.3 * n , 0.9 * n , 0 , 0 , 0 );
+	fout << "light point\n\tO= " << n << " " << -n << " " << 2 * n << "\n\tcolor= 1.5 1.5 1.5\nend\n\n";
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0;
+		double tilt = ( Random() - 0.5 ) * 0.8;
+		fout << "primitive square\n\tO= " << x << " " << y << " 0\n\tDx= 0.4 0 0\n\tDy= 0 " << 0.4 * cos( tilt ) << " " << 0.4 * sin( tilt ) << "\n";
+		fout << "\tcolor= 1 1 1\n\tdiff= 0.8\n\tspec= 0.2\n\ttexture= " << textures[k % 3] << "\nend\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= -0.5\n\tcolor= 1 1 1\n\tdiff= 0.6\n\trefl= 0.4\n\ttexture= floor.bmp\n\tDx= 4 0 0\n\tDy= 0 4 0\nend\n";
+}
+
+//vases of revolution with cubic profiles
+void Benchmark::WriteLathes( std::ostream& fout ) {
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	WriteCamera( fout , 0 , -1.3 * n , 0.9 * n , 0 , 0 , 0 );
+	fout << "light point\n\tO= " << -n << " " << -n << " " << 2 * n << "\n\tcolor= 1.5 1.5 1.5\nend\n\n";
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0;
+		fout << "primitive bezier\n\tO1= " << x << " " << y << " -0.4\n\tO2= " << x << " " << y << " " << 0.2 + 0.4 * Random() << "\n";
+		fout << "\tP= 0 0.05\n\tP= 0.33 " << 0.2 + 0.2 * Random() << "\n\tP= 0.66 " << 0.05 + 0.2 * Random() << "\n\tP= 1 " << 0.1 + 0.15 * Random() << "\n";
+		fout << "\tCylinder\n";
+		WriteMaterial( fout , ( k % 2 ) * 3 , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() );
+		fout << "end\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= -0.4\n\tcolor= 1 1 1\n\tdiff= 1\nend\n";
+}
+
+//columns of rotated boxes
+void Benchmark::WriteCubes( std::ostream& fout ) {
+	int columns = std::max( ( int ) ceil( sqrt( ( double ) count / 4 ) ) , 1 );
+	int n = std::max( ( int ) ceil( sqrt( ( double ) columns ) ) , 1 );
+	int height = ( count + columns - 1 ) / columns;
+	WriteCamera( fout , 0 , -1.6 * n , 0.25 * height + 0.6 * n , 0 , 0 , 0.1 * height );
+	fout << "light point\n\tO= " << n << " " << -n << " " << 0.3 * height + n << "\n\tcolor= 1.5 1.5 1.5\nend\n\n";
+	for ( int k = 0 ; k < count ; k++ ) {
+		int c = k / height , level = k % height;
+		double x = c % n - ( n - 1 ) / 2.0 , y = c / n - ( n - 1 ) / 2.0;
+		double angle = Random() * PI / 2;
+		fout << "primitive cube\n\tO= " << x << " " << y << " " << 0.1 + 0.2 * level << "\n";
+		fout << "\tDx= " << cos( angle ) << " " << sin( angle ) << " 0\n\tDy= " << -sin( angle ) << " " << cos( angle ) << " 0\n";
+		fout << "\tx= 0.25\n\ty= 0.25\n\tz= 0.1\n";
+		WriteMaterial( fout , k , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() , 0.3 + 0.7 * Random() );
+		fout << "end\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= 0\n\tcolor= 1 1 1\n\tdiff= 1\nend\n";
+}
+
+//diffuse spheres on a floor under a garland of point lights sharing a fixed total power
+void Benchmark::WriteLightString( std::ostream& fout , int lights , int light_samples ) {
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	WriteCamera( fout , 0 , -1.3 * n , 0.9 * n , 0 , 0 , 0 );
+	fout << "camera\n\tlight_samples= " << light_samples << "\nend\n\n";
+	double power = 1.2 / lights;
+	for ( int k = 0 ; k < lights ; k++ ) {
+		double t = ( k + 0.5 ) / lights;
+		fout << "light point\n\tO= " << ( t - 0.5 ) * 1.5 * n << " " << sin( t * 6 * PI ) * 0.5 * n << " " << 0.6 * n + 0.15 * n * cos( t * 10 * PI ) << "\n";
+		fout << "\tcolor= " << power << " " << power * ( 0.8 + 0.2 * Random() ) << " " << power * ( 0.6 + 0.4 * Random() ) << "\nend\n\n";
+	}
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0;
+		fout << "primitive sphere\n\tO= " << x << " " << y << " 0\n\tR= 0.4\n";
+		fout << "\tcolor= " << 0.3 + 0.7 * Random() << " " << 0.3 + 0.7 * Random() << " " << 0.3 + 0.7 * Random() << "\n\tdiff= 0.8\n\tspec= 0.2\n";
+		fout << "end\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= -0.4\n\tcolor= 1 1 1\n\tdiff= 1\nend\n";
+}
+
+//diffuse spheres on a floor under the sky, no other light
+void Benchmark::WriteEnvironment( std::ostream& fout , std::string skybox , int samples , std::string sampling ) {
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	WriteCamera( fout , 0 , -1.3 * n , 0.6 * n , 0 , 0 , 0 );
+	fout << "environment\n\tskybox= " << skybox << "\n\tsamples= " << samples << "\n\tsampling= " << sampling << "\nend\n\n";
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0;
+		fout << "primitive sphere\n\tO= " << x << " " << y << " 0\n\tR= 0.4\n";
+		fout << "\tcolor= " << 0.3 + 0.7 * Random() << " " << 0.3 + 0.7 * Random() << " " << 0.3 + 0.7 * Random() << "\n\tdiff= 1\n";
+		fout << "end\n\n";
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= -0.4\n\tcolor= 0.8 0.8 0.8\n\tdiff= 1\nend\n";
+}
+
+//a fractal terrain of cells x cells under one light, the same heights for either representation
+void Benchmark::WriteTerrain( std::ostream& fout , int cells , bool mesh ) {
+	WriteCamera( fout , -2 , -2 , 6 , 5 , 5 , 0 );
+	fout << "light point\n\tO= 12 -4 10\n\tcolor= 1.2 1.2 1.2\nend\n\n";
+	fout << "primitive heightfield\n\tO= 0 0 0\n\tsize= 10 10\n\theight= 3\n\tfractal= " << cells << " 7\n";
+	fout << "\tcolor= 0.7 0.6 0.4\n\tdiff= 0.9\n\tspec= 0.1\n\ttessellate= " << ( mesh ? 1 : 0 ) << "\nend\n";
+}
+
+//tubes standing on a floor, each an outer cylinder bored through by a longer thinner one
+void Benchmark::WriteTubes( std::ostream& fout , int segments ) {
+	int n = std::max( ( int ) ceil( sqrt( ( double ) count ) ) , 1 );
+	WriteCamera( fout , 0 , -1.2 * n , 1.1 * n , 0 , 0 , 0 );
+	fout << "light point\n\tO= " << -n << " " << -n << " " << 2 * n << "\n\tcolor= 1.5 1.5 1.5\nend\n\n";
+	const double R = 0.35 , r = 0.2;
+	for ( int k = 0 ; k < count ; k++ ) {
+		double x = k % n - ( n - 1 ) / 2.0 , y = k / n - ( n - 1 ) / 2.0 , h = 0.3 + 0.5 * Random();
+		double cr = 0.3 + 0.7 * Random() , cg = 0.3 + 0.7 * Random() , cb = 0.3 + 0.7 * Random();
+		if ( segments == 0 ) {
+			fout << "primitive cylinder\n\tname= tube" << k << "\n\tO1= " << x << " " << y << " 0\n\tO2= " << x << " " << y << " " << h << "\n\tR= " << R << "\nend\n\n";
+			fout << "primitive cylinder\n\tname= bore" << k << "\n\tO1= " << x << " " << y << " -0.1\n\tO2= " << x << " " << y << " " << h + 0.1 << "\n\tR= " << r << "\nend\n\n";
+			fout << "primitive csg\n\toperation= difference\n\ta= tube" << k << "\n\tb= bore" << k << "\n";
+			WriteMaterial( fout , 0 , cr , cg , cb );
+			fout << "end\n\n";
+			continue;
+		}
+		//outer and inner walls, top and bottom rings :: eight triangles a segment
+		for ( int s = 0 ; s < segments ; s++ ) {
+			double a0 = 2 * PI * s / segments , a1 = 2 * PI * ( s + 1 ) / segments;
+			Vector3 P[2][2][2]; //radius, angle, height
+			for ( int i = 0 ; i < 2 ; i++ )
+				for ( int j = 0 ; j < 2 ; j++ )
+					for ( int l = 0 ; l < 2 ; l++ ) {
+						double rad = i ? r : R , ang = j ? a1 : a0;
+						P[i][j][l] = Vector3( x + rad * cos( ang ) , y + rad * sin( ang ) , l * h );
+					}
+			Vector3 quads[4][4] = {
+				{ P[0][0][0] , P[0][1][0] , P[0][1][1] , P[0][0][1] } , { P[1][0][0] , P[1][0][1] , P[1][1][1] , P[1][1][0] } ,
+				{ P[0][0][1] , P[0][1][1] , P[1][1][1] , P[1][0][1] } , { P[0][0][0] , P[1][0][0] , P[1][1][0] , P[0][1][0] }
+			};
+			for ( int q = 0 ; q < 4 ; q++ )
+				for ( int t = 0 ; t < 2 ; t++ ) {
+					Vector3 A = quads[q][0] , B = quads[q][t + 1] , C = quads[q][t + 2];
+					fout << "primitive triangle\n\tP1= " << A.x << " " << A.y << " " << A.z << "\n\tP2= " << B.x << " " << B.y << " " << B.z;
+					fout << "\n\tP3= " << C.x << " " << C.y << " " << C.z << "\n";
+					WriteMaterial( fout , 0 , cr , cg , cb );
+					fout << "end\n\n";
+				}
+		}
+	}
+	fout << "primitive plane\n\tN= 0 0 1\n\tR= 0\n\tcolor= 1 1 1\n\tdiff= 1\nend\n";
+}
+
+bool Benchmark::GenerateScene( std::string name , std::ostream& fout ) {
+	random_state = 1;
+	for ( int k = 0 ; k < ( int ) name.size() ; k++ )
+		random_state = random_state * 31 + name[k];
+	if ( name == "spheres" ) WriteSpheres( fout ); else
+	if ( name == "cornell" ) WriteCornell( fout ); else
+	if ( name == "glass" ) WriteGlass( fout ); else
+	if ( name == "textured" ) WriteTextured( fout ); else
+	if ( name == "lathes" ) WriteLathes( fout ); else
+	if ( name == "cubes" ) WriteCubes( fout ); else
+		return false;
+	return true;
+}
+
+//the scaffold every mode shares :: writes benchmark_<run>.txt, lets configure set the raytracer up, parses the scene and
+//renders it frames times, then hands the raytracer to inspect before deleting it
+GeneratedRender Benchmark::RenderGenerated( std::string run , std::function<void( std::ostream& )> write , std::function<void( Raytracer* )> configure ,
+	std::function<void( Raytracer* )> inspect , std::string engine , HardwareCounter counter , int frames ) {
+	std::string input = "benchmark_" + run + ".txt";
+	std::ofstream fout( input.c_str() );
+	write( fout );
+	fout.close();
+
+	long long rss = CurrentRss();
+	Raytracer* raytracer = new Raytracer;
+	raytracer->SetInput( input );
+	raytracer->SetOutput( ImageName( run ) );
+	raytracer->SetThreads( threads );
+	if ( configure ) configure( raytracer );
+
+	GeneratedRender render;
+	render.rays = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	raytracer->CreateAll();
+	std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+	int fd = StartHardwareCounter( counter );
+	for ( int frame = 0 ; frame < frames ; frame++ ) {
+		if ( engine == "wavefront" ) raytracer->WavefrontRun(); else
+		if ( engine == "path" ) raytracer->PathTraceRun(); else
+			raytracer->MultiThreadRun();
+		render.rays += raytracer->GetTracedRays();
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	render.counter = StopHardwareCounter( fd );
+	render.setup_seconds = std::chrono::duration<double>( built - start ).count();
+	render.seconds = std::chrono::duration<double>( end - built ).count();
+	render.primitives = raytracer->GetScene()->GetPrimitiveCount();
+	render.memory = CurrentRss() - rss;
+
+	if ( inspect ) inspect( raytracer );
+	std::string output = raytracer->GetOutput();
+	delete raytracer;
+	render.checksum = Checksum( output );
+	return render;
+}
+
+bool Benchmark::Run( std::string name ) {
+	std::vector<std::string> names = GetSceneNames();
+	if ( name != "all" ) {
+		if ( std::find( names.begin() , names.end() , name ) == names.end() ) return false;
+		names.assign( 1 , name );
+	}
+
+	for ( int k = 0 ; k < ( int ) names.size() ; k++ ) {
+		GeneratedRender render = RenderGenerated( names[k] , [&]( std::ostream& fout ) { GenerateScene( names[k] , fout ); } ,
+			[&]( Raytracer* raytracer ) { raytracer->SetSpp( spp ); } , nullptr , engine );
+
+		BenchmarkResult result;
+		result.scene = names[k];
+		result.primitives = render.primitives;
+		result.rays = render.rays;
+		result.seconds = render.setup_seconds + render.seconds;
+		result.mrays = result.rays / result.seconds / 1e6;
+		result.peak_rss = PeakRss();
+		result.checksum = render.checksum;
+		results.push_back( result );
+	}
+	return true;
+}
+
+bool Benchmark::Animate( std::string name , int frames ) {
+	std::vector<std::string> names = GetSceneNames();
+	if ( name != "all" ) {
+		if ( std::find( names.begin() , names.end() , name ) == names.end() ) return false;
+		names.assign( 1 , name );
+	}
+
+	const double fractions[2] = { 0.01 , 0.1 };
+	for ( int k = 0 ; k < ( int ) names.size() ; k++ ) {
+		std::string input = "benchmark_" + names[k] + ".txt" , output = ImageName( names[k] );
+		std::ofstream fout( input.c_str() );
+		GenerateScene( names[k] , fout );
+		fout.close();
+
+		for ( int f = 0 ; f < 2 ; f++ )
+			for ( int mode = 0 ; mode < 2 ; mode++ ) {
+				Raytracer* raytracer = new Raytracer;
+				raytracer->SetInput( input );
+				raytracer->SetOutput( output );
+				raytracer->SetThreads( threads );
+				raytracer->SetSpp( spp );
+				raytracer->CreateAll();
+				Scene* scene = raytracer->GetScene();
+				scene->SetRefit( mode == 0 );
+
+				//the same primitives and velocities for both modes
+				std::vector<Primitive*> bounded;
+				for ( Primitive* now = scene->GetPrimitiveHead() ; now != NULL ; now = now->GetNext() ) {
+					Vector3 lo , hi;
+					if ( !now->IsLightPrimitive() && now->GetBounds( lo , hi ) ) bounded.push_back( now );
+				}
+				random_state = 7 + f;
+				int n = std::min( std::max( ( int ) ( bounded.size() * fractions[f] + 0.5 ) , 1 ) , ( int ) bounded.size() );
+				std::vector<Primitive*> moving;
+				std::vector<Vector3> velocity;
+				for ( int m = 0 ; m < n ; m++ ) {
+					int pick = m + ( int ) ( Random() * ( bounded.size() - m ) );
+					std::swap( bounded[m] , bounded[pick] );
+					moving.push_back( bounded[m] );
+					velocity.push_back( Vector3( Random() - 0.5 , Random() - 0.5 , Random() - 0.5 ) * 2 * BENCHMARK_MOVE_STEP );
+				}
+
+				AnimationResult result;
+				result.scene = names[k];
+				result.moving = ( double ) n / std::max( ( int ) bounded.size() , 1 );
+				result.refit = ( mode == 0 );
+				result.frames = frames;
+				result.update_seconds = result.render_seconds = 0;
+				long long rays = 0;
+				for ( int frame = 0 ; frame < frames ; frame++ ) {
+					std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+					for ( int m = 0 ; m < n ; m++ )
+						scene->Translate( moving[m] , velocity[m] );
+					scene->Update();
+					std::chrono::steady_clock::time_point updated = std::chrono::steady_clock::now();
+					result.update_seconds += std::chrono::duration<double>( updated - start ).count();
+
+					if ( engine == "wavefront" ) raytracer->WavefrontRun(); else
+					if ( engine == "path" ) raytracer->PathTraceRun(); else
+						raytracer->MultiThreadRun();
+					result.render_seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - updated ).count();
+					rays += raytracer->GetTracedRays();
+				}
+				result.mrays = rays / std::max( result.render_seconds , 1e-9 ) / 1e6;
+				result.update_seconds /= std::max( frames , 1 );
+				result.render_seconds /= std::max( frames , 1 );
+				result.refits = scene->GetRefits();
+				result.rebuilds = scene->GetRebuilds();
+				animation_results.push_back( result );
+				delete raytracer;
+			}
+	}
+	return true;
+}
+
+void Benchmark::ManyLights( int light_samples ) {
+	const int light_counts[3] = { 1 , 100 , 10000 };
+	for ( int c = 0 ; c < 3 ; c++ )
+		for ( int mode = 0 ; mode < 2 ; mode++ ) {
+			std::string name = "lights" + std::to_string( light_counts[c] ) + ( ( mode == 0 ) ? "_all" : "_tree" );
+			GeneratedRender render = RenderGenerated( name , [&]( std::ostream& fout ) {
+				random_state = 11;
+				WriteLightString( fout , light_counts[c] , mode == 0 ? 0 : light_samples );
+			} );
+
+			LightResult result;
+			result.lights = light_counts[c];
+			result.light_samples = ( mode == 0 ) ? 0 : light_samples;
+			result.seconds = render.setup_seconds + render.seconds;
+			result.mrays = render.rays / result.seconds / 1e6;
+			result.rmse = 0;
+
+			if ( mode == 1 ) {
+				Bmp reference_bmp , image;
+				reference_bmp.Input( ImageName( "lights" + std::to_string( light_counts[c] ) + "_all" ) );
+				image.Input( ImageName( name ) );
+				ImageCompare compare;
+				ImageDiff diff = compare.Compare( &reference_bmp , &image , NULL );
+				result.rmse = diff.same_size ? 255 / pow( 10.0 , diff.psnr / 20 ) : -1;
+			}
+			light_results.push_back( result );
+		}
+}
+
+void Benchmark::EnvironmentConvergence( std::string skybox ) {
+	const int sample_counts[4] = { 1 , 4 , 16 , 64 };
+	const std::string modes[3] = { "uniform" , "cdf" , "mixed" };
+	const int reference_samples = 1024;
+	for ( int c = -1 ; c < 4 ; c++ )
+		for ( int mode = 0 ; mode < 3 ; mode++ ) {
+			if ( c < 0 && mode > 0 ) continue;
+			int samples = ( c < 0 ) ? reference_samples : sample_counts[c];
+			std::string name = ( c < 0 ) ? "environment_reference" : "environment" + std::to_string( samples ) + "_" + modes[mode];
+			GeneratedRender render = RenderGenerated( name , [&]( std::ostream& fout ) {
+				random_state = 13;
+				WriteEnvironment( fout , skybox , samples , ( c < 0 ) ? "mixed" : modes[mode] );
+			} );
+			if ( c < 0 ) continue;
+
+			EnvironmentResult result;
+			result.samples = samples;
+			result.sampling = modes[mode];
+			result.seconds = render.setup_seconds + render.seconds;
+			Bmp reference_bmp , image;
+			reference_bmp.Input( ImageName( "environment_reference" ) );
+			image.Input( ImageName( name ) );
+			ImageCompare compare;
+			ImageDiff diff = compare.Compare( &reference_bmp , &image , NULL );
+			result.rmse = diff.same_size ? 255 / pow( 10.0 , diff.psnr / 20 ) : -1;
+			environment_results.push_back( result );
+		}
+}
+
+//the reference draws from rand(), so it shares no points with the low discrepancy runs
+bool Benchmark::SamplerConvergence( std::string name ) {
+	const int sample_counts[4] = { 1 , 4 , 16 , 64 };
+	const std::string samplers[3] = { "random" , "halton" , "sobol" };
+	const int reference_spp = 1024;
+	std::vector<std::string> names = GetSceneNames();
+	if ( std::find( names.begin() , names.end() , name ) == names.end() ) return false;
+	for ( int c = -1 ; c < 4 ; c++ )
+		for ( int s = 0 ; s < 3 ; s++ ) {
+			if ( c < 0 && s > 0 ) continue;
+			int samples = ( c < 0 ) ? reference_spp : sample_counts[c];
+			std::string run = ( c < 0 ) ? name + "_reference" : name + std::to_string( samples ) + "_" + samplers[s];
+			GeneratedRender render = RenderGenerated( run , [&]( std::ostream& fout ) {
+				GenerateScene( name , fout );
+				fout << "\ncamera\n\tsampler= " << samplers[s] << "\nend\n";
+			} , [&]( Raytracer* raytracer ) { raytracer->SetSpp( samples ); } , nullptr , "path" );
+			if ( c < 0 ) continue;
+
+			SamplerResult result;
+			result.sampler = samplers[s];
+			result.spp = samples;
+			result.seconds = render.setup_seconds + render.seconds;
+			Bmp reference_bmp , image;
+			reference_bmp.Input( ImageName( name + "_reference" ) );
+			image.Input( ImageName( run ) );
+			ImageCompare compare;
+			ImageDiff diff = compare.Compare( &reference_bmp , &image , NULL );
+			result.rmse = diff.same_size ? 255 / pow( 10.0 , diff.psnr / 20 ) : -1;
+			sampler_results.push_back( result );
+		}
+	return true;
+}
+
+bool Benchmark::ShadingKernels( std::string name ) {
+	std::vector<std::string> names = GetSceneNames();
+	if ( name != "all" ) {
+		if ( std::find( names.begin() , names.end() , name ) == names.end() ) return false;
+		names.assign( 1 , name );
+	}
+
+	for ( int k = 0 ; k < ( int ) names.size() ; k++ )
+		for ( int specialized = 0 ; specialized < 2 ; specialized++ ) {
+			std::string run = names[k] + ( specialized ? "_specialized" : "_generic" );
+			GeneratedRender render = RenderGenerated( run , [&]( std::ostream& fout ) { GenerateScene( names[k] , fout ); } ,
+				[&]( Raytracer* raytracer ) { raytracer->SetSpecializedShading( specialized == 1 ); } , nullptr , "whitted" , COUNTER_BRANCH_MISSES );
+
+			KernelResult result;
+			result.scene = names[k];
+			result.specialized = ( specialized == 1 );
+			result.seconds = render.seconds;
+			result.branch_misses = render.counter;
+			result.checksum = render.checksum;
+			kernel_results.push_back( result );
+		}
+	return true;
+}
+
+bool Benchmark::TileOrders( std::string name ) {
+	std::vector<std::string> names = GetSceneNames();
+	if ( name != "all" ) {
+		if ( std::find( names.begin() , names.end() , name ) == names.end() ) return false;
+		names.assign( 1 , name );
+	}
+
+	for ( int k = 0 ; k < ( int ) names.size() ; k++ )
+		for ( int hilbert = 0 ; hilbert < 2 ; hilbert++ ) {
+			std::string run = names[k] + ( hilbert ? "_hilbert" : "_scanline" );
+			GeneratedRender render = RenderGenerated( run , [&]( std::ostream& fout ) { GenerateScene( names[k] , fout ); } ,
+				[&]( Raytracer* raytracer ) { raytracer->SetTileOrder( hilbert ? TILE_HILBERT : TILE_SCANLINE ); } , nullptr , "whitted" , COUNTER_CACHE_MISSES );
+
+			TileOrderResult result;
+			result.scene = names[k];
+			result.hilbert = ( hilbert == 1 );
+			result.seconds = render.seconds;
+			result.mrays = render.rays / render.seconds / 1e6;
+			result.cache_misses = render.counter;
+			tile_results.push_back( result );
+		}
+	return true;
+}
+
+void Benchmark::CsgTubes( int segments ) {
+	std::vector<bool> on_tube; //camera rays of the CSG render that hit a tube
+	std::vector<int> runs( 1 , 0 );
+	for ( int n = 16 ; n <= segments ; n *= 4 )
+		runs.push_back( n );
+
+	for ( int k = 0 ; k < ( int ) runs.size() ; k++ ) {
+		std::string name = ( runs[k] == 0 ) ? "tubes_csg" : "tubes_mesh" + std::to_string( runs[k] );
+		CsgResult result;
+		//the intersection alone, over the same camera rays for every run
+		GeneratedRender render = RenderGenerated( name , [&]( std::ostream& fout ) {
+			random_state = 1;
+			WriteTubes( fout , runs[k] );
+		} , nullptr , [&]( Raytracer* raytracer ) {
+			Camera* camera = raytracer->GetCamera();
+			Scene* scene = raytracer->GetScene();
+			int H = camera->GetH() , W = camera->GetW() , hits = 0;
+			if ( runs[k] == 0 ) {
+				on_tube.assign( H * W , false );
+				for ( int i = 0 ; i < H ; i++ )
+					for ( int j = 0 ; j < W ; j++ ) {
+						CollidePrimitive hit = scene->FindNearestPrimitiveGetCollide( camera->GetO() , camera->Emit( i , j ) );
+						on_tube[i * W + j] = hit.isCollide && dynamic_cast<Csg*>( hit.collide_primitive ) != NULL;
+					}
+			}
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for ( int i = 0 ; i < H ; i++ )
+				for ( int j = 0 ; j < W ; j++ )
+					if ( on_tube[i * W + j] ) {
+						scene->FindNearestPrimitiveGetCollide( camera->GetO() , camera->Emit( i , j ) );
+						hits++;
+					}
+			double trace = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+			result.hit_us = trace / std::max( hits , 1 ) * 1e6;
+		} );
+
+		result.segments = runs[k];
+		result.primitives = render.primitives;
+		result.setup_seconds = render.setup_seconds;
+		result.render_seconds = render.seconds;
+		result.memory = render.memory;
+		Bmp reference , image;
+		reference.Input( ImageName( "tubes_csg" ) );
+		image.Input( ImageName( name ) );
+		ImageCompare compare;
+		ImageDiff diff = compare.Compare( &reference , &image , NULL );
+		result.psnr = diff.same_size ? diff.psnr : 0;
+		csg_results.push_back( result );
+	}
+}
+
+void Benchmark::ImageOutput( int frames ) {
+	const char* formats[2] = { "bmp" , "qoi" };
+	for ( int f = 0 ; f < 2 ; f++ )
+		for ( int async = 0 ; async < 2 ; async++ ) {
+			std::string output = std::string( "benchmark_output." ) + formats[f];
+			ImageOutputResult result;
+			double output_seconds = 0;
+			GeneratedRender render = RenderGenerated( "output" , [&]( std::ostream& fout ) { GenerateScene( "cubes" , fout ); } ,
+				[&]( Raytracer* raytracer ) {
+					raytracer->SetAsyncOutput( async == 1 );
+					raytracer->SetOutput( output );
+				} , [&]( Raytracer* raytracer ) {
+					//the last frame is only done once it is on disk
+					std::chrono::steady_clock::time_point flush = std::chrono::steady_clock::now();
+					ImageWriter* writer = raytracer->GetImageWriter();
+					if ( writer != NULL ) writer->Flush();
+					double flush_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - flush ).count();
+					output_seconds = raytracer->GetOutputSeconds();
+					result.output_seconds = ( output_seconds + flush_seconds ) / frames;
+					result.write_seconds = ( writer != NULL ) ? writer->GetWriteSeconds() / frames : result.output_seconds;
+				} , "whitted" , COUNTER_NONE , frames );
+
+			result.format = formats[f];
+			result.async = ( async == 1 );
+			result.frames = frames;
+			result.render_seconds = ( render.seconds - output_seconds ) / frames;
+			result.bytes = FileSize( output );
+			output_results.push_back( result );
+		}
+}
+
+void Benchmark::TextureFilter() {
+	const int scale = 4;
+	int w = W , h = H;
+	for ( int run = -1 ; run < 2 ; run++ ) {
+		std::string name = ( run < 0 ) ? "texture_reference" : ( run == 0 ) ? "texture_point" : "texture_filtered";
+		GeneratedRender render = RenderGenerated( name , [&]( std::ostream& fout ) {
+			if ( run < 0 ) SetSize( w * scale , h * scale );
+			random_state = 1;
+			WriteTextured( fout );
+			fout << "\ncamera\n\ttexture_filter= " << ( run > 0 ) << "\nend\n";
+			SetSize( w , h );
+		} );
+		if ( run < 0 ) continue;
+
+		//the reference boxed down to the benchmark size
+		Bmp large , reference( h , w ) , image;
+		large.Input( ImageName( "texture_reference" ) );
+		for ( int i = 0 ; i < h ; i++ )
+			for ( int j = 0 ; j < w ; j++ ) {
+				Color sum;
+				for ( int a = 0 ; a < scale ; a++ )
+					for ( int b = 0 ; b < scale ; b++ )
+						sum += large.GetColor( i * scale + a , j * scale + b );
+				reference.SetColor( i , j , sum / ( scale * scale ) );
+			}
+		image.Input( ImageName( name ) );
+		ImageCompare compare;
+		ImageDiff diff = compare.Compare( &reference , &image , NULL );
+
+		TextureFilterResult result;
+		result.filtered = ( run > 0 );
+		result.rays = render.rays;
+		result.seconds = render.setup_seconds + render.seconds;
+		result.psnr = diff.same_size ? diff.psnr : 0;
+		texture_results.push_back( result );
+	}
+}
+
+void Benchmark::Terrain( int cells , int mesh_cells ) {
+	for ( int n = std::min( 256 , cells ) ; n <= cells ; n *= 4 )
+		for ( int mode = 0 ; mode < 2 ; mode++ ) {
+			if ( mode == 1 && n > mesh_cells ) continue;
+			std::string name = "terrain" + std::to_string( n ) + ( mode == 0 ? "_heightfield" : "_mesh" );
+			TerrainResult result;
+			//the intersection alone, the renders are mostly shading
+			GeneratedRender render = RenderGenerated( name , [&]( std::ostream& fout ) { WriteTerrain( fout , n , mode == 1 ); } , nullptr ,
+				[&]( Raytracer* raytracer ) {
+					Camera* camera = raytracer->GetCamera();
+					Scene* scene = raytracer->GetScene();
+					int hits = 0;
+					std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+					for ( int i = 0 ; i < camera->GetH() ; i++ )
+						for ( int j = 0 ; j < camera->GetW() ; j++ )
+							if ( scene->FindNearestPrimitiveGetCollide( camera->GetO() , camera->Emit( i , j ) ).isCollide ) hits++;
+					double trace = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+					result.trace_us = trace / std::max( camera->GetH() * camera->GetW() , 1 ) * 1e6;
+				} );
+
+			result.cells = n;
+			result.mesh = ( mode == 1 );
+			result.setup_seconds = render.setup_seconds;
+			result.render_seconds = render.seconds;
+			result.mrays = render.rays / render.seconds / 1e6;
+			result.memory = render.memory;
+			terrain_results.push_back( result );
+		}
+}
+
+void Benchmark::Print() {
+	if ( !csg_results.empty() ) {
+		printf( "%10s %11s %10s %10s %12s %8s %12s %10s\n" , "tubes" , "primitives" , "setup_s" , "render_s" , "hit_us" , "x_csg" , "memory_kB" , "PSNR" );
+		double csg = csg_results[0].hit_us;
+		for ( int k = 0 ; k < ( int ) csg_results.size() ; k++ ) {
+			CsgResult& r = csg_results[k];
+			std::string name = ( r.segments == 0 ) ? "csg" : "mesh" + std::to_string( r.segments );
+			printf( "%10s %11d %10.3f %10.3f %12.3f %7.2fx %12lld %10.2f\n" , name.c_str() , r.primitives , r.setup_seconds , r.render_seconds ,
+				r.hit_us , r.hit_us / std::max( csg , 1e-9 ) , r.memory , std::min( r.psnr , 999.99 ) );
+		}
+		return;
+	}
+	if ( !output_results.empty() ) {
+		//the synchronous run of a format comes first
+		printf( "%-6s %6s %8s %10s %10s %10s %12s\n" , "format" , "writer" , "render_s" , "output_ms" , "write_ms" , "saved_ms" , "kB/frame" );
+		double sync = 0;
+		for ( int k = 0 ; k < ( int ) output_results.size() ; k++ ) {
+			ImageOutputResult& r = output_results[k];
+			if ( !r.async ) sync = r.output_seconds;
+			printf( "%-6s %6s %8.3f %10.1f %10.1f %10.1f %12.0f\n" , r.format.c_str() , r.async ? "async" : "sync" , r.render_seconds ,
+				r.output_seconds * 1e3 , r.write_seconds * 1e3 , ( sync - r.output_seconds ) * 1e3 , r.bytes / 1024.0 );
+		}
+		return;
+	}
+	if ( !tile_results.empty() ) {
+		//the scanline run of a scene comes first
+		printf( "%-10s %10s %10s %10s %14s %8s\n" , "scene" , "order" , "seconds" , "MRays/s" , "llc_misses" , "speedup" );
+		double scanline = 0;
+		for ( int k = 0 ; k < ( int ) tile_results.size() ; k++ ) {
+			TileOrderResult& r = tile_results[k];
+			if ( !r.hilbert ) scanline = r.seconds;
+			std::string misses = ( r.cache_misses >= 0 ) ? std::to_string( r.cache_misses ) : "n/a";
+			printf( "%-10s %10s %10.3f %10.3f %14s %7.2fx\n" , r.scene.c_str() , r.hilbert ? "hilbert" : "scanline" , r.seconds , r.mrays ,
+				misses.c_str() , scanline / std::max( r.seconds , 1e-9 ) );
+		}
+		return;
+	}
+	if ( !kernel_results.empty() ) {
+		//the generic run of a scene comes first
+		printf( "%-10s %12s %10s %16s %8s  %s\n" , "scene" , "shading" , "seconds" , "branch_misses" , "speedup" , "image" );
+		const KernelResult* generic = NULL;
+		for ( int k = 0 ; k < ( int ) kernel_results.size() ; k++ ) {
+			KernelResult& r = kernel_results[k];
+			if ( !r.specialized ) generic = &r;
+			std::string misses = ( r.branch_misses >= 0 ) ? std::to_string( r.branch_misses ) : "n/a";
+			std::string image = ( generic == NULL || generic->checksum == r.checksum ) ? "same" : "DIFFERENT";
+			printf( "%-10s %12s %10.3f %16s %7.2fx  %s\n" , r.scene.c_str() , r.specialized ? "specialized" : "generic" , r.seconds , misses.c_str() ,
+				( generic != NULL ) ? generic->seconds / std::max( r.seconds , 1e-9 ) : 1.0 , image.c_str() );
+		}
+		return;
+	}
+	if ( !texture_results.empty() ) {
+		printf( "%10s %12s %10s %8s\n" , "textures" , "rays" , "seconds" , "PSNR" );
+		for ( int k = 0 ; k < ( int ) texture_results.size() ; k++ ) {
+			TextureFilterResult& r = texture_results[k];
+			printf( "%10s %12lld %10.3f %8.2f\n" , r.filtered ? "filtered" : "point" , r.rays , r.seconds , std::min( r.psnr , 999.99 ) );
+		}
+		//the first pass traces the same rays either way, the difference is resampling
+		if ( texture_results.size() == 2 ) {
+			long long saved = texture_results[0].rays - texture_results[1].rays;
+			printf( "filtering saved %lld resampling rays, %.1f%% of the point lookup render\n" , saved , 100.0 * saved / std::max( texture_results[0].rays , 1LL ) );
+		}
+		return;
+	}
+	if ( !sampler_results.empty() ) {
+		//random noise falls as 1/sqrt(spp) :: (random RMSE / RMSE)^2 is how many times more random samples the same noise takes
+		printf( "%8s %8s %10s %8s %14s\n" , "spp" , "sampler" , "seconds" , "RMSE" , "random_spp_x" );
+		double random_rmse = 0;
+		for ( int k = 0 ; k < ( int ) sampler_results.size() ; k++ ) {
+			SamplerResult& r = sampler_results[k];
+			if ( r.sampler == "random" ) random_rmse = r.rmse;
+			double ratio = random_rmse / std::max( r.rmse , 1e-9 );
+			printf( "%8d %8s %10.3f %8.3f %13.2fx\n" , r.spp , r.sampler.c_str() , r.seconds , r.rmse , ratio * ratio );
+		}
+		return;
+	}
+	if ( !terrain_results.empty() ) {
+		printf( "%8s %12s %10s %10s %10s %12s %12s\n" , "cells" , "primitive" , "setup_s" , "render_s" , "MRays/s" , "trace_us/ray" , "memory_kB" );
+		for ( int k = 0 ; k < ( int ) terrain_results.size() ; k++ ) {
+			TerrainResult& r = terrain_results[k];
+			printf( "%8d %12s %10.3f %10.3f %10.3f %12.3f %12lld\n" , r.cells , r.mesh ? "mesh" : "heightfield" , r.setup_seconds , r.render_seconds ,
+				r.mrays , r.trace_us , r.memory );
+		}
+		return;
+	}
+	if ( !environment_results.empty() ) {
+		//the uniform run with the same sample count comes first
+		printf( "%8s %9s %10s %8s %16s\n" , "samples" , "sampling" , "seconds" , "RMSE" , "uniform/RMSE" );
+		double uniform_rmse = 0;
+		for ( int k = 0 ; k < ( int ) environment_results.size() ; k++ ) {
+			EnvironmentResult& r = environment_results[k];
+			if ( r.sampling == "uniform" ) uniform_rmse = r.rmse;
+			printf( "%8d %9s %10.3f %8.3f %15.2fx\n" , r.samples , r.sampling.c_str() , r.seconds , r.rmse , uniform_rmse / std::max( r.rmse , 1e-9 ) );
+		}
+		return;
+	}
+	if ( !light_results.empty() ) {
+		printf( "%8s %14s %10s %10s %10s %8s\n" , "lights" , "light_samples" , "seconds" , "speedup" , "MRays/s" , "RMSE" );
+		for ( int k = 0 ; k < ( int ) light_results.size() ; k++ ) {
+			LightResult& r = light_results[k];
+			double speedup = ( r.light_samples > 0 && k > 0 ) ? light_results[k - 1].seconds / r.seconds : 1;
+			printf( "%8d %14s %10.3f %9.2fx %10.3f %8.3f\n" , r.lights , r.light_samples > 0 ? std::to_string( r.light_samples ).c_str() : "all" ,
+				r.seconds , speedup , r.mrays , r.rmse );
+		}
+		return;
+	}
+	if ( !animation_results.empty() ) {
+		printf( "%-10s %7s %8s %7s %9s %13s %13s %10s\n" , "scene" , "moving" , "mode" , "refits" , "rebuilds" , "update_ms/fr" , "render_s/fr" , "MRays/s" );
+		for ( int k = 0 ; k < ( int ) animation_results.size() ; k++ ) {
+			AnimationResult& r = animation_results[k];
+			printf( "%-10s %6.1f%% %8s %7d %9d %13.3f %13.3f %10.3f\n" , r.scene.c_str() , r.moving * 100 , r.refit ? "refit" : "rebuild" ,
+				r.refits , r.rebuilds , r.update_seconds * 1000 , r.render_seconds , r.mrays );
+		}
+		return;
+	}
+	printf( "%-10s %10s %12s %10s %10s %12s %10s\n" , "scene" , "primitives" , "rays" , "seconds" , "MRays/s" , "peak_rss_kB" , "checksum" );
+	for ( int k = 0 ; k < ( int ) results.size() ; k++ ) {
+		BenchmarkResult& r = results[k];
+		printf( "%-10s %10d %12lld %10.3f %10.3f %12lld %08x\n" , r.scene.c_str() , r.primitives , r.rays , r.seconds , r.mrays , r.peak_rss , r.checksum );
+	}
+}
+
+void Benchmark::Output( std::string file ) {
+	FILE* fout = fopen( file.c_str() , "w" );
+	if ( fout == NULL ) return;
+	fprintf( fout , "# engine %s count %d size %d %d spp %d\n" , engine.c_str() , count , W , H , spp );
+	for ( int k = 0 ; k < ( int ) results.size() ; k++ ) {
+		BenchmarkResult& r = results[k];
+		fprintf( fout , "%s %d %lld %.6f %.6f %lld %08x\n" , r.scene.c_str() , r.primitives , r.rays , r.seconds , r.mrays , r.peak_rss , r.checksum );
+	}
+	fclose( fout );
+}
+
+int Benchmark::Compare( std::string file ) {
+	std::ifstream fin( file.c_str() );
+	if ( !fin ) return -1;
+
+	std::vector<BenchmarkResult> baseline;
+	std::string line;
+	while ( getline( fin , line ) ) {
+		if ( line.empty() || line[0] == '#' ) continue;
+		std::stringstream fin2( line );
+		BenchmarkResult r;
+		fin2 >> r.scene >> r.primitives >> r.rays >> r.seconds >> r.mrays >> r.peak_rss >> std::hex >> r.checksum;
+		if ( fin2 ) baseline.push_back( r );
+	}
+
+	int regressions = 0;
+	printf( "%-10s %10s %10s %8s  %s\n" , "scene" , "baseline" , "MRays/s" , "change" , "status" );
+	for ( int k = 0 ; k < ( int ) results.size() ; k++ ) {
+		BenchmarkResult& r = results[k];
+		BenchmarkResult* base = NULL;
+		for ( int b = 0 ; b < ( int ) baseline.size() ; b++ )
+			if ( baseline[b].scene == r.scene ) base = &baseline[b];
+		if ( base == NULL ) {
+			printf( "%-10s %10s %10.3f %8s  not in baseline\n" , r.scene.c_str() , "-" , r.mrays , "-" );
+			continue;
+		}
+
+		double change = r.mrays / base->mrays - 1;
+		std::string status = "ok";
+		if ( base->primitives != r.primitives ) status = "different scene size";
+		else {
+			if ( change < -tolerance ) status = "SLOWER";
+			if ( base->checksum != r.checksum ) status = ( status == "ok" ) ? "IMAGE CHANGED" : status + ", IMAGE CHANGED";
+			if ( status != "ok" ) regressions++;
+		}
+		printf( "%-10s %10.3f %10.3f %+7.1f%%  %s\n" , r.scene.c_str() , base->mrays , r.mrays , change * 100 , status.c_str() );
+	}
+	return regressions;
+}
+
+int Benchmark::Golden( std::string dir , bool update , ImageCompare* compare ) {
+	int failures = 0;
+	if ( !update ) printf( "%-10s %8s %8s %8s %8s  %s\n" , "scene" , "max" , "bad" , "PSNR" , "SSIM" , "status" );
+	for ( int k = 0 ; k < ( int ) results.size() ; k++ ) {
+		std::string scene = results[k].scene;
+		std::string golden = dir + "/" + scene + ".bmp";
+		Bmp* image = new Bmp;
+		image->Input( ImageName( scene ) );
+
+		if ( update ) {
+			image->Output( golden );
+			printf( "%-10s -> %s\n" , scene.c_str() , golden.c_str() );
+			delete image;
+			continue;
+		}
+
+		if ( !FileExists( golden ) ) {
+			printf( "%-10s %8s %8s %8s %8s  FAILED, no %s\n" , scene.c_str() , "-" , "-" , "-" , "-" , golden.c_str() );
+			failures++;
+			delete image;
+			continue;
+		}
+
+		Bmp* reference = new Bmp;
+		reference->Input( golden );
+		Bmp* diff = new Bmp;
+		ImageDiff result = compare->Compare( reference , image , diff );
+		if ( !result.same_size ) {
+			printf( "%-10s %8s %8s %8s %8s  FAILED, size %dx%d against %dx%d\n" , scene.c_str() , "-" , "-" , "-" , "-" ,
+				image->GetW() , image->GetH() , reference->GetW() , reference->GetH() );
+		} else {
+			std::string status = "ok";
+			if ( !result.passed ) {
+				std::string diff_file = "benchmark_" + scene + "_diff.bmp";
+				diff->Output( diff_file );
+				status = "FAILED, see " + diff_file;
+			}
+			printf( "%-10s %8d %7.2f%% %8.2f %8.4f  %s\n" , scene.c_str() , result.max_diff , result.bad_fraction * 100 ,
+				std::min( result.psnr , 999.99 ) , result.ssim , status.c_str() );
+		}
+		if ( !result.passed ) failures++;
+		delete reference;
+		delete diff;
+		delete image;
+	}
+	return failures;
+}
@@ -0,0 +1,198 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include<string>
+#include<vector>
+#include<ostream>
+#include<functional>
+
+class ImageCompare;
+class Raytracer;
+
+extern const int STD_BENCHMARK_COUNT;
+extern const int STD_BENCHMARK_WIDTH;
+extern const int STD_BENCHMARK_HEIGHT;
+extern const double STD_BENCHMARK_TOLERANCE;
+
+enum HardwareCounter { COUNTER_NONE , COUNTER_BRANCH_MISSES , COUNTER_CACHE_MISSES };
+
+//what Benchmark::RenderGenerated measured of one generated scene, each mode reports the parts it needs
+struct GeneratedRender {
+	int primitives;
+	long long rays; //over all frames
+	double setup_seconds; //CreateAll :: parse, tessellation and BVH
+	double seconds; //the renders alone
+	long long memory; //kB of resident memory the scene added
+	long long counter; //the hardware counter over the renders, -1 without one
+	unsigned int checksum; //FNV-1a of the output image
+};
+
+struct BenchmarkResult {
+	std::string scene;
+	int primitives;
+	long long rays;
+	double seconds;
+	double mrays;
+	long long peak_rss; //kB, process peak so far
+	unsigned int checksum; //FNV-1a of the output bmp
+};
+
+//a generated scene with some of its primitives drifting, the BVH refitted or rebuilt every frame
+struct AnimationResult {
+	std::string scene;
+	double moving; //fraction of the bounded primitives
+	bool refit;
+	int frames , refits , rebuilds;
+	double update_seconds; //per frame
+	double render_seconds; //per frame
+	double mrays;
+};
+
+//the same scene lit by a string of point lights, every light shaded against a few picked from the light tree
+struct LightResult {
+	int lights;
+	int light_samples; //0 for every light
+	double seconds;
+	double mrays;
+	double rmse; //against the every-light render, in 0..255
+};
+
+//the same scene lit only by an environment map, its irradiance drawn with each EnvironmentSampling
+struct EnvironmentResult {
+	int samples;
+	std::string sampling;
+	double seconds;
+	double rmse; //against a many-sample cdf render, in 0..255
+};
+
+//a generated scene path traced with each SamplerType at a few sample counts
+struct SamplerResult {
+	std::string sampler;
+	int spp;
+	double seconds;
+	double rmse; //against a many-sample rand() render, in 0..255
+};
+
+//the textured scene with point texture lookups, whose aliased pixels go to the resampler, against lookups filtered over the ray cones
+struct TextureFilterResult {
+	bool filtered;
+	long long rays;
+	double seconds;
+	double psnr; //against a render 4 x 4 times larger, boxed down
+};
+
+//a generated scene shaded by the generic kernel and by the ones specialized per material
+struct KernelResult {
+	std::string scene;
+	bool specialized;
+	double seconds;
+	long long branch_misses; //-1 without hardware counters
+	unsigned int checksum;
+};
+
+//a generated scene rendered in scanline rows and in Hilbert ordered tiles
+struct TileOrderResult {
+	std::string scene;
+	bool hilbert;
+	double seconds;
+	double mrays;
+	long long cache_misses; //last level, -1 without hardware counters
+};
+
+//frames of a generated scene written synchronously or by the background writer, as bmp or QOI
+struct ImageOutputResult {
+	std::string format;
+	bool async;
+	int frames;
+	double render_seconds; //per frame, output left out
+	double output_seconds; //per frame the render thread spent on output, waiting for the writer included
+	double write_seconds; //per frame on the writer, the same as output_seconds when synchronous
+	long long bytes; //per frame
+};
+
+//bored cylinders as CSG differences of two cylinders and as closed triangle meshes of a few tessellations
+struct CsgResult {
+	int segments; //around a tube, 0 for CSG
+	int primitives;
+	double setup_seconds; //parse, tessellation and BVH
+	double render_seconds;
+	double hit_us; //nearest hit of a camera ray that lands on a tube in the CSG render
+	long long memory; //kB of resident memory the scene added
+	double psnr; //against the CSG render
+};
+
+//one fractal terrain traced as a heightfield or as its tessellated triangle mesh
+struct TerrainResult {
+	int cells; //a side
+	bool mesh;
+	double setup_seconds; //parse, terrain generation, tessellation and BVH
+	double render_seconds;
+	double mrays;
+	double trace_us; //nearest hit of one camera ray, shading left out
+	long long memory; //kB of resident memory the scene added
+};
+
+//deterministic generated scenes rendered back to back, optionally checked against a stored baseline
+class Benchmark {
+	std::string engine;
+	int count , threads , spp , W , H;
+	double tolerance;
+	std::vector<BenchmarkResult> results;
+	std::vector<AnimationResult> animation_results;
+	std::vector<LightResult> light_results;
+	std::vector<EnvironmentResult> environment_results;
+	std::vector<TerrainResult> terrain_results;
+	std::vector<SamplerResult> sampler_results;
+	std::vector<TextureFilterResult> texture_results;
+	std::vector<KernelResult> kernel_results;
+	std::vector<TileOrderResult> tile_results;
+	std::vector<ImageOutputResult> output_results;
+	std::vector<CsgResult> csg_results;
+
+	unsigned int random_state;
+	double Random();
+	void WriteCamera( std::ostream& fout , double ox , double oy , double oz , double tx , double ty , double tz );
+	void WriteSpheres( std::ostream& fout );
+	void WriteCornell( std::ostream& fout );
+	void WriteGlass( std::ostream& fout );
+	void WriteTextured( std::ostream& fout );
+	void WriteLathes( std::ostream& fout );
+	void WriteCubes( std::ostream& fout );
+	void WriteLightString( std::ostream& fout , int lights , int light_samples );
+	void WriteEnvironment( std::ostream& fout , std::string skybox , int samples , std::string sampling );
+	void WriteTerrain( std::ostream& fout , int cells , bool mesh );
+	void WriteTubes( std::ostream& fout , int segments ); //0 segments :: csg nodes
+	GeneratedRender RenderGenerated( std::string run , std::function<void( std::ostream& )> write , std::function<void( Raytracer* )> configure = nullptr ,
+		std::function<void( Raytracer* )> inspect = nullptr , std::string engine = "whitted" , HardwareCounter counter = COUNTER_NONE , int frames = 1 );
+
+public:
+	Benchmark();
+	~Benchmark() {}
+
+	void SetEngine( std::string name ) { engine = name; }
+	void SetCount( int n ) { count = n; }
+	void SetThreads( int n ) { threads = n; }
+	void SetSpp( int n ) { spp = n; }
+	void SetSize( int w , int h ) { W = w; H = h; }
+	void SetTolerance( double t ) { tolerance = t; }
+
+	static std::vector<std::string> GetSceneNames();
+	bool GenerateScene( std::string name , std::ostream& fout ); //false for an unknown name
+	bool Run( std::string name ); //one scene or "all"
+	bool Animate( std::string name , int frames ); //1% and 10% moving primitives, refit against rebuild
+	void ManyLights( int light_samples ); //1, 100 and 10000 lights
+	void EnvironmentConvergence( std::string skybox ); //mixed, cdf and uniform sampling at 1 to 64 samples
+	void Terrain( int cells , int mesh_cells ); //heightfields from 256 cells a side up to cells, meshes up to mesh_cells
+	bool SamplerConvergence( std::string name ); //random, halton and sobol at 1 to 64 spp, false for an unknown scene
+	bool ShadingKernels( std::string name ); //one scene or "all", generic against specialized shading, false for an unknown scene
+	bool TileOrders( std::string name ); //one scene or "all", scanline against Hilbert tiles, false for an unknown scene
+	void CsgTubes( int segments ); //the CSG tubes against meshes of 16 segments up to segments
+	void ImageOutput( int frames ); //the cubes scene rendered frames times per format, writing synchronously and in the background
+	void TextureFilter(); //the textured scene with and without mip filtering, rays and error against a supersampled render
+	void Print();
+	void Output( std::string file );
+	int Compare( std::string file ); //number of regressions against the baseline, -1 if it cannot be read
+	int Golden( std::string dir , bool update , ImageCompare* compare ); //renders against dir/<scene>.bmp :: number of failures
+};
+
+#endif
@@ -4,8 +4,13 @@
 #include<iostream>
 #include<string>
 #include<cmath>
+#include<vector>
+#include<algorithm>
 
-using namespace std;
+//rows are stored in multiples of 4 bytes
+static int RowPadding( int W , int bits ) {
+	return ( 4 - W * bits / 8 % 4 ) % 4;
+}
 
 Bmp::Bmp( int H , int W ) {
 	Initialize( H , W );
@@ -26,7 +31,7 @@ void Bmp::Initialize( int H , int W ) {
 	strInfo.biWidth = W;
 	strInfo.biBitCount = 24;
 	strInfo.biCompression = 0;
-	strInfo.biSizeImage = H * W * 3;
+	strInfo.biSizeImage = ( W * 3 + RowPadding( W , 24 ) ) * H;
 	strInfo.biXPelsPerMeter = 0;
 	strInfo.biYPelsPerMeter = 0;
 	strInfo.biClrUsed = 0;
@@ -44,6 +49,9 @@ void Bmp::Release() {
 		delete[] ima[i];
 
 	delete[] ima;
+	mip.clear();
+	mip_H.clear();
+	mip_W.clear();
 }
 
 void Bmp::Input( std::string file ) {
@@ -55,61 +63,203 @@ void Bmp::Input( std::string file ) {
 	fread( &strHead , 1 , sizeof( BITMAPFILEHEADER ) , fpi );
 	fread( &strInfo , 1 , sizeof( BITMAPINFOHEADER ) , fpi );
 	
-	RGBQUAD Pla;
-	for ( int i = 0 ; i < ( int ) strInfo.biClrUsed ; i++ ) {
-		fread( ( char * ) & ( Pla.rgbBlue ) , 1 , sizeof( byte ) , fpi );
-		fread( ( char * ) & ( Pla.rgbGreen ) , 1 , sizeof( byte ) , fpi );
-		fread( ( char * ) & ( Pla.rgbRed ) , 1 , sizeof( byte ) , fpi );
-	}
+	//up to 8 bits a pixel indexes the palette, which has 2^bits entries when biClrUsed is 0
+	int colors = strInfo.biClrUsed;
+	if ( colors == 0 && strInfo.biBitCount <= 8 ) colors = 1 << strInfo.biBitCount;
+	std::vector<RGBQUAD> palette( colors );
+	for ( int i = 0 ; i < colors ; i++ )
+		fread( &palette[i] , 1 , sizeof( RGBQUAD ) , fpi );
+	fseek( fpi , strHead.bfOffBits , SEEK_SET );
 	
+	int bits = strInfo.biBitCount; //Initialize sets up a 24-bit image
 	Initialize( strInfo.biHeight , strInfo.biWidth );
-	for(int i = 0 ; i < strInfo.biHeight ; i++ )
+	int padding = RowPadding( strInfo.biWidth , bits );
+	for(int i = 0 ; i < strInfo.biHeight ; i++ ) {
 		for(int j = 0 ; j < strInfo.biWidth ; j++ ) {
+			if ( bits == 8 ) {
+				byte index = 0;
+				fread( &index , 1 , sizeof( byte ) , fpi );
+				RGBQUAD& entry = palette[std::min( ( int ) index , colors - 1 )];
+				ima[i][j].red = entry.rgbRed;
+				ima[i][j].green = entry.rgbGreen;
+				ima[i][j].blue = entry.rgbBlue;
+				continue;
+			}
 			fread( &ima[i][j].blue , 1 , sizeof( byte ) , fpi );
 			fread( &ima[i][j].green , 1 , sizeof( byte ) , fpi );
 			fread( &ima[i][j].red , 1 , sizeof( byte ) , fpi );
 		}
+		fseek( fpi , padding , SEEK_CUR );
+	}
 
 	fclose( fpi );
 }
 
-void Bmp::Output( std::string file ) {
+long long Bmp::Output( std::string file ) {
+	if ( file.size() >= 4 && file.substr( file.size() - 4 ) == ".qoi" )
+		return OutputQoi( file );
+	return OutputBmp( file );
+}
+
+long long Bmp::OutputBmp( std::string file ) {
 	FILE *fpw = fopen( file.c_str() , "wb" );
+	if ( fpw == NULL ) return 0;
 
 	word bfType = 0x4d42;
 	fwrite( &bfType , 1 , sizeof( word ) , fpw );
 	fwrite( &strHead , 1 , sizeof( BITMAPFILEHEADER ) , fpw );
 	fwrite( &strInfo , 1 , sizeof( BITMAPINFOHEADER ) , fpw );
 
-	for ( int i = 0 ; i < strInfo.biHeight ; i++ )
+	//a whole row per fwrite, padding included
+	int padding = RowPadding( strInfo.biWidth , strInfo.biBitCount );
+	std::vector<unsigned char> row( strInfo.biWidth * 3 + padding , 0 );
+	for ( int i = 0 ; i < strInfo.biHeight ; i++ ) {
 		for ( int j = 0 ; j < strInfo.biWidth ; j++ ) {
-			fwrite( &ima[i][j].blue , 1 , sizeof( byte ) , fpw );
-			fwrite( &ima[i][j].green , 1 , sizeof( byte ) , fpw );
-			fwrite( &ima[i][j].red , 1 , sizeof( byte ) , fpw );
+			row[j * 3] = ima[i][j].blue;
+			row[j * 3 + 1] = ima[i][j].green;
+			row[j * 3 + 2] = ima[i][j].red;
 		}
+		fwrite( &row[0] , 1 , row.size() , fpw );
+	}
 	
+	long long bytes = ftell( fpw );
 	fclose( fpw );
+	return bytes;
+}
+
+static void PutBigEndian( std::vector<unsigned char>& out , dword x ) {
+	out.push_back( byte( x >> 24 ) );
+	out.push_back( byte( x >> 16 ) );
+	out.push_back( byte( x >> 8 ) );
+	out.push_back( byte( x ) );
+}
+
+//the Quite OK Image format :: runs, an index of 64 recent colours, and small differences to the previous pixel
+long long Bmp::OutputQoi( std::string file ) {
+	FILE *fpw = fopen( file.c_str() , "wb" );
+	if ( fpw == NULL ) return 0;
+
+	int H = strInfo.biHeight , W = strInfo.biWidth;
+	std::vector<unsigned char> out;
+	out.reserve( 14 + ( size_t ) H * W * 4 / 3 + 8 );
+	const char magic[4] = { 'q' , 'o' , 'i' , 'f' };
+	out.insert( out.end() , magic , magic + 4 );
+	PutBigEndian( out , W );
+	PutBigEndian( out , H );
+	out.push_back( 3 ); //rgb
+	out.push_back( 0 ); //sRGB with linear alpha
+
+	int index[64]; //packed rgb, -1 while empty :: the decoder starts its slots transparent, so none matches an opaque pixel
+	for ( int k = 0 ; k < 64 ; k++ )
+		index[k] = -1;
+	int pr = 0 , pg = 0 , pb = 0 , run = 0;
+	//top row first, unlike bmp
+	for ( int i = H - 1 ; i >= 0 ; i-- )
+		for ( int j = 0 ; j < W ; j++ ) {
+			int r = ima[i][j].red , g = ima[i][j].green , b = ima[i][j].blue;
+			if ( r == pr && g == pg && b == pb ) {
+				if ( ++run == 62 ) {
+					out.push_back( byte( 0xc0 | ( run - 1 ) ) );
+					run = 0;
+				}
+				continue;
+			}
+			if ( run > 0 ) {
+				out.push_back( byte( 0xc0 | ( run - 1 ) ) );
+				run = 0;
+			}
+
+			int slot = ( r * 3 + g * 5 + b * 7 + 255 * 11 ) % 64;
+			if ( index[slot] == ( r << 16 | g << 8 | b ) ) {
+				out.push_back( byte( slot ) );
+			} else {
+				index[slot] = r << 16 | g << 8 | b;
+				//differences wrap around modulo 256
+				int dr = ( signed char ) byte( r - pr ) , dg = ( signed char ) byte( g - pg ) , db = ( signed char ) byte( b - pb );
+				int dr_dg = dr - dg , db_dg = db - dg;
+				if ( dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1 ) {
+					out.push_back( byte( 0x40 | ( dr + 2 ) << 4 | ( dg + 2 ) << 2 | ( db + 2 ) ) );
+				} else
+				if ( dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7 ) {
+					out.push_back( byte( 0x80 | ( dg + 32 ) ) );
+					out.push_back( byte( ( dr_dg + 8 ) << 4 | ( db_dg + 8 ) ) );
+				} else {
+					out.push_back( 0xfe );
+					out.push_back( byte( r ) );
+					out.push_back( byte( g ) );
+					out.push_back( byte( b ) );
+				}
+			}
+			pr = r; pg = g; pb = b;
+		}
+	if ( run > 0 ) out.push_back( byte( 0xc0 | ( run - 1 ) ) );
+	for ( int k = 0 ; k < 8 ; k++ )
+		out.push_back( ( k == 7 ) ? 1 : 0 );
+
+	fwrite( &out[0] , 1 , out.size() , fpw );
+	fclose( fpw );
+	return ( long long ) out.size();
 }
 
 void Bmp::SetColor( int i , int j , Color col ) {
+	col.Confine();
 	ima[i][j].red = ( int ) ( col.r * 255 );
 	ima[i][j].green = ( int ) ( col.g * 255 );
 	ima[i][j].blue = ( int ) ( col.b * 255 );
 }
 
-Color Bmp::GetSmoothColor( double u , double v ) {
-	double U = ( u - floor( u ) ) * strInfo.biHeight;
-	double V = ( v - floor( v ) ) * strInfo.biWidth;
+//box filtered halves down to a single texel, odd sizes repeat their last row or column
+void Bmp::BuildMipmaps() {
+	mip.assign( 1 , std::vector<Color>() );
+	mip_H.assign( 1 , strInfo.biHeight );
+	mip_W.assign( 1 , strInfo.biWidth );
+	for ( int level = 1 ; mip_H[level - 1] > 1 || mip_W[level - 1] > 1 ; level++ ) {
+		int h = mip_H[level - 1] , w = mip_W[level - 1];
+		int nh = ( h + 1 ) / 2 , nw = ( w + 1 ) / 2;
+		mip.push_back( std::vector<Color>( nh * nw ) );
+		mip_H.push_back( nh );
+		mip_W.push_back( nw );
+		for ( int i = 0 ; i < nh ; i++ )
+			for ( int j = 0 ; j < nw ; j++ ) {
+				int i2 = std::min( 2 * i + 1 , h - 1 ) , j2 = std::min( 2 * j + 1 , w - 1 );
+				Color sum = GetTexel( level - 1 , 2 * i , 2 * j ) + GetTexel( level - 1 , 2 * i , j2 ) +
+				            GetTexel( level - 1 , i2 , 2 * j ) + GetTexel( level - 1 , i2 , j2 );
+				mip[level][i * nw + j] = sum / 4;
+			}
+	}
+}
+
+double Bmp::GetLevel( double du , double dv ) {
+	double texels = std::max( du * strInfo.biHeight , dv * strInfo.biWidth );
+	return ( texels > 0 ) ? log( texels ) / log( 2.0 ) : 0;
+}
+
+//trilinear between the two levels around the footprint, the plain bilinear lookup when it is no larger than a texel
+Color Bmp::GetSmoothColor( double u , double v , double du , double dv ) {
+	double level = GetLevel( du , dv );
+	if ( level <= 0 || mip.empty() ) return GetLevelColor( 0 , u , v );
+	int top = ( int ) mip.size() - 1;
+	if ( level >= top ) return GetLevelColor( top , u , v );
+	int lo = ( int ) floor( level );
+	double t = level - lo;
+	return GetLevelColor( lo , u , v ) * ( 1 - t ) + GetLevelColor( lo + 1 , u , v ) * t;
+}
+
+Color Bmp::GetLevelColor( int level , double u , double v ) {
+	int H = ( level == 0 ) ? strInfo.biHeight : mip_H[level];
+	int W = ( level == 0 ) ? strInfo.biWidth : mip_W[level];
+	double U = ( u - floor( u ) ) * H;
+	double V = ( v - floor( v ) ) * W;
 	int U1 = ( int ) floor( U - EPS  ) , U2 = U1 + 1;
 	int V1 = ( int ) floor( V - EPS  ) , V2 = V1 + 1;
 	double rat_U = U2 - U;
 	double rat_V = V2 - V;
-	if ( U1 < 0 ) U1 = strInfo.biHeight - 1; if ( U2 == strInfo.biHeight ) U2 = 0;
-	if ( V1 < 0 ) V1 = strInfo.biWidth - 1; if ( V2 == strInfo.biWidth ) V2 = 0;
+	if ( U1 < 0 ) U1 = H - 1; if ( U2 == H ) U2 = 0;
+	if ( V1 < 0 ) V1 = W - 1; if ( V2 == W ) V2 = 0;
 	Color ret;
-	ret = ret + ima[U1][V1].GetColor() * rat_U * rat_V;
-	ret = ret + ima[U1][V2].GetColor() * rat_U * ( 1 - rat_V );
-	ret = ret + ima[U2][V1].GetColor() * ( 1 - rat_U ) * rat_V;
-	ret = ret + ima[U2][V2].GetColor() * ( 1 - rat_U ) * ( 1 - rat_V );
+	ret = ret + GetTexel( level , U1 , V1 ) * rat_U * rat_V;
+	ret = ret + GetTexel( level , U1 , V2 ) * rat_U * ( 1 - rat_V );
+	ret = ret + GetTexel( level , U2 , V1 ) * ( 1 - rat_U ) * rat_V;
+	ret = ret + GetTexel( level , U2 , V2 ) * ( 1 - rat_U ) * ( 1 - rat_V );
 	return ret;
 }
@@ -3,6 +3,7 @@
 
 #include"color.h"
 #include<string>
+#include<vector>
 
 extern const double EPS;
 
@@ -19,14 +20,14 @@ struct BITMAPFILEHEADER {
 
 struct BITMAPINFOHEADER {
 	dword biSize;
-	long biWidth;
-	long biHeight;
+	int biWidth; //LONG is 32 bits in the file, and long is not on every platform
+	int biHeight;
 	word biPlanes;
 	word biBitCount;
 	dword biCompression;
 	dword biSizeImage;
-	long biXPelsPerMeter;
-	long biYPelsPerMeter;
+	int biXPelsPerMeter;
+	int biYPelsPerMeter;
 	dword biClrUsed;
 	dword biClrImportant;
 };
@@ -52,8 +53,14 @@ class Bmp {
 	BITMAPINFOHEADER strInfo;
 	bool ima_created;
 	IMAGEDATA** ima;
+	std::vector< std::vector<Color> > mip; //level k holds the image halved k times, level 0 is left empty for ima
+	std::vector<int> mip_H , mip_W;
 
 	void Release();
+	long long OutputBmp( std::string file );
+	long long OutputQoi( std::string file );
+	Color GetTexel( int level , int i , int j ) { return ( level == 0 ) ? ima[i][j].GetColor() : mip[level][i * mip_W[level] + j]; }
+	Color GetLevelColor( int level , double u , double v );
 	
 public:
 	Bmp( int H = 0 , int W = 0 );
@@ -66,8 +73,10 @@ public:
 
 	void Initialize( int H , int W );
 	void Input( std::string file );
-	void Output( std::string file );
-	Color GetSmoothColor( double u , double v );
+	long long Output( std::string file ); //QOI for a .qoi file name, bmp otherwise :: bytes written, 0 if the file cannot be opened
+	void BuildMipmaps();
+	Color GetSmoothColor( double u , double v , double du = 0 , double dv = 0 ); //du dv :: footprint in texture coordinates, 0 for a bilinear point lookup
+	double GetLevel( double du , double dv ); //mip level a footprint falls on, 0 or below is magnified
 };
 
 #endif
@@ -0,0 +1,258 @@
+#include"bvh.h"
+#include"stats.h"
+#include<cmath>
+#include<algorithm>
+
+const int BVH_LEAF_SIZE = 2;
+const int BVH_MAX_DEPTH = 48; //keeps the traversal stack below BVH_STACK
+const int BVH_BINS = 12;
+const int BVH_STACK = 64;
+const double BVH_TRAVERSAL_COST = 0.125; //one box test against one Collide
+const double STD_BVH_REBUILD_RATIO = 1.2;
+
+static double Axis( const Vector3& v , int axis ) {
+	return ( axis == 0 ) ? v.x : ( axis == 1 ) ? v.y : v.z;
+}
+
+static double Area( const Vector3& lo , const Vector3& hi ) {
+	Vector3 d = hi - lo;
+	return 2 * ( d.x * d.y + d.y * d.z + d.z * d.x );
+}
+
+static void Grow( Vector3& lo , Vector3& hi , const Vector3& a , const Vector3& b ) {
+	lo = Vector3( std::min( lo.x , a.x ) , std::min( lo.y , a.y ) , std::min( lo.z , a.z ) );
+	hi = Vector3( std::max( hi.x , b.x ) , std::max( hi.y , b.y ) , std::max( hi.z , b.z ) );
+}
+
+static double Weight( const BvhNode& node ) {
+	return ( node.count > 0 ) ? node.count : BVH_TRAVERSAL_COST;
+}
+
+static bool SameBox( const Vector3& a_lo , const Vector3& a_hi , const Vector3& b_lo , const Vector3& b_hi ) {
+	return a_lo.x == b_lo.x && a_lo.y == b_lo.y && a_lo.z == b_lo.z && a_hi.x == b_hi.x && a_hi.y == b_hi.y && a_hi.z == b_hi.z;
+}
+
+static Vector3 Inverse( const Vector3& v ) {
+	return Vector3( ( fabs( v.x ) > 1e-12 ) ? 1 / v.x : ( v.x < 0 ? -1e12 : 1e12 ) ,
+	                ( fabs( v.y ) > 1e-12 ) ? 1 / v.y : ( v.y < 0 ? -1e12 : 1e12 ) ,
+	                ( fabs( v.z ) > 1e-12 ) ? 1 / v.z : ( v.z < 0 ? -1e12 : 1e12 ) );
+}
+
+static bool HitBox( const BvhNode& node , const Vector3& O , const Vector3& inv , double tmax ) {
+	double t0 = 0 , t1 = tmax;
+	for ( int axis = 0 ; axis < 3 ; axis++ ) {
+		double a = ( Axis( node.lo , axis ) - Axis( O , axis ) ) * Axis( inv , axis );
+		double b = ( Axis( node.hi , axis ) - Axis( O , axis ) ) * Axis( inv , axis );
+		if ( a > b ) std::swap( a , b );
+		t0 = std::max( t0 , a );
+		t1 = std::min( t1 , b );
+		if ( t0 > t1 ) return false;
+	}
+	return true;
+}
+
+void Bvh::Build( std::vector<Primitive*>& primitives ) {
+	nodes.clear();
+	items.clear();
+	item_lo.clear();
+	item_hi.clear();
+	item_leaf.clear();
+	item_index.clear();
+	area_cost = build_cost = 0;
+	for ( int k = 0 ; k < ( int ) primitives.size() ; k++ ) {
+		Vector3 lo , hi;
+		if ( !primitives[k]->GetBounds( lo , hi ) ) continue;
+		items.push_back( primitives[k] );
+		item_lo.push_back( lo );
+		item_hi.push_back( hi );
+	}
+	if ( items.empty() ) return;
+
+	nodes.reserve( 2 * items.size() );
+	nodes.push_back( BvhNode() );
+	nodes[0].parent = -1;
+	Build( 0 , 0 , ( int ) items.size() , 0 );
+
+	item_leaf.resize( items.size() );
+	for ( int n = 0 ; n < ( int ) nodes.size() ; n++ ) {
+		area_cost += Weight( nodes[n] ) * Area( nodes[n].lo , nodes[n].hi );
+		for ( int k = nodes[n].left ; k < nodes[n].left + nodes[n].count ; k++ )
+			item_leaf[k] = n;
+	}
+	for ( int k = 0 ; k < ( int ) items.size() ; k++ )
+		item_index[items[k]] = k;
+	build_cost = GetCost();
+}
+
+double Bvh::GetCost() {
+	if ( nodes.empty() ) return 0;
+	return area_cost / std::max( Area( nodes[0].lo , nodes[0].hi ) , 1e-12 );
+}
+
+void Bvh::SetBox( int node , Vector3 lo , Vector3 hi ) {
+	area_cost += Weight( nodes[node] ) * ( Area( lo , hi ) - Area( nodes[node].lo , nodes[node].hi ) );
+	nodes[node].lo = lo;
+	nodes[node].hi = hi;
+}
+
+//the tree keeps its topology, so boxes may overlap more and more :: watch GetCost() against GetBuildCost()
+void Bvh::Refit( std::vector<Primitive*>& changed ) {
+	for ( int c = 0 ; c < ( int ) changed.size() ; c++ ) {
+		std::map<Primitive*, int>::iterator iter = item_index.find( changed[c] );
+		if ( iter == item_index.end() ) continue;
+		int k = iter->second;
+		changed[c]->GetBounds( item_lo[k] , item_hi[k] );
+
+		int node = item_leaf[k];
+		Vector3 lo = item_lo[nodes[node].left] , hi = item_hi[nodes[node].left];
+		for ( int i = nodes[node].left + 1 ; i < nodes[node].left + nodes[node].count ; i++ )
+			Grow( lo , hi , item_lo[i] , item_hi[i] );
+		SetBox( node , lo , hi );
+
+		//ancestors above an unchanged box are already correct
+		for ( node = nodes[node].parent ; node >= 0 ; node = nodes[node].parent ) {
+			const BvhNode& left = nodes[nodes[node].left];
+			const BvhNode& right = nodes[nodes[node].left + 1];
+			lo = left.lo; hi = left.hi;
+			Grow( lo , hi , right.lo , right.hi );
+			if ( SameBox( lo , hi , nodes[node].lo , nodes[node].hi ) ) break;
+			SetBox( node , lo , hi );
+		}
+	}
+}
+
+void Bvh::Build( int node , int begin , int end , int depth ) {
+	Vector3 lo = item_lo[begin] , hi = item_hi[begin];
+	Vector3 clo = ( lo + hi ) / 2 , chi = clo;
+	for ( int k = begin ; k < end ; k++ ) {
+		Vector3 c = ( item_lo[k] + item_hi[k] ) / 2;
+		Grow( lo , hi , item_lo[k] , item_hi[k] );
+		Grow( clo , chi , c , c );
+	}
+	nodes[node].lo = lo;
+	nodes[node].hi = hi;
+	nodes[node].left = begin;
+	nodes[node].count = end - begin;
+	nodes[node].axis = 0;
+
+	int n = end - begin;
+	if ( n <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH ) return;
+
+	//bin the centroids along the widest axis and take the cheapest SAH split between bins
+	Vector3 extent = chi - clo;
+	int axis = ( extent.x > extent.y && extent.x > extent.z ) ? 0 : ( extent.y > extent.z ) ? 1 : 2;
+	double cmin = Axis( clo , axis ) , width = Axis( extent , axis );
+	if ( width < 1e-12 ) return;
+
+	int bin_count[BVH_BINS] = { 0 };
+	Vector3 bin_lo[BVH_BINS] , bin_hi[BVH_BINS];
+	std::vector<int> bin( n );
+	for ( int k = begin ; k < end ; k++ ) {
+		double c = ( Axis( item_lo[k] , axis ) + Axis( item_hi[k] , axis ) ) / 2;
+		int b = std::min( ( int ) ( ( c - cmin ) / width * BVH_BINS ) , BVH_BINS - 1 );
+		bin[k - begin] = b;
+		if ( bin_count[b]++ == 0 ) {
+			bin_lo[b] = item_lo[k];
+			bin_hi[b] = item_hi[k];
+		} else
+			Grow( bin_lo[b] , bin_hi[b] , item_lo[k] , item_hi[k] );
+	}
+
+	double right_area[BVH_BINS];
+	int right_count[BVH_BINS];
+	Vector3 rlo , rhi;
+	int count = 0;
+	for ( int b = BVH_BINS - 1 ; b > 0 ; b-- ) {
+		if ( bin_count[b] > 0 ) {
+			if ( count == 0 ) { rlo = bin_lo[b]; rhi = bin_hi[b]; }
+			else Grow( rlo , rhi , bin_lo[b] , bin_hi[b] );
+			count += bin_count[b];
+		}
+		right_area[b] = ( count > 0 ) ? Area( rlo , rhi ) : 0;
+		right_count[b] = count;
+	}
+
+	int best = -1;
+	double best_cost = n; //cost of keeping the leaf
+	Vector3 llo , lhi;
+	count = 0;
+	for ( int b = 0 ; b < BVH_BINS - 1 ; b++ ) {
+		if ( bin_count[b] > 0 ) {
+			if ( count == 0 ) { llo = bin_lo[b]; lhi = bin_hi[b]; }
+			else Grow( llo , lhi , bin_lo[b] , bin_hi[b] );
+			count += bin_count[b];
+		}
+		if ( count == 0 || right_count[b + 1] == 0 ) continue;
+		double cost = BVH_TRAVERSAL_COST + ( Area( llo , lhi ) * count + right_area[b + 1] * right_count[b + 1] ) / std::max( Area( lo , hi ) , 1e-12 );
+		if ( cost < best_cost ) {
+			best_cost = cost;
+			best = b;
+		}
+	}
+	if ( best < 0 ) return;
+
+	int mid = begin;
+	for ( int k = begin ; k < end ; k++ )
+		if ( bin[k - begin] <= best ) {
+			std::swap( items[k] , items[mid] );
+			std::swap( item_lo[k] , item_lo[mid] );
+			std::swap( item_hi[k] , item_hi[mid] );
+			std::swap( bin[k - begin] , bin[mid - begin] );
+			mid++;
+		}
+
+	int left = ( int ) nodes.size();
+	nodes.push_back( BvhNode() );
+	nodes.push_back( BvhNode() );
+	nodes[left].parent = nodes[left + 1].parent = node;
+	nodes[node].left = left;
+	nodes[node].count = 0;
+	nodes[node].axis = axis;
+	Build( left , begin , mid , depth + 1 );
+	Build( left + 1 , mid , end , depth + 1 );
+}
+
+void Bvh::Intersect( Vector3 ray_O , Vector3 ray_V , CollidePrimitive& ret ) {
+	if ( nodes.empty() ) return;
+	Vector3 inv = Inverse( ray_V.GetUnitVector() ); //primitives normalize ray_V themselves, boxes need the same unit t
+	int stack[BVH_STACK] , top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		const BvhNode& node = nodes[stack[--top]];
+		STAT_INC( STAT_BVH_NODES );
+		if ( !HitBox( node , ray_O , inv , ret.dist ) ) continue;
+		if ( node.count > 0 ) {
+			for ( int k = node.left ; k < node.left + node.count ; k++ ) {
+				CollidePrimitive tmp = items[k]->Collide( ray_O , ray_V );
+				if ( tmp.IsCloserThan( ret ) ) ret = tmp;
+			}
+			continue;
+		}
+		bool negative = Axis( ray_V , node.axis ) < 0;
+		stack[top++] = node.left + ( negative ? 0 : 1 );
+		stack[top++] = node.left + ( negative ? 1 : 0 );
+	}
+}
+
+Primitive* Bvh::FindOccluder( Vector3 ray_O , Vector3 ray_V , double dist , Primitive* ignore ) {
+	if ( nodes.empty() ) return NULL;
+	Vector3 inv = Inverse( ray_V.GetUnitVector() );
+	int stack[BVH_STACK] , top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		const BvhNode& node = nodes[stack[--top]];
+		STAT_INC( STAT_BVH_NODES );
+		if ( !HitBox( node , ray_O , inv , dist ) ) continue;
+		if ( node.count > 0 ) {
+			for ( int k = node.left ; k < node.left + node.count ; k++ ) {
+				if ( items[k] == ignore ) continue;
+				CollidePrimitive tmp = items[k]->Collide( ray_O , ray_V );
+				if ( tmp.isCollide && EPS < dist - tmp.dist ) return items[k];
+			}
+			continue;
+		}
+		stack[top++] = node.left;
+		stack[top++] = node.left + 1;
+	}
+	return NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include"vector3.h"
+#include"primitive.h"
+#include<vector>
+#include<map>
+
+extern const int BVH_LEAF_SIZE;
+extern const int BVH_MAX_DEPTH;
+extern const double STD_BVH_REBUILD_RATIO; //refits are accepted until the SAH cost grows by this factor
+
+struct BvhNode {
+	Vector3 lo , hi;
+	int left; //inner node :: children at left and left + 1, leaf :: first item
+	int count; //items in a leaf, 0 for inner nodes
+	int parent;
+	int axis; //split axis, children are visited near first
+};
+
+//bounding volume hierarchy over the bounded primitives, binned SAH build
+class Bvh {
+	std::vector<BvhNode> nodes;
+	std::vector<Primitive*> items;
+	std::vector<Vector3> item_lo , item_hi;
+	std::vector<int> item_leaf;
+	std::map<Primitive*, int> item_index;
+	double area_cost; //SAH weight times surface area, summed over the nodes
+	double build_cost; //GetCost() right after the last build
+
+	void Build( int node , int begin , int end , int depth );
+	void SetBox( int node , Vector3 lo , Vector3 hi ); //keeps area_cost in step
+
+public:
+	Bvh() : area_cost( 0 ) , build_cost( 0 ) {}
+	~Bvh() {}
+
+	int GetNodeCount() { return ( int ) nodes.size(); }
+	double GetCost(); //expected SAH cost of a ray through the root
+	double GetBuildCost() { return build_cost; }
+	void Build( std::vector<Primitive*>& primitives );
+	void Refit( std::vector<Primitive*>& changed ); //re-bounds the changed primitives and their ancestors only
+	void Intersect( Vector3 ray_O , Vector3 ray_V , CollidePrimitive& ret ); //keeps ret if nothing is nearer
+	Primitive* FindOccluder( Vector3 ray_O , Vector3 ray_V , double dist , Primitive* ignore ); //any hit closer than dist, NULL for none
+};
+
+#endif
@@ -3,6 +3,9 @@
 #include<string>
 #include<sstream>
 #include<iostream>
+#include<vector>
+#include<cmath>
+#include<algorithm>
 
 const double STD_LENS_WIDTH = 0.88;
 const double STD_LENS_HEIGHT = 0.88;
@@ -14,6 +17,11 @@ const int STD_MAX_PHOTONS = 2000000;
 const int STD_EMIT_PHOTONS = 1000000;
 const int STD_SAMPLE_PHOTONS = 100;
 const double STD_SAMPLE_DIST = 1;
+const int STD_SPP = 16;
+const int STD_INDIRECT_QUALITY = 0;
+const int STD_LIGHT_SAMPLES = 0;
+const int STD_LENS_SAMPLES = 64;
+const double STD_LENS_THRESHOLD = 0.005;
 
 Camera::Camera() {
 	O = Vector3( 0 , 0 , 0 );
@@ -28,11 +36,21 @@ Camera::Camera() {
 	emit_photons = STD_EMIT_PHOTONS;
 	sample_photons = STD_SAMPLE_PHOTONS;
 	sample_dist = STD_SAMPLE_DIST;
+	spp = STD_SPP;
+	indirect_quality = STD_INDIRECT_QUALITY;
+	light_samples = STD_LIGHT_SAMPLES;
+	aperture = 0;
+	focus_dist = 0;
+	auto_focus = true;
+	lens_samples = STD_LENS_SAMPLES;
+	lens_threshold = STD_LENS_THRESHOLD;
+	sampler = SAMPLER_SOBOL;
+	texture_filter = true;
 	data = NULL;
 }
 
 Camera::~Camera() {
-	if ( data == NULL ) {
+	if ( data != NULL ) {
 		for ( int i = 0 ; i < H ; i++ )
 			delete[] data[i];
 		delete[] data;
@@ -40,21 +58,62 @@ Camera::~Camera() {
 }
 
 void Camera::Initialize() {
-	N = N.GetUnitVector();
-	Dx = N.GetAnVerticalVector();
-	Dy = Dx * N;
-	Dx = Dx * lens_W / 2;
-	Dy = Dy * lens_H / 2;
+	SetView( O , N );
 
 	data = new Color*[H];
 	for ( int i = 0 ; i < H ; i++ )
 		data[i] = new Color[W];
 }
 
+//moves the camera without touching the image buffer
+void Camera::SetView( Vector3 view_O , Vector3 view_N ) {
+	O = view_O;
+	N = view_N.GetUnitVector();
+	Dx = N.GetAnVerticalVector();
+	Dy = Dx * N;
+	lens_Dx = Dx * aperture / 2;
+	lens_Dy = Dy * aperture / 2;
+	Dx = Dx * lens_W / 2;
+	Dy = Dy * lens_H / 2;
+}
+
 Vector3 Camera::Emit( double i , double j ) {
 	return N + Dy * ( 2 * i / H - 1 ) + Dx * ( 2 * j / W - 1 );
 }
 
+//the camera dimensions of the pixel's sampler :: lens in u[0..1], pixel jitter in u[2..3]
+void Camera::LensSample( int i , int j , int k , double u[4] ) {
+	unsigned int seed = Sampler::PixelSeed( i * W + j );
+	for ( int d = 0 ; d < 4 ; d++ )
+		u[d] = Sampler::Sample( sampler , ( d + 2 ) % 4 , k , seed );
+}
+
+//every lens point aims at the spot the pinhole ray meets on the focal plane
+void Camera::EmitLens( int i , int j , double di , double dj , int k , Vector3& ray_O , Vector3& ray_V ) {
+	ray_V = Emit( i + di , j + dj );
+	ray_O = O;
+	if ( aperture <= 0 ) return;
+
+	double u[4];
+	LensSample( i , j , k , u );
+	//concentric map of the unit square onto the disk
+	double a = 2 * u[0] - 1 , b = 2 * u[1] - 1 , r = 0 , phi = 0;
+	if ( a != 0 || b != 0 ) {
+		if ( fabs( a ) > fabs( b ) ) { r = a; phi = PI / 4 * ( b / a ); }
+			else { r = b; phi = PI / 2 - PI / 4 * ( a / b ); }
+	}
+	Vector3 L = lens_Dx * ( r * cos( phi ) ) + lens_Dy * ( r * sin( phi ) );
+	ray_O = O + L;
+	ray_V = ray_V * focus_dist - L;
+}
+
+//seen from a lens point the offset r away, a point at depth z drifts by r * |1/f - 1/z| on the image plane at depth 1
+double Camera::CircleOfConfusion( int i , int j , double dist ) {
+	if ( aperture <= 0 ) return 0;
+	double inv_z = ( dist > 0 ) ? 1 / ( dist * Emit( i , j ).GetUnitVector().Dot( N ) ) : 0;
+	return aperture / 2 * fabs( 1 / focus_dist - inv_z ) / std::min( lens_W / W , lens_H / H );
+}
+
 void Camera::Input( std::string var , std::stringstream& fin ) {
 	if ( var == "O=" ) O.Input( fin );
 	if ( var == "N=" ) N.Input( fin );
@@ -68,12 +127,27 @@ void Camera::Input( std::string var , std::stringstream& fin ) {
 	if ( var == "emit_photons=" ) fin >> emit_photons;
 	if ( var == "sample_photons=" ) fin >> sample_photons;
 	if ( var == "sample_dist=" ) fin >> sample_dist;
+	if ( var == "spp=" ) fin >> spp;
+	if ( var == "indirect_quality=" ) fin >> indirect_quality;
+	if ( var == "light_samples=" ) fin >> light_samples;
+	if ( var == "aperture=" ) fin >> aperture;
+	if ( var == "focus_dist=" ) { fin >> focus_dist; auto_focus = ( focus_dist <= 0 ); }
+	if ( var == "lens_samples=" ) fin >> lens_samples;
+	if ( var == "lens_threshold=" ) fin >> lens_threshold;
+	if ( var == "texture_filter=" ) fin >> texture_filter;
+	if ( var == "sampler=" ) {
+		std::string name; fin >> name;
+		if ( !Sampler::ParseType( name , sampler ) ) fprintf( stderr , "camera :: unknown sampler %s\n" , name.c_str() );
+	}
 }
 
-void Camera::Output( Bmp* bmp ) {
-	bmp->Initialize( H , W );
-
+void Camera::GetFramebuffer( std::vector<float> color[3] ) {
+	for ( int c = 0 ; c < 3 ; c++ )
+		color[c].resize( H * W );
 	for ( int i = 0 ; i < H ; i++ )
-		for ( int j = 0 ; j < W ; j++ )
-			bmp->SetColor( i , j , data[i][j] );
+		for ( int j = 0 ; j < W ; j++ ) {
+			color[0][i * W + j] = ( float ) data[i][j].r;
+			color[1][i * W + j] = ( float ) data[i][j].g;
+			color[2][i * W + j] = ( float ) data[i][j].b;
+		}
 }
@@ -4,8 +4,11 @@
 #include"vector3.h"
 #include"color.h"
 #include"bmp.h"
+#include"sampler.h"
 #include<string>
 #include<sstream>
+#include<vector>
+#include<algorithm>
 
 extern const double STD_LENS_WIDTH; //the width of lens in the scene
 extern const double STD_LENS_HEIGHT;
@@ -17,10 +20,23 @@ extern const int STD_MAX_PHOTONS;
 extern const int STD_EMIT_PHOTONS;
 extern const int STD_SAMPLE_PHOTONS;
 extern const double STD_SAMPLE_DIST;
+extern const int STD_SPP; //path tracing :: samples per pixel
+extern const int STD_LIGHT_SAMPLES; //caln diffusion :: lights picked from the light tree per hit, 0 shades every light
+extern const int STD_INDIRECT_QUALITY; //caln diffusion :: hemisphere gather rays (*16), 0 leaves indirect light out
+extern const int STD_LENS_SAMPLES; //depth of field :: most lens samples a defocused pixel takes
+extern const double STD_LENS_THRESHOLD; //depth of field :: a defocused pixel stops once the standard error of its luminance is below this
 
 class Camera {
 	Vector3 O , N , Dx , Dy;
+	Vector3 lens_Dx , lens_Dy; //the aperture radius along Dx and Dy
 	double lens_W , lens_H;
+	double aperture; //diameter of the thin lens, 0 for a pinhole
+	double focus_dist; //distance along N to the plane in focus, 0 focuses on what the centre pixel sees
+	bool auto_focus; //focus_dist was 0 in the scene :: refocused whenever the view changes
+	int lens_samples;
+	double lens_threshold;
+	SamplerType sampler;
+	bool texture_filter; //textures looked up over the ray footprint, off :: point lookups and textured pixels left to the resampler
 	int W , H;
 	Color** data;
 	double shade_quality;
@@ -29,26 +45,48 @@ class Camera {
 	int emit_photons;
 	int sample_photons;
 	double sample_dist;
+	int spp;
+	int indirect_quality;
+	int light_samples;
 
 public:
 	Camera();
 	~Camera();
 	
 	Vector3 GetO() { return O; }
+	Vector3 GetN() { return N; }
 	int GetW() { return W; }
 	int GetH() { return H; }
 	void SetColor( int i , int j , Color color ) { data[i][j] = color; }
+	Color GetColor( int i , int j ) { return data[i][j]; }
 	double GetShadeQuality() { return shade_quality; }
 	double GetDreflQuality() { return drefl_quality; }
 	int GetMaxPhotons() { return max_photons; }
 	int GetEmitPhotons() { return emit_photons; }
 	int GetSamplePhotons() { return sample_photons; }
 	double GetSampleDist() { return sample_dist; }
+	int GetSpp() { return spp; }
+	int GetIndirectQuality() { return indirect_quality; }
+	int GetLightSamples() { return light_samples; }
+	bool HasLens() { return aperture > 0; }
+	double GetFocusDist() { return focus_dist; }
+	bool IsAutoFocus() { return auto_focus; }
+	int GetLensSamples() { return lens_samples; }
+	double GetLensThreshold() { return lens_threshold; }
+	SamplerType GetSampler() { return sampler; }
+	bool GetTextureFilter() { return texture_filter; }
+	void SetSpp( int s ) { spp = s; }
+	void SetFocusDist( double d ) { focus_dist = d; }
 
 	Vector3 Emit( double i , double j );
+	void LensSample( int i , int j , int k , double u[4] ); //k-th low discrepancy point of pixel (i,j) :: lens in u[0..1], pixel jitter in u[2..3]
+	void EmitLens( int i , int j , double di , double dj , int k , Vector3& ray_O , Vector3& ray_V ); //through (i+di,j+dj) from lens sample k, the pinhole ray without an aperture
+	double GetPixelSpread() { return std::min( lens_W / W , lens_H / H ); } //angle one pixel subtends, the image plane is at depth 1
+	double CircleOfConfusion( int i , int j , double dist ); //radius in pixels of the point dist along the centre ray of pixel (i,j), dist 0 for the far distance
 	void Initialize();
+	void SetView( Vector3 O , Vector3 N );
 	void Input( std::string var , std::stringstream& fin );
-	void Output( Bmp* );
+	void GetFramebuffer( std::vector<float> color[3] ); //linear planes, row 0 at the bottom
 };
 
 #endif
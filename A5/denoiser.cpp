@@ -0,0 +1,144 @@
+#include"denoiser.h"
+#include<cmath>
+#include<string>
+#include<sstream>
+#include<algorithm>
+
+const int STD_DENOISE_ITERATIONS = 5;
+const double STD_SIGMA_COLOR = 0.6;
+const double STD_SIGMA_NORMAL = 0.3;
+const double STD_SIGMA_DEPTH = 0.1;
+const double STD_SIGMA_ALBEDO = 0.1;
+const float ALBEDO_EPS = 1e-3f;
+const float B3_SPLINE[5] = { 1.0f / 16 , 1.0f / 4 , 3.0f / 8 , 1.0f / 4 , 1.0f / 16 };
+
+Denoiser::Denoiser() {
+	iterations = STD_DENOISE_ITERATIONS;
+	sigma_color = ( float ) STD_SIGMA_COLOR;
+	sigma_normal = ( float ) STD_SIGMA_NORMAL;
+	sigma_depth = ( float ) STD_SIGMA_DEPTH;
+	sigma_albedo = ( float ) STD_SIGMA_ALBEDO;
+}
+
+void Denoiser::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "iterations=" ) fin >> iterations;
+	if ( var == "sigma_color=" ) fin >> sigma_color;
+	if ( var == "sigma_normal=" ) fin >> sigma_normal;
+	if ( var == "sigma_depth=" ) fin >> sigma_depth;
+	if ( var == "sigma_albedo=" ) fin >> sigma_albedo;
+}
+
+//pointers to the rows of every plane the filter reads
+struct FilterRowPtr {
+	const float* c[3];
+	const float* n[3];
+	const float* a[3];
+	const float* z;
+};
+
+struct FilterParam {
+	float kernel;
+	float inv_color , inv_normal , inv_depth , inv_albedo;
+};
+
+static inline float TapWeight( const FilterRowPtr& P , int p , const FilterRowPtr& Q , int q , const FilterParam& param ) {
+	float dc = 0 , dn = 0 , da = 0;
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		float t = P.c[c][p] - Q.c[c][q]; dc += t * t;
+		t = P.n[c][p] - Q.n[c][q]; dn += t * t;
+		t = P.a[c][p] - Q.a[c][q]; da += t * t;
+	}
+	float dz = fabsf( P.z[p] - Q.z[q] ) / ( std::max( P.z[p] , Q.z[q] ) + 1e-6f );
+	return param.kernel * expf( -dc * param.inv_color - dn * param.inv_normal - dz * param.inv_depth - da * param.inv_albedo );
+}
+
+static FilterRowPtr GetRowPtr( AovBuffer& aov , std::vector<float>* color , int i ) {
+	int k = i * aov.GetW();
+	FilterRowPtr ret;
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		ret.c[c] = &color[c][k];
+		ret.n[c] = &aov.normal[c][k];
+		ret.a[c] = &aov.albedo[c][k];
+	}
+	ret.z = &aov.depth[k];
+	return ret;
+}
+
+void Denoiser::FilterRow( int i , int step , AovBuffer& aov , std::vector<float>* in , std::vector<float>* out ) {
+	int H = aov.GetH() , W = aov.GetW();
+	float sc = sigma_color / step; //the colour tolerance halves every iteration
+	FilterParam param;
+	param.inv_color = 1 / ( sc * sc );
+	param.inv_normal = 1 / ( sigma_normal * sigma_normal );
+	param.inv_depth = 1 / ( sigma_depth * step );
+	param.inv_albedo = 1 / ( sigma_albedo * sigma_albedo );
+
+	FilterRowPtr P = GetRowPtr( aov , in , i );
+	std::vector<float> sum_w( W , 0 ) , sum_c[3];
+	for ( int c = 0 ; c < 3 ; c++ )
+		sum_c[c].assign( W , 0 );
+	float* sw = &sum_w[0];
+	float* s0 = &sum_c[0][0];
+	float* s1 = &sum_c[1][0];
+	float* s2 = &sum_c[2][0];
+
+	for ( int dy = -2 ; dy <= 2 ; dy++ ) {
+		int ii = std::min( std::max( i + dy * step , 0 ) , H - 1 );
+		FilterRowPtr Q = GetRowPtr( aov , in , ii );
+		for ( int dx = -2 ; dx <= 2 ; dx++ ) {
+			int off = dx * step;
+			param.kernel = B3_SPLINE[dy + 2] * B3_SPLINE[dx + 2];
+			int lo = std::min( std::max( -off , 0 ) , W ) , hi = std::max( std::min( W - off , W ) , lo );
+
+			//columns whose neighbour is inside the image form one contiguous, vectorisable run
+			for ( int j = lo ; j < hi ; j++ ) {
+				float w = TapWeight( P , j , Q , j + off , param );
+				sw[j] += w;
+				s0[j] += w * Q.c[0][j + off];
+				s1[j] += w * Q.c[1][j + off];
+				s2[j] += w * Q.c[2][j + off];
+			}
+			//the remaining columns near the border clamp their neighbour
+			for ( int e = 0 ; e < W - ( hi - lo ) ; e++ ) {
+				int j = ( e < lo ) ? e : e + hi - lo;
+				int q = std::min( std::max( j + off , 0 ) , W - 1 );
+				float w = TapWeight( P , j , Q , q , param );
+				sw[j] += w;
+				s0[j] += w * Q.c[0][q];
+				s1[j] += w * Q.c[1][q];
+				s2[j] += w * Q.c[2][q];
+			}
+		}
+	}
+
+	int k = i * W;
+	for ( int j = 0 ; j < W ; j++ ) {
+		out[0][k + j] = s0[j] / sw[j];
+		out[1][k + j] = s1[j] / sw[j];
+		out[2][k + j] = s2[j] / sw[j];
+	}
+}
+
+void Denoiser::Run( ThreadPool* pool , AovBuffer& aov , std::vector<float> color[3] ) {
+	int H = aov.GetH() , W = aov.GetW();
+	std::vector<float> in[3] , out[3];
+
+	//filter the untextured irradiance so texture detail is not blurred away
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		in[c].resize( H * W );
+		out[c].resize( H * W );
+		for ( int k = 0 ; k < H * W ; k++ )
+			in[c][k] = color[c][k] / ( aov.albedo[c][k] + ALBEDO_EPS );
+	}
+
+	for ( int it = 0 ; it < iterations ; it++ ) {
+		int step = 1 << it;
+		pool->ParallelFor( H , [&]( int i ) { FilterRow( i , step , aov , in , out ); } );
+		for ( int c = 0 ; c < 3 ; c++ )
+			in[c].swap( out[c] );
+	}
+
+	for ( int c = 0 ; c < 3 ; c++ )
+		for ( int k = 0 ; k < H * W ; k++ )
+			color[c][k] = in[c][k] * ( aov.albedo[c][k] + ALBEDO_EPS );
+}
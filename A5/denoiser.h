@@ -0,0 +1,31 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include"aov.h"
+#include"threadpool.h"
+#include<vector>
+#include<string>
+#include<sstream>
+
+extern const int STD_DENOISE_ITERATIONS;
+extern const double STD_SIGMA_COLOR;
+extern const double STD_SIGMA_NORMAL;
+extern const double STD_SIGMA_DEPTH;
+extern const double STD_SIGMA_ALBEDO;
+
+//edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the aov features
+class Denoiser {
+	int iterations;
+	float sigma_color , sigma_normal , sigma_depth , sigma_albedo;
+
+	void FilterRow( int i , int step , AovBuffer& aov , std::vector<float>* in , std::vector<float>* out );
+
+public:
+	Denoiser();
+	~Denoiser() {}
+
+	void Input( std::string var , std::stringstream& fin );
+	void Run( ThreadPool* pool , AovBuffer& aov , std::vector<float> color[3] ); //filters color in place
+};
+
+#endif
@@ -0,0 +1,283 @@
+#include"raytracer.h"
+#include"tile.h"
+#include<cstdio>
+#include<cstdlib>
+#include<chrono>
+#include<deque>
+#include<algorithm>
+#ifndef _WIN32
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<signal.h>
+#include<sys/wait.h>
+#endif
+
+const int DISTRIBUTED_TILE_SIZE = 64;
+const int MAX_WORKER_RESTARTS = 3;
+
+//traces the tile plus a one pixel border for the hash comparison, then resamples the tile's edge pixels
+void Raytracer::RenderTile( Tile& tile , std::vector<float>& data ) {
+	int a0 = std::max( tile.i0 - 1 , i0 ) , a1 = std::min( tile.i1 + 1 , i1 );
+	int b0 = std::max( tile.j0 - 1 , j0 ) , b1 = std::min( tile.j1 + 1 , j1 );
+	int h = a1 - a0 , w = b1 - b0;
+	std::vector<int> sample( h * w , 0 );
+	std::vector<Color> color( h * w );
+
+	GetThreadPool()->ParallelFor( h , [&]( int r ) {
+		thread_rays = 0;
+		for ( int c = 0 ; c < w ; c++ )
+			color[r * w + c] = TracePixel( a0 + r , b0 + c , &sample[r * w + c] , NULL );
+		traced_rays += thread_rays;
+	} );
+
+	int th = tile.i1 - tile.i0 , tw = tile.j1 - tile.j0;
+	data.resize( th * tw * 3 );
+	GetThreadPool()->ParallelFor( th , [&]( int r ) {
+		thread_rays = 0;
+		int i = tile.i0 + r;
+		for ( int j = tile.j0 ; j < tile.j1 ; j++ ) {
+			int k = ( i - a0 ) * w + ( j - b0 );
+			Color col = color[k];
+			if ( sample[k] != LENS_DEFOCUSED && ( ( i > a0 && sample[k] != sample[k - w] ) || ( i < a1 - 1 && sample[k] != sample[k + w] ) ||
+			     ( j > b0 && sample[k] != sample[k - 1] ) || ( j < b1 - 1 && sample[k] != sample[k + 1] ) ) ) {
+				col = Color();
+				for ( int dr = -1 ; dr <= 1 ; dr++ )
+					for ( int dc = -1 ; dc <= 1 ; dc++ ) {
+						Vector3 ray_O , ray_V;
+						camera->EmitLens( i , j , ( double ) dr / 3 , ( double ) dc / 3 , ( dr + 1 ) * 3 + dc + 2 , ray_O , ray_V );
+						thread_sampler.Start( camera->GetSampler() , i * camera->GetW() + j , ( dr + 1 ) * 3 + dc + 2 );
+						col += RayTracing( ray_O , ray_V , 1 , NULL , NULL , RayCone( 0 , camera->GetPixelSpread() / 3 ) ) / 9;
+					}
+			}
+			float* out = &data[( r * tw + j - tile.j0 ) * 3];
+			out[0] = ( float ) col.r; out[1] = ( float ) col.g; out[2] = ( float ) col.b;
+		}
+		traced_rays += thread_rays;
+	} );
+}
+
+#ifndef _WIN32
+
+struct WorkerProcess {
+	pid_t pid;
+	int to , from; //its stdin and stdout
+	int tile; //-1 when idle
+	int restarts;
+	bool alive;
+};
+
+static bool ReadAll( int fd , void* buf , size_t n ) {
+	char* p = ( char* ) buf;
+	while ( n > 0 ) {
+		ssize_t got = read( fd , p , n );
+		if ( got <= 0 ) return false;
+		p += got;
+		n -= got;
+	}
+	return true;
+}
+
+static bool WriteAll( int fd , const void* buf , size_t n ) {
+	const char* p = ( const char* ) buf;
+	while ( n > 0 ) {
+		ssize_t put = write( fd , p , n );
+		if ( put <= 0 ) return false;
+		p += put;
+		n -= put;
+	}
+	return true;
+}
+
+static bool SpawnWorker( std::vector<std::string> command , WorkerProcess& worker ) {
+	int to[2] , from[2];
+	if ( pipe( to ) != 0 ) return false;
+	if ( pipe( from ) != 0 ) {
+		close( to[0] ); close( to[1] );
+		return false;
+	}
+	//the coordinator's ends must not leak into later workers, or a dead worker's stdin never reaches EOF
+	fcntl( to[1] , F_SETFD , FD_CLOEXEC );
+	fcntl( from[0] , F_SETFD , FD_CLOEXEC );
+
+	pid_t pid = fork();
+	if ( pid < 0 ) {
+		close( to[0] ); close( to[1] ); close( from[0] ); close( from[1] );
+		return false;
+	}
+	if ( pid == 0 ) {
+		dup2( to[0] , 0 );
+		dup2( from[1] , 1 );
+		close( to[0] ); close( from[1] );
+		std::vector<char*> argv;
+		for ( int k = 0 ; k < ( int ) command.size() ; k++ )
+			argv.push_back( ( char* ) command[k].c_str() );
+		argv.push_back( NULL );
+		execvp( argv[0] , &argv[0] );
+		_exit( 127 );
+	}
+
+	close( to[0] );
+	close( from[1] );
+	worker.pid = pid;
+	worker.to = to[1];
+	worker.from = from[0];
+	worker.tile = -1;
+	worker.alive = true;
+	return true;
+}
+
+static void StopWorker( WorkerProcess& worker , bool graceful ) {
+	if ( graceful ) {
+		int quit[5] = { -1 , 0 , 0 , 0 , 0 };
+		WriteAll( worker.to , quit , sizeof( quit ) );
+	} else
+		kill( worker.pid , SIGKILL );
+	close( worker.to );
+	close( worker.from );
+	waitpid( worker.pid , NULL , 0 );
+	worker.alive = false;
+}
+
+void Raytracer::WorkerRun( int crash_after ) {
+	CreateAll();
+	//the tile stream owns stdout, anything else printed goes to stderr
+	int out = dup( 1 );
+	dup2( 2 , 1 );
+
+	std::vector<float> data;
+	int header[5];
+	while ( ReadAll( 0 , header , sizeof( header ) ) && header[0] >= 0 ) {
+		if ( crash_after >= 0 && crash_after-- == 0 ) _exit( 1 );
+		Tile tile;
+		tile.i0 = header[1]; tile.i1 = header[2];
+		tile.j0 = header[3]; tile.j1 = header[4];
+		srand( seed + header[0] );
+		traced_rays = 0;
+		RenderTile( tile , data );
+		long long rays = traced_rays;
+		if ( !WriteAll( out , header , sizeof( header ) ) || !WriteAll( out , &rays , sizeof( rays ) ) ||
+		     !WriteAll( out , &data[0] , data.size() * sizeof( float ) ) ) break;
+	}
+	close( out );
+}
+
+void Raytracer::DistributedRun( std::vector<std::string> worker_command , int workers , int crash_after ) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	//the workers trace, this process only needs the image the tiles go into
+	CreateImage();
+	traced_rays = 0;
+	signal( SIGPIPE , SIG_IGN );
+
+	TileScheduler scheduler( i0 , i1 , j0 , j1 , DISTRIBUTED_TILE_SIZE );
+	int tiles = scheduler.GetTileCount() , done = 0 , requeued = 0;
+	std::deque<int> pending;
+	for ( int k = 0 ; k < tiles ; k++ )
+		pending.push_back( k );
+
+	std::vector<WorkerProcess> pool( std::max( workers , 1 ) );
+	for ( int w = 0 ; w < ( int ) pool.size() ; w++ ) {
+		std::vector<std::string> command = worker_command;
+		//test hook :: only the first process of slot 0 fails
+		if ( w == 0 && crash_after >= 0 ) {
+			char buf[32];
+			sprintf( buf , "%d" , crash_after );
+			command.push_back( "--worker-crash-after" );
+			command.push_back( buf );
+		}
+		pool[w].restarts = 0;
+		if ( !SpawnWorker( command , pool[w] ) ) pool[w].alive = false;
+	}
+
+	//a failed worker gives its tile back to the queue and is replaced a few times
+	auto fail = [&]( WorkerProcess& worker ) {
+		if ( worker.tile >= 0 ) {
+			pending.push_front( worker.tile );
+			requeued++;
+		}
+		printf( "Distributed: worker %d failed, tile %d re-queued\n" , ( int ) worker.pid , worker.tile );
+		StopWorker( worker , false );
+		if ( worker.restarts < MAX_WORKER_RESTARTS ) {
+			worker.restarts++;
+			if ( !SpawnWorker( worker_command , worker ) ) worker.alive = false;
+		}
+	};
+
+	std::vector<float> data;
+	while ( done < tiles ) {
+		for ( int w = 0 ; w < ( int ) pool.size() ; w++ ) {
+			WorkerProcess& worker = pool[w];
+			if ( !worker.alive || worker.tile >= 0 || pending.empty() ) continue;
+			Tile& tile = scheduler.GetTile( pending.front() );
+			int header[5] = { pending.front() , tile.i0 , tile.i1 , tile.j0 , tile.j1 };
+			worker.tile = pending.front();
+			pending.pop_front();
+			if ( !WriteAll( worker.to , header , sizeof( header ) ) ) fail( worker );
+		}
+
+		std::vector<pollfd> fds;
+		std::vector<int> owner;
+		for ( int w = 0 ; w < ( int ) pool.size() ; w++ )
+			if ( pool[w].alive && pool[w].tile >= 0 ) {
+				pollfd p;
+				p.fd = pool[w].from;
+				p.events = POLLIN;
+				p.revents = 0;
+				fds.push_back( p );
+				owner.push_back( w );
+			}
+		if ( fds.empty() ) {
+			printf( "Distributed: no workers left, %d of %d tiles missing\n" , tiles - done , tiles );
+			break;
+		}
+		if ( poll( &fds[0] , fds.size() , -1 ) < 0 ) continue;
+
+		for ( int k = 0 ; k < ( int ) fds.size() ; k++ ) {
+			if ( fds[k].revents == 0 ) continue;
+			WorkerProcess& worker = pool[owner[k]];
+			int header[5];
+			long long rays;
+			bool ok = ReadAll( worker.from , header , sizeof( header ) ) && header[0] == worker.tile && ReadAll( worker.from , &rays , sizeof( rays ) );
+			if ( ok ) {
+				data.resize( ( header[2] - header[1] ) * ( header[4] - header[3] ) * 3 );
+				ok = ReadAll( worker.from , &data[0] , data.size() * sizeof( float ) );
+			}
+			if ( !ok ) {
+				fail( worker );
+				continue;
+			}
+
+			int tw = header[4] - header[3];
+			for ( int i = header[1] ; i < header[2] ; i++ )
+				for ( int j = header[3] ; j < header[4] ; j++ ) {
+					float* p = &data[( ( i - header[1] ) * tw + j - header[3] ) * 3];
+					camera->SetColor( i , j , Color( p[0] , p[1] , p[2] ) );
+				}
+			traced_rays += rays;
+			worker.tile = -1;
+			done++;
+		}
+	}
+
+	for ( int w = 0 ; w < ( int ) pool.size() ; w++ )
+		if ( pool[w].alive ) StopWorker( pool[w] , true );
+
+	OutputImage();
+
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	printf( "Distributed: %d tiles on %d workers, %d re-queued, %lld rays in %.3fs (%.3f MRays/s)\n" , tiles , ( int ) pool.size() , requeued ,
+		( long long ) traced_rays , seconds , traced_rays / seconds / 1e6 );
+}
+
+#else
+
+void Raytracer::WorkerRun( int ) {
+	printf( "worker processes need a POSIX system\n" );
+}
+
+void Raytracer::DistributedRun( std::vector<std::string> , int , int ) {
+	printf( "distributed rendering needs a POSIX system, rendering locally\n" );
+	MultiThreadRun();
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include"environment.h"
+#include"bmp.h"
+#include<cmath>
+#include<cstdio>
+#include<cstdlib>
+#include<algorithm>
+#define ran() ( double( rand() % 32768 ) / 32768 )
+#define fine_ran() ( ( double( rand() % 32768 ) + ran() ) / 32768 ) //a few hundred thousand texels need more than 15 bits
+
+const int STD_ENVIRONMENT_SAMPLES = 16;
+
+//forward , right and up of every face, seen from inside
+static const double FACE_AXES[6][9] = {
+	{ 1 , 0 , 0 ,   0 , -1 , 0 ,   0 , 0 , 1 } ,
+	{ -1 , 0 , 0 ,   0 , 1 , 0 ,   0 , 0 , 1 } ,
+	{ 0 , 1 , 0 ,   1 , 0 , 0 ,   0 , 0 , 1 } ,
+	{ 0 , -1 , 0 ,   -1 , 0 , 0 ,   0 , 0 , 1 } ,
+	{ 0 , 0 , 1 ,   1 , 0 , 0 ,   0 , -1 , 0 } ,
+	{ 0 , 0 , -1 ,   1 , 0 , 0 ,   0 , 1 , 0 }
+};
+
+static Vector3 FaceAxis( int face , int k ) {
+	return Vector3( FACE_AXES[face][3 * k] , FACE_AXES[face][3 * k + 1] , FACE_AXES[face][3 * k + 2] );
+}
+
+Environment::Environment() {
+	half_sides = mirror = false;
+	scale = 1;
+	samples = STD_ENVIRONMENT_SAMPLES;
+	sampling = ENVIRONMENT_MIXED;
+	for ( int f = 0 ; f < 6 ; f++ )
+		offset[f] = W[f] = H[f] = 0;
+}
+
+void Environment::Input( std::string var , std::stringstream& fin ) {
+	const char* face_key[6] = { "px=" , "nx=" , "py=" , "ny=" , "pz=" , "nz=" };
+	for ( int f = 0 ; f < 6 ; f++ )
+		if ( var == face_key[f] ) fin >> file[f];
+	//the five SkyBox images of A6 :: walls from the horizon up, the ground is the sky reversed
+	if ( var == "skybox=" ) {
+		std::string prefix; fin >> prefix;
+		const int image[5] = { 1 , 3 , 0 , 2 , 4 };
+		for ( int f = 0 ; f < 5 ; f++ )
+			file[f] = prefix + std::to_string( image[f] ) + ".bmp";
+		half_sides = mirror = true;
+	}
+	if ( var == "half_sides=" ) fin >> half_sides;
+	if ( var == "mirror=" ) fin >> mirror;
+	if ( var == "scale=" ) fin >> scale;
+	if ( var == "samples=" ) fin >> samples;
+	if ( var == "sampling=" ) {
+		std::string mode; fin >> mode;
+		if ( mode == "mixed" ) sampling = ENVIRONMENT_MIXED;
+		if ( mode == "cdf" ) sampling = ENVIRONMENT_CDF;
+		if ( mode == "uniform" ) sampling = ENVIRONMENT_UNIFORM;
+	}
+}
+
+Vector3 Environment::FacePoint( int face , double u , double v ) {
+	double b = ( half_sides && face < 4 ) ? 1 - v : 1 - 2 * v;
+	return FaceAxis( face , 0 ) + FaceAxis( face , 1 ) * ( 2 * u - 1 ) + FaceAxis( face , 2 ) * b;
+}
+
+double Environment::TexelArea( int face ) {
+	return ( 2.0 / W[face] ) * ( ( ( half_sides && face < 4 ) ? 1.0 : 2.0 ) / H[face] );
+}
+
+bool Environment::FaceCoord( Vector3 V , int& face , int& col , int& row ) {
+	if ( mirror && V.z < 0 ) V.z = -V.z;
+	double ax = fabs( V.x ) , ay = fabs( V.y ) , az = fabs( V.z );
+	if ( az >= ax && az >= ay ) face = ( V.z > 0 ) ? 4 : 5; else
+	if ( ax >= ay ) face = ( V.x > 0 ) ? 0 : 1; else
+		face = ( V.y > 0 ) ? 2 : 3;
+	if ( W[face] == 0 ) return false;
+
+	Vector3 P = V / V.Dot( FaceAxis( face , 0 ) );
+	double u = ( P.Dot( FaceAxis( face , 1 ) ) + 1 ) / 2 , b = P.Dot( FaceAxis( face , 2 ) );
+	double v = ( half_sides && face < 4 ) ? 1 - b : ( 1 - b ) / 2;
+	if ( v > 1 ) return false; //below a half side
+	col = std::min( std::max( ( int ) ( u * W[face] ) , 0 ) , W[face] - 1 );
+	row = std::min( std::max( ( int ) ( v * H[face] ) , 0 ) , H[face] - 1 );
+	return true;
+}
+
+void Environment::Load() {
+	texels.clear();
+	for ( int f = 0 ; f < 6 ; f++ ) {
+		offset[f] = ( int ) texels.size();
+		W[f] = H[f] = 0;
+		if ( file[f] == "" || ( mirror && f == 5 ) ) continue;
+		FILE* fp = fopen( file[f].c_str() , "rb" );
+		if ( fp == NULL ) {
+			fprintf( stderr , "environment :: cannot open %s\n" , file[f].c_str() );
+			continue;
+		}
+		fclose( fp );
+
+		Bmp bmp;
+		bmp.Input( file[f] );
+		W[f] = bmp.GetW();
+		H[f] = bmp.GetH();
+		//bmp rows run bottom up, the flat layout top down
+		texels.resize( offset[f] + W[f] * H[f] );
+		for ( int r = 0 ; r < H[f] ; r++ )
+			for ( int c = 0 ; c < W[f] ; c++ )
+				texels[offset[f] + r * W[f] + c] = bmp.GetColor( H[f] - 1 - r , c ) * scale;
+	}
+
+	//texel weight :: brightness times the solid angle it covers
+	row_cdf.assign( 1 , 0 );
+	texel_cdf.assign( texels.size() , 0 );
+	texel_pdf.assign( texels.size() , 0 );
+	row_face.clear();
+	row_start.clear();
+	double total = 0;
+	for ( int f = 0 ; f < 6 ; f++ )
+		for ( int r = 0 ; r < H[f] ; r++ ) {
+			int start = offset[f] + r * W[f];
+			double row_sum = 0;
+			for ( int c = 0 ; c < W[f] ; c++ ) {
+				double len = FacePoint( f , ( c + 0.5 ) / W[f] , ( r + 0.5 ) / H[f] ).Module();
+				Color& texel = texels[start + c];
+				texel_pdf[start + c] = ( texel.r + texel.g + texel.b ) / 3 * TexelArea( f ) / ( len * len * len );
+				row_sum += texel_pdf[start + c];
+				texel_cdf[start + c] = row_sum;
+			}
+			for ( int c = 0 ; c < W[f] ; c++ )
+				texel_cdf[start + c] = ( row_sum > 0 ) ? texel_cdf[start + c] / row_sum : ( c + 1.0 ) / W[f];
+			total += row_sum;
+			row_cdf.push_back( total );
+			row_face.push_back( f );
+			row_start.push_back( start );
+		}
+	for ( int g = 0 ; g < ( int ) row_cdf.size() ; g++ )
+		row_cdf[g] = ( total > 0 ) ? row_cdf[g] / total : 0;
+	for ( int t = 0 ; t < ( int ) texel_pdf.size() ; t++ )
+		texel_pdf[t] = ( total > 0 ) ? texel_pdf[t] / total : 0;
+}
+
+Color Environment::Lookup( Vector3 V ) {
+	int face , col , row;
+	if ( !FaceCoord( V , face , col , row ) ) return Color();
+	return texels[offset[face] + row * W[face] + col];
+}
+
+Vector3 Environment::SampleTexel( double& pdf ) {
+	pdf = 0;
+	int rows = ( int ) row_face.size();
+	if ( rows == 0 || row_cdf[rows] <= 0 ) return Vector3( 0 , 0 , 1 );
+	int g = std::upper_bound( row_cdf.begin() + 1 , row_cdf.end() , fine_ran() ) - ( row_cdf.begin() + 1 );
+	g = std::min( g , rows - 1 );
+	int face = row_face[g] , start = row_start[g];
+	int col = std::upper_bound( texel_cdf.begin() + start , texel_cdf.begin() + start + W[face] , fine_ran() ) - ( texel_cdf.begin() + start );
+	col = std::min( col , W[face] - 1 );
+	int row = ( start - offset[face] ) / W[face];
+
+	//uniform over the texel on the cube face, then from area to solid angle
+	Vector3 P = FacePoint( face , ( col + ran() ) / W[face] , ( row + ran() ) / H[face] );
+	double len = P.Module();
+	pdf = texel_pdf[start + col] / TexelArea( face ) * len * len * len;
+	P = P / len;
+	if ( mirror ) {
+		if ( ran() < 0.5 ) P.z = -P.z;
+		pdf /= 2;
+	}
+	return P;
+}
+
+double Environment::TexelPdf( Vector3 V ) {
+	int face , col , row;
+	if ( !FaceCoord( V , face , col , row ) ) return 0;
+	if ( mirror && V.z < 0 ) V.z = -V.z;
+	Vector3 P = V / V.Dot( FaceAxis( face , 0 ) );
+	double len = P.Module();
+	double pdf = texel_pdf[offset[face] + row * W[face] + col] / TexelArea( face ) * len * len * len;
+	return mirror ? pdf / 2 : pdf;
+}
+
+//the texel cdf knows nothing of the surface, half the draws follow the cosine instead
+Vector3 Environment::Sample( Vector3 N , double& pdf ) {
+	if ( sampling == ENVIRONMENT_CDF ) return SampleTexel( pdf );
+
+	Vector3 U = N.GetAnVerticalVector() , V = N * U;
+	if ( sampling == ENVIRONMENT_UNIFORM ) {
+		double cos_theta = ran() , phi = 2 * PI * ran() , sin_theta = sqrt( 1 - cos_theta * cos_theta );
+		pdf = 1 / ( 2 * PI );
+		return ( U * cos( phi ) + V * sin( phi ) ) * sin_theta + N * cos_theta;
+	}
+
+	Vector3 dir;
+	if ( ran() < 0.5 ) {
+		double sin2 = ran() , phi = 2 * PI * ran();
+		dir = ( U * cos( phi ) + V * sin( phi ) ) * sqrt( sin2 ) + N * sqrt( 1 - sin2 );
+	} else {
+		double texel;
+		dir = SampleTexel( texel );
+	}
+	pdf = ( std::max( dir.Dot( N ) , 0.0 ) / PI + TexelPdf( dir ) ) / 2;
+	return dir;
+}
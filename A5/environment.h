@@ -0,0 +1,51 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include"vector3.h"
+#include"color.h"
+#include<string>
+#include<sstream>
+#include<vector>
+
+extern const int STD_ENVIRONMENT_SAMPLES;
+
+//texel cdf and cosine lobe half and half weighted by their mixed pdf, the texel cdf alone, or uniform over the hemisphere
+enum EnvironmentSampling { ENVIRONMENT_MIXED , ENVIRONMENT_CDF , ENVIRONMENT_UNIFORM };
+
+//cube map around the scene :: looked up by rays that miss, importance sampled for diffuse shading
+//faces px nx py ny pz nz, seen from inside with +z up on the side faces
+class Environment {
+	std::string file[6];
+	bool half_sides; //the side images cover the upper half of their face only
+	bool mirror; //the lower hemisphere mirrors the upper one
+	double scale;
+	int samples;
+	EnvironmentSampling sampling;
+
+	//all faces in one flat texel array, face f starts at offset[f]
+	std::vector<Color> texels;
+	int offset[6] , W[6] , H[6];
+	//2d cdf :: rows of every face stacked, the marginal over rows and the conditional inside each row
+	std::vector<double> row_cdf , texel_cdf , texel_pdf;
+	std::vector<int> row_face , row_start;
+
+	bool FaceCoord( Vector3 V , int& face , int& col , int& row );
+	Vector3 FacePoint( int face , double u , double v ); //u left to right, v top to bottom, on the unit cube
+	double TexelArea( int face ); //on the cube face
+	Vector3 SampleTexel( double& pdf );
+	double TexelPdf( Vector3 V ); //solid angle pdf of SampleTexel
+
+public:
+	Environment();
+	~Environment() {}
+
+	int GetSamples() { return samples; }
+	EnvironmentSampling GetSampling() { return sampling; }
+
+	void Input( std::string var , std::stringstream& fin );
+	void Load(); //reads the faces and builds the cdf
+	Color Lookup( Vector3 V ); //radiance from direction V
+	Vector3 Sample( Vector3 N , double& pdf ); //direction with a solid angle pdf, 0 when nothing can be drawn
+};
+
+#endif
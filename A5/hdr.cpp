@@ -0,0 +1,64 @@
+#include"hdr.h"
+#include<cstdio>
+#include<cmath>
+#include<string>
+#include<algorithm>
+
+Hdr::Hdr( int H , int W ) {
+	Initialize( H , W );
+}
+
+void Hdr::Initialize( int H , int W ) {
+	this->H = H;
+	this->W = W;
+	data.assign( H * W * 3 , 0 );
+}
+
+void Hdr::SetColor( int i , int j , Color col ) {
+	float* p = &data[( i * W + j ) * 3];
+	p[0] = ( float ) col.r;
+	p[1] = ( float ) col.g;
+	p[2] = ( float ) col.b;
+}
+
+void Hdr::Output( std::string file ) {
+	if ( file.size() >= 4 && file.substr( file.size() - 4 ) == ".hdr" )
+		OutputRgbe( file );
+	else
+		OutputPfm( file );
+}
+
+void Hdr::OutputPfm( std::string file ) {
+	FILE *fpw = fopen( file.c_str() , "wb" );
+	if ( fpw == NULL ) return;
+	fprintf( fpw , "PF\n%d %d\n-1.0\n" , W , H ); //negative scale :: little-endian, rows bottom to top
+	if ( H * W > 0 ) fwrite( &data[0] , sizeof( float ) , H * W * 3 , fpw );
+	fclose( fpw );
+}
+
+void Hdr::OutputRgbe( std::string file ) {
+	FILE *fpw = fopen( file.c_str() , "wb" );
+	if ( fpw == NULL ) return;
+	fprintf( fpw , "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n" , H , W );
+
+	std::vector<unsigned char> row( W * 4 );
+	for ( int i = H - 1 ; i >= 0 ; i-- ) {
+		for ( int j = 0 ; j < W ; j++ ) {
+			float* p = &data[( i * W + j ) * 3];
+			float v = std::max( p[0] , std::max( p[1] , p[2] ) );
+			unsigned char* q = &row[j * 4];
+			if ( v < 1e-32f ) {
+				q[0] = q[1] = q[2] = q[3] = 0;
+				continue;
+			}
+			int e;
+			float m = frexpf( v , &e ) * 256.0f / v;
+			q[0] = ( unsigned char ) ( std::max( p[0] , 0.0f ) * m );
+			q[1] = ( unsigned char ) ( std::max( p[1] , 0.0f ) * m );
+			q[2] = ( unsigned char ) ( std::max( p[2] , 0.0f ) * m );
+			q[3] = ( unsigned char ) ( e + 128 );
+		}
+		fwrite( &row[0] , 1 , W * 4 , fpw );
+	}
+	fclose( fpw );
+}
@@ -0,0 +1,28 @@
+#ifndef HDR_H
+#define HDR_H
+
+#include"color.h"
+#include<string>
+#include<vector>
+
+//linear float image, written as PFM or, for a .hdr file name, Radiance RGBE
+class Hdr {
+	int H , W;
+	std::vector<float> data; //rgb triples, row 0 (the bottom row) first
+
+	void OutputPfm( std::string file );
+	void OutputRgbe( std::string file );
+
+public:
+	Hdr( int H = 0 , int W = 0 );
+	~Hdr() {}
+
+	int GetH() { return H; }
+	int GetW() { return W; }
+	void SetColor( int i , int j , Color );
+
+	void Initialize( int H , int W );
+	void Output( std::string file );
+};
+
+#endif
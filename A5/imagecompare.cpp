@@ -0,0 +1,90 @@
+#include"imagecompare.h"
+#include<cmath>
+#include<vector>
+#include<algorithm>
+
+const double STD_PIXEL_TOLERANCE = 8;
+const double STD_PIXEL_FRACTION = 0.01;
+const double STD_MIN_PSNR = 30;
+const double STD_MIN_SSIM = 0.95;
+
+const int SSIM_WINDOW = 8;
+const int SSIM_STRIDE = 4;
+
+ImageCompare::ImageCompare() {
+	pixel_tolerance = STD_PIXEL_TOLERANCE;
+	pixel_fraction = STD_PIXEL_FRACTION;
+	min_psnr = STD_MIN_PSNR;
+	min_ssim = STD_MIN_SSIM;
+}
+
+//mean structural similarity of two luma planes over a grid of windows
+static double Ssim( std::vector<double>& x , std::vector<double>& y , int H , int W ) {
+	const double C1 = ( 0.01 * 255 ) * ( 0.01 * 255 ) , C2 = ( 0.03 * 255 ) * ( 0.03 * 255 );
+	int wh = std::min( SSIM_WINDOW , H ) , ww = std::min( SSIM_WINDOW , W );
+	double total = 0;
+	int windows = 0;
+	for ( int i = 0 ; i + wh <= H ; i += SSIM_STRIDE ) {
+		for ( int j = 0 ; j + ww <= W ; j += SSIM_STRIDE ) {
+			double mx = 0 , my = 0 , sxx = 0 , syy = 0 , sxy = 0;
+			for ( int a = i ; a < i + wh ; a++ )
+				for ( int b = j ; b < j + ww ; b++ ) {
+					mx += x[a * W + b];
+					my += y[a * W + b];
+				}
+			int n = wh * ww;
+			mx /= n; my /= n;
+			for ( int a = i ; a < i + wh ; a++ )
+				for ( int b = j ; b < j + ww ; b++ ) {
+					double dx = x[a * W + b] - mx , dy = y[a * W + b] - my;
+					sxx += dx * dx; syy += dy * dy; sxy += dx * dy;
+				}
+			sxx /= n - 1; syy /= n - 1; sxy /= n - 1;
+			total += ( 2 * mx * my + C1 ) * ( 2 * sxy + C2 ) / ( ( mx * mx + my * my + C1 ) * ( sxx + syy + C2 ) );
+			windows++;
+		}
+	}
+	return ( windows > 0 ) ? total / windows : 1;
+}
+
+ImageDiff ImageCompare::Compare( Bmp* reference , Bmp* image , Bmp* diff ) {
+	ImageDiff ret;
+	ret.same_size = ( reference->GetH() == image->GetH() && reference->GetW() == image->GetW() );
+	ret.max_diff = 255;
+	ret.bad_fraction = 1;
+	ret.psnr = 0;
+	ret.ssim = 0;
+	ret.passed = false;
+	if ( !ret.same_size ) return ret;
+
+	int H = reference->GetH() , W = reference->GetW();
+	if ( diff != NULL ) diff->Initialize( H , W );
+	std::vector<double> luma_ref( H * W ) , luma_img( H * W );
+	double squared = 0;
+	int bad = 0;
+	ret.max_diff = 0;
+	for ( int i = 0 ; i < H ; i++ )
+		for ( int j = 0 ; j < W ; j++ ) {
+			Color a = reference->GetColor( i , j ) * 256 , b = image->GetColor( i , j ) * 256;
+			Color d = a - b;
+			int m = ( int ) ( std::max( fabs( d.r ) , std::max( fabs( d.g ) , fabs( d.b ) ) ) + 0.5 );
+			ret.max_diff = std::max( ret.max_diff , m );
+			if ( m > pixel_tolerance ) bad++;
+			squared += d.r * d.r + d.g * d.g + d.b * d.b;
+			luma_ref[i * W + j] = 0.299 * a.r + 0.587 * a.g + 0.114 * a.b;
+			luma_img[i * W + j] = 0.299 * b.r + 0.587 * b.g + 0.114 * b.b;
+
+			//failing pixels in red over a dimmed reference, the rest as the difference times 8
+			if ( diff != NULL ) {
+				if ( m > pixel_tolerance ) diff->SetColor( i , j , Color( 1 , 0 , 0 ) );
+				else diff->SetColor( i , j , Color( fabs( d.r ) , fabs( d.g ) , fabs( d.b ) ) * 8 / 255 + Color( 1 , 1 , 1 ) * ( luma_ref[i * W + j] / 255 * 0.25 ) );
+			}
+		}
+
+	double mse = squared / ( 3.0 * H * W );
+	ret.bad_fraction = ( double ) bad / ( H * W );
+	ret.psnr = ( mse > 0 ) ? 10 * log10( 255.0 * 255.0 / mse ) : 1e9;
+	ret.ssim = Ssim( luma_ref , luma_img , H , W );
+	ret.passed = ret.bad_fraction <= pixel_fraction && ret.psnr >= min_psnr && ret.ssim >= min_ssim;
+	return ret;
+}
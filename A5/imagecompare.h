@@ -0,0 +1,35 @@
+#ifndef IMAGECOMPARE_H
+#define IMAGECOMPARE_H
+
+#include"bmp.h"
+
+extern const double STD_PIXEL_TOLERANCE; //largest channel difference in 0..255 that still counts as equal
+extern const double STD_PIXEL_FRACTION; //share of pixels allowed above the tolerance
+extern const double STD_MIN_PSNR;
+extern const double STD_MIN_SSIM;
+
+struct ImageDiff {
+	bool same_size;
+	int max_diff;
+	double bad_fraction;
+	double psnr; //dB, 1e9 for identical images
+	double ssim; //mean over 8x8 windows of the luma
+	bool passed;
+};
+
+class ImageCompare {
+	double pixel_tolerance , pixel_fraction , min_psnr , min_ssim;
+
+public:
+	ImageCompare();
+	~ImageCompare() {}
+
+	void SetPixelTolerance( double t ) { pixel_tolerance = t; }
+	void SetPixelFraction( double f ) { pixel_fraction = f; }
+	void SetMinPsnr( double p ) { min_psnr = p; }
+	void SetMinSsim( double s ) { min_ssim = s; }
+
+	ImageDiff Compare( Bmp* reference , Bmp* image , Bmp* diff ); //diff, if not NULL, gets the amplified difference
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include"imagewriter.h"
+#include"bmp.h"
+#include"hdr.h"
+#include<chrono>
+
+const int IMAGE_WRITER_QUEUE = 2; //frames waiting for the writer, each holds a float framebuffer
+
+ImageWriter::ImageWriter() {
+	writing = false;
+	stop = false;
+	frames = 0;
+	bytes = 0;
+	write_seconds = blocked_seconds = 0;
+	worker = std::thread( &ImageWriter::WorkerLoop , this );
+}
+
+ImageWriter::~ImageWriter() {
+	{
+		std::unique_lock<std::mutex> lock( mtx );
+		stop = true;
+	}
+	cv_job.notify_all();
+	worker.join();
+	for ( int k = 0 ; k < ( int ) spare.size() ; k++ )
+		delete spare[k];
+}
+
+long long ImageWriter::Write( ImageJob& job ) {
+	int H = job.H , W = job.W;
+	if ( job.hdr_output != "" ) {
+		Hdr hdr( H , W );
+		for ( int i = 0 ; i < H ; i++ )
+			for ( int j = 0 ; j < W ; j++ )
+				hdr.SetColor( i , j , Color( job.color[0][i * W + j] , job.color[1][i * W + j] , job.color[2][i * W + j] ) );
+		hdr.Output( job.hdr_output );
+	}
+
+	job.tonemapper.Run( job.color );
+	Bmp bmp( H , W );
+	for ( int i = 0 ; i < H ; i++ )
+		for ( int j = 0 ; j < W ; j++ )
+			bmp.SetColor( i , j , Color( job.color[0][i * W + j] , job.color[1][i * W + j] , job.color[2][i * W + j] ) );
+	return bmp.Output( job.output );
+}
+
+void ImageWriter::WorkerLoop() {
+	while ( true ) {
+		ImageJob* job = NULL;
+		{
+			std::unique_lock<std::mutex> lock( mtx );
+			cv_job.wait( lock , [&]() { return stop || !jobs.empty(); } );
+			//the queue drains before a stop takes effect
+			if ( jobs.empty() ) return;
+			job = jobs.front();
+			jobs.pop_front();
+			writing = true;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		long long written = Write( *job );
+		double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+		std::unique_lock<std::mutex> lock( mtx );
+		spare.push_back( job );
+		writing = false;
+		frames++;
+		bytes += written;
+		write_seconds += seconds;
+		cv_done.notify_all();
+	}
+}
+
+ImageJob* ImageWriter::NewJob() {
+	std::unique_lock<std::mutex> lock( mtx );
+	if ( spare.empty() ) return new ImageJob;
+	ImageJob* job = spare.back();
+	spare.pop_back();
+	return job;
+}
+
+void ImageWriter::Submit( ImageJob* job ) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock( mtx );
+	cv_done.wait( lock , [&]() { return ( int ) jobs.size() < IMAGE_WRITER_QUEUE; } );
+	blocked_seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	jobs.push_back( job );
+	cv_job.notify_one();
+}
+
+void ImageWriter::Flush() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock( mtx );
+	cv_done.wait( lock , [&]() { return jobs.empty() && !writing; } );
+	blocked_seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
@@ -0,0 +1,51 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include"tonemap.h"
+#include<string>
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+
+extern const int IMAGE_WRITER_QUEUE;
+
+//one finished frame :: the linear framebuffer and everything needed to turn it into files
+struct ImageJob {
+	int H , W;
+	std::vector<float> color[3]; //linear planes, row 0 at the bottom
+	ToneMapper tonemapper;
+	std::string output , hdr_output; //hdr_output empty :: no float image
+};
+
+//converts, encodes and writes frames on a background thread while the next one renders
+class ImageWriter {
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cv_job , cv_done;
+	std::deque<ImageJob*> jobs;
+	std::vector<ImageJob*> spare; //written jobs kept for their already faulted in framebuffers
+	bool writing , stop;
+	int frames;
+	long long bytes; //of the tone mapped images
+	double write_seconds , blocked_seconds; //on the writer, and callers waiting for a free slot or a flush
+
+	void WorkerLoop();
+
+public:
+	ImageWriter();
+	~ImageWriter(); //writes whatever is still queued
+
+	static long long Write( ImageJob& job ); //on the calling thread :: bytes of the tone mapped image
+	ImageJob* NewJob(); //a spare one when there is
+	void Submit( ImageJob* job ); //takes the job, waits while IMAGE_WRITER_QUEUE frames are queued
+	void Flush(); //waits until every submitted frame is on disk
+
+	int GetFrames() { return frames; }
+	long long GetBytes() { return bytes; }
+	double GetWriteSeconds() { return write_seconds; }
+	double GetBlockedSeconds() { return blocked_seconds; }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include"irradiancecache.h"
+#include<cmath>
+#include<algorithm>
+#include<mutex>
+
+const double STD_IRRADIANCE_ERROR = 0.3;
+const double STD_IRRADIANCE_MIN_SPACING = 0.02;
+const double STD_IRRADIANCE_MAX_SPACING = 2;
+const int STD_IRRADIANCE_PREPASS = 4;
+
+IrradianceNode::IrradianceNode() {
+	for ( int k = 0 ; k < 8 ; k++ )
+		child[k] = NULL;
+}
+
+IrradianceNode::~IrradianceNode() {
+	for ( int k = 0 ; k < 8 ; k++ )
+		if ( child[k] != NULL ) delete child[k];
+}
+
+IrradianceCache::IrradianceCache() {
+	error = STD_IRRADIANCE_ERROR;
+	min_spacing = STD_IRRADIANCE_MIN_SPACING;
+	max_spacing = STD_IRRADIANCE_MAX_SPACING;
+	prepass = STD_IRRADIANCE_PREPASS;
+	root = NULL;
+	half = 0;
+	lookups = hits = 0;
+	records = 0;
+}
+
+IrradianceCache::~IrradianceCache() {
+	if ( root != NULL ) delete root;
+}
+
+void IrradianceCache::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "error=" ) fin >> error;
+	if ( var == "min_spacing=" ) fin >> min_spacing;
+	if ( var == "max_spacing=" ) fin >> max_spacing;
+	if ( var == "prepass=" ) fin >> prepass;
+}
+
+static int Octant( const Vector3& P , const Vector3& center ) {
+	return ( P.x >= center.x ? 1 : 0 ) | ( P.y >= center.y ? 2 : 0 ) | ( P.z >= center.z ? 4 : 0 );
+}
+
+static Vector3 ChildCenter( const Vector3& center , double half , int octant ) {
+	double q = half / 2;
+	return center + Vector3( ( octant & 1 ) ? q : -q , ( octant & 2 ) ? q : -q , ( octant & 4 ) ? q : -q );
+}
+
+static bool Inside( const Vector3& lo , const Vector3& hi , const Vector3& center , double half ) {
+	return lo.x >= center.x - half && lo.y >= center.y - half && lo.z >= center.z - half &&
+	       hi.x <= center.x + half && hi.y <= center.y + half && hi.z <= center.z + half;
+}
+
+bool IrradianceCache::Lookup( Vector3 P , Vector3 N , Color& E ) {
+	lookups++;
+	std::shared_lock<std::shared_timed_mutex> lock( mtx );
+	if ( root == NULL || !Inside( P , P , center , half ) ) return false;
+
+	//Ward's weight 1 / ( d / R + sqrt( 1 - N.Ni ) ), records count while it stays above 1 / error
+	Color sum;
+	double weight = 0;
+	IrradianceNode* node = root;
+	Vector3 node_center = center;
+	double node_half = half;
+	while ( node != NULL ) {
+		for ( int k = 0 ; k < ( int ) node->records.size() ; k++ ) {
+			IrradianceRecord& record = node->records[k];
+			Vector3 D = P - record.P;
+			double bend = std::max( 1 - N.Dot( record.N ) , 0.0 );
+			double e = D.Module() / record.R + sqrt( bend );
+			if ( e >= error ) continue;
+			if ( D.Dot( N + record.N ) < -0.1 * record.R ) continue; //P lies behind the record
+			Vector3 turn = record.N * N;
+			Color estimate = record.E + Color( turn.Dot( record.grad_r[0] ) , turn.Dot( record.grad_r[1] ) , turn.Dot( record.grad_r[2] ) ) +
+			                 Color( D.Dot( record.grad_t[0] ) , D.Dot( record.grad_t[1] ) , D.Dot( record.grad_t[2] ) );
+			double w = 1 / std::max( e , 1e-6 );
+			sum += estimate * w;
+			weight += w;
+		}
+		int octant = Octant( P , node_center );
+		node_center = ChildCenter( node_center , node_half , octant );
+		node_half /= 2;
+		node = node->child[octant];
+	}
+	if ( weight <= 0 ) return false;
+
+	E = sum / weight;
+	E = Color( std::max( E.r , 0.0 ) , std::max( E.g , 0.0 ) , std::max( E.b , 0.0 ) );
+	hits++;
+	return true;
+}
+
+//doubles the root towards the box until it fits, the old root becomes one octant
+void IrradianceCache::Grow( Vector3 lo , Vector3 hi ) {
+	if ( root == NULL ) {
+		root = new IrradianceNode;
+		center = ( lo + hi ) / 2;
+		half = std::max( hi.x - lo.x , std::max( hi.y - lo.y , hi.z - lo.z ) ) * 4;
+	}
+	while ( !Inside( lo , hi , center , half ) ) {
+		Vector3 new_center = center + Vector3( lo.x < center.x - half ? -half : half ,
+		                                       lo.y < center.y - half ? -half : half ,
+		                                       lo.z < center.z - half ? -half : half );
+		IrradianceNode* new_root = new IrradianceNode;
+		new_root->child[Octant( center , new_center )] = root;
+		root = new_root;
+		center = new_center;
+		half *= 2;
+	}
+}
+
+//a record sits in every node overlapping its validity box, on the level where the nodes are about as big as the box
+void IrradianceCache::Insert( IrradianceNode* node , Vector3 node_center , double node_half , IrradianceRecord& record , Vector3 lo , Vector3 hi ) {
+	if ( node_half / 2 < ( hi.x - lo.x ) / 2 ) {
+		node->records.push_back( record );
+		return;
+	}
+	double q = node_half / 2;
+	for ( int octant = 0 ; octant < 8 ; octant++ ) {
+		Vector3 c = ChildCenter( node_center , node_half , octant );
+		if ( lo.x > c.x + q || hi.x < c.x - q || lo.y > c.y + q || hi.y < c.y - q || lo.z > c.z + q || hi.z < c.z - q ) continue;
+		if ( node->child[octant] == NULL ) node->child[octant] = new IrradianceNode;
+		Insert( node->child[octant] , c , q , record , lo , hi );
+	}
+}
+
+void IrradianceCache::Add( IrradianceRecord& record ) {
+	double radius = record.R * error;
+	//near walls the translation gradient overshoots, it may not move E by more than E itself inside the record
+	double E[3] = { record.E.r , record.E.g , record.E.b };
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		double change = record.grad_t[c].Module() * radius;
+		if ( change > E[c] ) record.grad_t[c] *= E[c] / change;
+	}
+	Vector3 lo = record.P - Vector3( radius , radius , radius ) , hi = record.P + Vector3( radius , radius , radius );
+	std::unique_lock<std::shared_timed_mutex> lock( mtx );
+	Grow( lo , hi );
+	Insert( root , center , half , record , lo , hi );
+	records++;
+}
+
+void IrradianceCache::Clear() {
+	std::unique_lock<std::shared_timed_mutex> lock( mtx );
+	if ( root != NULL ) delete root;
+	root = NULL;
+	records = 0;
+}
+
+void IrradianceCache::ResetCounters() {
+	lookups = hits = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef IRRADIANCECACHE_H
+#define IRRADIANCECACHE_H
+
+#include"vector3.h"
+#include"color.h"
+#include<string>
+#include<sstream>
+#include<vector>
+#include<atomic>
+#include<shared_mutex>
+
+extern const double STD_IRRADIANCE_ERROR; //Ward's a :: larger reuses records further away
+extern const double STD_IRRADIANCE_MIN_SPACING;
+extern const double STD_IRRADIANCE_MAX_SPACING;
+extern const int STD_IRRADIANCE_PREPASS; //pixel stride of the warm-up pass, 0 for none
+
+//one hemisphere gather :: indirect irradiance over pi with its rotation and translation gradients
+struct IrradianceRecord {
+	Vector3 P , N;
+	Color E;
+	Vector3 grad_r[3] , grad_t[3]; //per channel
+	double R; //harmonic mean distance of the gather rays, clamped to the spacing limits
+};
+
+struct IrradianceNode {
+	IrradianceNode* child[8];
+	std::vector<IrradianceRecord> records;
+	IrradianceNode();
+	~IrradianceNode();
+};
+
+//octree of irradiance records, looked up by many threads and filled lazily
+class IrradianceCache {
+	double error , min_spacing , max_spacing;
+	int prepass;
+	IrradianceNode* root;
+	Vector3 center;
+	double half; //the root covers center +- half
+	std::shared_timed_mutex mtx;
+	std::atomic<long long> lookups , hits;
+	std::atomic<int> records;
+
+	void Grow( Vector3 lo , Vector3 hi );
+	void Insert( IrradianceNode* node , Vector3 node_center , double node_half , IrradianceRecord& record , Vector3 lo , Vector3 hi );
+
+public:
+	IrradianceCache();
+	~IrradianceCache();
+
+	double GetMinSpacing() { return min_spacing; }
+	double GetMaxSpacing() { return max_spacing; }
+	int GetPrepass() { return prepass; }
+	long long GetLookups() { return lookups; }
+	long long GetHits() { return hits; }
+	int GetRecordCount() { return records; }
+
+	void Input( std::string var , std::stringstream& fin );
+	bool Lookup( Vector3 P , Vector3 N , Color& E ); //false when no record is close enough
+	void Add( IrradianceRecord& record );
+	void Clear(); //after the geometry has moved
+	void ResetCounters();
+};
+
+#endif
@@ -1,12 +1,24 @@
 #include"light.h"
+#include"scene.h"
+#include"sampler.h"
 #include<sstream>
 #include<string>
 #include<cmath>
 #include<cstdlib>
+#include<algorithm>
+#include<vector>
+#include<atomic>
 #define ran() ( double( rand() % 32768 ) / 32768 )
 
+//each thread drops its cache for another scene or a newer generation, so no pointer outlives the scene it came from
+static std::atomic<int> occluder_generation( 0 );
+static thread_local int last_occluder_generation = -1;
+static thread_local Scene* last_occluder_scene = NULL;
+static thread_local std::vector<Primitive*> last_occluder;
+
 Light::Light() {
 	sample = rand();
+	slot = 0;
 	next = NULL;
 	lightPrimitive = NULL;
 }
@@ -15,22 +27,42 @@ void Light::Input( std::string var , std::stringstream& fin ) {
 	if ( var == "color=" ) color.Input( fin );
 }
 
+void Light::ClearOccluderCaches() {
+	occluder_generation++;
+}
+
+//neighbouring shading points are mostly blocked by the same primitive, so that one is tested before the traversal
+double Light::Visible( Vector3 C , Vector3 P , Scene* scene ) {
+	STAT_INC( STAT_SHADOW_RAYS );
+	if ( last_occluder_generation != occluder_generation || last_occluder_scene != scene ) {
+		last_occluder_generation = occluder_generation;
+		last_occluder_scene = scene;
+		last_occluder.clear();
+	}
+	if ( slot >= ( int ) last_occluder.size() ) last_occluder.resize( slot + 1 , NULL );
+	Primitive*& last = last_occluder[slot];
+	if ( last != NULL ) {
+		STAT_INC( STAT_OCCLUDER_TESTS );
+		Vector3 V = P - C;
+		double dist = V.Module();
+		CollidePrimitive tmp = last->Collide( C , V );
+		if ( tmp.isCollide && EPS < dist - tmp.dist ) {
+			STAT_INC( STAT_OCCLUDER_HITS );
+			return 0;
+		}
+	}
+	last = scene->FindOccluder( C , P , lightPrimitive );
+	return ( last != NULL ) ? 0 : 1;
+}
+
 void PointLight::Input( std::string var , std::stringstream& fin ) {
 	if ( var == "O=" ) O.Input( fin );
 	Light::Input( var , fin );
 }
 
 
-double PointLight::CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality ) {
-	Vector3 V = O - C;
-	double dist = V.Module();
-	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() )
-	{
-		CollidePrimitive tmp = now->Collide(C, V);
-		if ( EPS < (dist - tmp.dist) )  return 0;
-	}
-
-	return 1;
+double PointLight::CalnShade( Vector3 C , Scene* scene , int shade_quality ) {
+	return Visible( C , O , scene );
 }
 
 void SquareLight::Input( std::string var , std::stringstream& fin ) {
@@ -41,10 +73,35 @@ void SquareLight::Input( std::string var , std::stringstream& fin ) {
 }
 
 
-double SquareLight::CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality ) {
-	int shade = 0;
-	//NEED TO IMPLEMENT
-	return 0;
+//a low discrepancy sampler draws all the shadow rays as one stratified set, rand() keeps the jittered grid
+double SquareLight::CalnShade( Vector3 C , Scene* scene , int shade_quality ) {
+	double shade = 0;
+	if ( !thread_sampler.IsRandom() ) {
+		int d = thread_sampler.Reserve( 2 ) , n = 16 * shade_quality;
+		for ( int s = 0 ; s < n ; s++ ) {
+			Vector3 N;
+			Vector3 P = Sample( C , thread_sampler.Get( d , s , n ) , thread_sampler.Get( d + 1 , s , n ) , N );
+			shade += Visible( C , P , scene );
+		}
+		return shade / n;
+	}
+	for ( int i = 0 ; i < 4 * shade_quality ; i++ )
+		for ( int j = 0 ; j < 4 ; j++ ) {
+			Vector3 N;
+			Vector3 P = Sample( C , ( i + ran() ) / ( 4 * shade_quality ) , ( j + ran() ) / 4 , N );
+			shade += Visible( C , P , scene );
+		}
+	return shade / ( 16 * shade_quality );
+}
+
+Vector3 SquareLight::Sample( Vector3 C , double u , double v , Vector3& N ) {
+	N = ( Dx * Dy ).GetUnitVector();
+	if ( N.Dot( C - O ) < 0 ) N = -N;
+	return O + Dx * ( 2 * u - 1 ) + Dy * ( 2 * v - 1 );
+}
+
+double SquareLight::GetArea() {
+	return 4 * ( Dx * Dy ).Module();
 }
 
 Primitive* SquareLight::CreateLightPrimitive()
@@ -63,10 +120,36 @@ void SphereLight::Input( std::string var , std::stringstream& fin ) {
 }
 
 
-double SphereLight::CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality ) {
-	int shade = 0;
-	//NEED TO IMPLEMENT
-	return 0;
+double SphereLight::CalnShade( Vector3 C , Scene* scene , int shade_quality ) {
+	//sample the disc the sphere projects to as seen from C
+	Vector3 V = ( O - C ).GetUnitVector();
+	Vector3 Dx = V.GetAnVerticalVector();
+	Vector3 Dy = V * Dx;
+	double shade = 0;
+	bool random = thread_sampler.IsRandom();
+	int d = thread_sampler.Reserve( 2 ) , n = 16 * shade_quality;
+	for ( int i = 0 ; i < n ; i++ ) {
+		double r = R * sqrt( random ? ( i + ran() ) / n : thread_sampler.Get( d , i , n ) );
+		double theta = ( random ? ran() : thread_sampler.Get( d + 1 , i , n ) ) * 2 * PI;
+		shade += Visible( C , O + Dx * ( r * cos( theta ) ) + Dy * ( r * sin( theta ) ) , scene );
+	}
+	return shade / ( 16 * shade_quality );
+}
+
+//the far half cannot be seen from C, only the hemisphere facing it is sampled
+Vector3 SphereLight::Sample( Vector3 C , double u , double v , Vector3& N ) {
+	Vector3 A = ( C - O ).GetUnitVector();
+	Vector3 Dx = A.GetAnVerticalVector();
+	Vector3 Dy = A * Dx;
+	double z = u;
+	double r = sqrt( std::max( 0.0 , 1 - z * z ) );
+	double phi = 2 * PI * v;
+	N = A * z + Dx * ( r * cos( phi ) ) + Dy * ( r * sin( phi ) );
+	return O + N * R;
+}
+
+double SphereLight::GetArea() {
+	return 2 * PI * R * R;
 }
 
 
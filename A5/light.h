@@ -10,9 +10,12 @@
 
 extern const double EPS;
 
+class Scene;
+
 class Light {
 protected:
 	int sample;
+	int slot; //index of this light in its scene, and so in each thread's last occluder cache
 	Color color;
 	Light* next;
 	Primitive* lightPrimitive;
@@ -20,18 +23,24 @@ protected:
 public:
 
 	Light();
-	~Light() {}
+	virtual ~Light() {}
 	
 	int GetSample() { return sample; }
 	Color GetColor() { return color; }
 	Light* GetNext() { return next; }
 	void SetNext( Light* light ) { next = light; }
+	void SetSlot( int light_slot ) { slot = light_slot; }
+	static void ClearOccluderCaches(); //call when a scene is created :: every thread forgets its cached primitives
+	Primitive* GetLightPrimitive() { return lightPrimitive; }
+	double Visible( Vector3 C , Vector3 P , Scene* scene ); //1 if nothing but the light itself blocks C->P, tries the last occluder first
 
 	virtual bool IsPointLight() = 0;
 	virtual void Input( std::string , std::stringstream& );
 	virtual Vector3 GetO() = 0;
-	virtual double CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality ) = 0;
+	virtual double CalnShade( Vector3 C , Scene* scene , int shade_quality ) = 0;
 	virtual Primitive* CreateLightPrimitive() = 0;
+	virtual Vector3 Sample( Vector3 C , double u , double v , Vector3& N ) = 0; //uniform point on the part of the surface facing C, N :: its normal on the side of C
+	virtual double GetArea() = 0; //of the part Sample draws from, 0 for delta lights
 };
 
 class PointLight : public Light {
@@ -43,8 +52,10 @@ public:
 	bool IsPointLight() { return true; }
 	Vector3 GetO() { return O; }
 	void Input( std::string , std::stringstream& );
-	double CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality );
+	double CalnShade( Vector3 C , Scene* scene , int shade_quality );
 	Primitive* CreateLightPrimitive(){return NULL;}
+	Vector3 Sample( Vector3 , double , double , Vector3& N ) { N = Vector3(); return O; }
+	double GetArea() { return 0; }
 };
 
 class SquareLight : public Light {
@@ -57,8 +68,10 @@ public:
 	bool IsPointLight() { return false; }
 	Vector3 GetO() { return O; }
 	void Input( std::string , std::stringstream& );
-	double CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality );
+	double CalnShade( Vector3 C , Scene* scene , int shade_quality );
 	Primitive* CreateLightPrimitive();
+	Vector3 Sample( Vector3 C , double u , double v , Vector3& N );
+	double GetArea();
 };
 
 class SphereLight : public Light {
@@ -71,8 +84,10 @@ public:
 	bool IsPointLight() { return false; }
 	Vector3 GetO() { return O; }
 	void Input( std::string , std::stringstream& );
-	double CalnShade( Vector3 C , Primitive* primitive_head , int shade_quality );
+	double CalnShade( Vector3 C , Scene* scene , int shade_quality );
 	Primitive* CreateLightPrimitive();
+	Vector3 Sample( Vector3 C , double u , double v , Vector3& N );
+	double GetArea();
 };
 
 
@@ -0,0 +1,87 @@
+#include"lighttree.h"
+#include<cmath>
+#include<cstdlib>
+#include<algorithm>
+#define ran() ( double( rand() % 32768 ) / 32768 )
+#define fine_ran() ( ( double( rand() % 32768 ) + ran() ) / 32768 ) //small branch probabilities need more than 15 bits
+
+static double Luminance( Color color ) {
+	return std::max( 0.299 * color.r + 0.587 * color.g + 0.114 * color.b , 0.0 );
+}
+
+void LightTree::Build( Light* light_head ) {
+	nodes.clear();
+	lights.clear();
+	for ( Light* light = light_head ; light != NULL ; light = light->GetNext() )
+		lights.push_back( light );
+	if ( lights.empty() ) return;
+	nodes.reserve( 2 * lights.size() );
+	nodes.push_back( LightNode() );
+	Build( 0 , 0 , ( int ) lights.size() );
+}
+
+//median split along the widest axis of the centres, children take two neighbouring slots
+void LightTree::Build( int node , int begin , int end ) {
+	Vector3 lo = lights[begin]->GetO() , hi = lo;
+	double power = 0;
+	for ( int k = begin ; k < end ; k++ ) {
+		Vector3 O = lights[k]->GetO();
+		lo = Vector3( std::min( lo.x , O.x ) , std::min( lo.y , O.y ) , std::min( lo.z , O.z ) );
+		hi = Vector3( std::max( hi.x , O.x ) , std::max( hi.y , O.y ) , std::max( hi.z , O.z ) );
+		power += Luminance( lights[k]->GetColor() );
+	}
+	nodes[node].lo = lo;
+	nodes[node].hi = hi;
+	nodes[node].power = power;
+	nodes[node].left = -1;
+	nodes[node].light = ( end - begin == 1 ) ? begin : -1;
+	if ( end - begin == 1 ) return;
+
+	Vector3 extent = hi - lo;
+	int axis = ( extent.x > extent.y && extent.x > extent.z ) ? 0 : ( extent.y > extent.z ) ? 1 : 2;
+	int mid = ( begin + end ) / 2;
+	std::nth_element( lights.begin() + begin , lights.begin() + mid , lights.begin() + end , [axis]( Light* a , Light* b ) {
+		return a->GetO().GetCoord( axis ) < b->GetO().GetCoord( axis );
+	} );
+	int left = ( int ) nodes.size();
+	nodes.push_back( LightNode() );
+	nodes.push_back( LightNode() );
+	nodes[node].left = left;
+	Build( left , begin , mid );
+	Build( left + 1 , mid , end );
+}
+
+//power times the largest cosine any centre in the box can make with N :: never 0 while a light in it can contribute
+double LightTree::Importance( LightNode& node , Vector3& C , Vector3& N ) {
+	if ( node.power <= 0 ) return 0;
+	Vector3 centre = ( node.lo + node.hi ) / 2;
+	Vector3 D = centre - C;
+	double dist = D.Module() , radius = ( node.hi - node.lo ).Module() / 2;
+	if ( dist <= radius + EPS ) return node.power;
+	double cos_axis = D.Dot( N ) / dist;
+	double theta = acos( std::min( std::max( cos_axis , -1.0 ) , 1.0 ) ) - asin( radius / dist );
+	if ( theta <= 0 ) return node.power;
+	if ( theta >= PI / 2 ) return 0;
+	return node.power * cos( theta );
+}
+
+Light* LightTree::Sample( Vector3 C , Vector3 N , double& pdf ) {
+	pdf = 1;
+	if ( nodes.empty() ) return NULL;
+	int node = 0;
+	if ( Importance( nodes[0] , C , N ) <= 0 ) return NULL;
+	while ( nodes[node].light < 0 ) {
+		int left = nodes[node].left;
+		double a = Importance( nodes[left] , C , N ) , b = Importance( nodes[left + 1] , C , N );
+		if ( a + b <= 0 ) return NULL;
+		double p = a / ( a + b );
+		if ( fine_ran() < p ) {
+			node = left;
+			pdf *= p;
+		} else {
+			node = left + 1;
+			pdf *= 1 - p;
+		}
+	}
+	return lights[nodes[node].light];
+}
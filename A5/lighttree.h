@@ -0,0 +1,32 @@
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+#include"vector3.h"
+#include"light.h"
+#include<vector>
+
+struct LightNode {
+	Vector3 lo , hi; //bounds of the light centres
+	double power; //summed luminance of the colours
+	int left; //inner node :: children at left and left + 1
+	int light; //leaf :: index into lights, -1 for inner nodes
+};
+
+//binary tree over the lights for picking one with probability proportional to its bounded contribution
+class LightTree {
+	std::vector<LightNode> nodes;
+	std::vector<Light*> lights;
+
+	void Build( int node , int begin , int end );
+	double Importance( LightNode& node , Vector3& C , Vector3& N );
+
+public:
+	LightTree() {}
+	~LightTree() {}
+
+	int GetLightCount() { return ( int ) lights.size(); }
+	void Build( Light* light_head );
+	Light* Sample( Vector3 C , Vector3 N , double& pdf ); //NULL when no light can reach C
+};
+
+#endif
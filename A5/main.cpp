@@ -1,11 +1,312 @@
 #include"raytracer.h"
-int main() {
+#include"stats.h"
+#include"benchmark.h"
+#include"imagecompare.h"
+#include<cstdio>
+#include<cstdlib>
+#include<string>
+#include<chrono>
+#include<sstream>
+#include<vector>
+
+void Usage() {
+	printf( "usage: raytracer [options]\n" );
+	printf( "  --scene FILE          scene description (default scene.txt)\n" );
+	printf( "  --output FILE         tone mapped image, .qoi for QOI, otherwise bmp (default pictureT4.bmp)\n" );
+	printf( "  --hdr FILE            linear image, .hdr for RGBE, otherwise PFM\n" );
+	printf( "  --aov FILE            depth/normal/albedo/primitive/samples buffers\n" );
+	printf( "  --engine NAME         whitted (default), wavefront or path\n" );
+	printf( "  --threads N           worker threads (default one per hardware thread)\n" );
+	printf( "  --spp N               path tracing samples per pixel (overrides the scene)\n" );
+	printf( "  --deadline MS         path trace for MS milliseconds :: a quick pass, then the noisiest tiles\n" );
+	printf( "  --region X0 X1 Y0 Y1  render only columns [X0,X1) and rows [Y0,Y1) from the top\n" );
+	printf( "  --seed N              random seed\n" );
+	printf( "  --stats FILE          write the render counters as JSON (debug builds or RT_STATS)\n" );
+	printf( "  --no-irradiance-cache gather indirect light at every diffuse hit, for comparison\n" );
+	printf( "  --sequence PATTERN    render every frame of the scene's animation block into PATTERN, e.g. frame%%03d.bmp\n" );
+	printf( "  --async-output        tone map, encode and write frames on a background thread while the next one renders\n" );
+	printf( "distributed rendering (POSIX):\n" );
+	printf( "  --workers N           split the image into tiles rendered by N worker processes\n" );
+	printf( "  --worker-cmd CMD      start workers with CMD instead of this program, e.g. \"ssh host /path/raytracer\"\n" );
+	printf( "                        (the scene path must be valid on that machine)\n" );
+	printf( "  --worker              serve tiles on stdin/stdout, started by the coordinator\n" );
+	printf( "  --worker-crash-after N  testing :: the first worker dies after N tiles\n" );
+	printf( "benchmark mode, run from the directory holding the texture bmps:\n" );
+	printf( "  --benchmark NAME      generated scene to render, or all (spheres cornell glass textured lathes cubes)\n" );
+	printf( "  --count N             primitives per generated scene (default 64)\n" );
+	printf( "  --size W H            benchmark image size (default 320 180)\n" );
+	printf( "  --save-baseline FILE  store the results\n" );
+	printf( "  --baseline FILE       compare against stored results, exit code 2 on regressions\n" );
+	printf( "  --tolerance F         allowed MRays/s drop before flagging (default 0.1)\n" );
+	printf( "  --many-lights K       render 1, 100 and 10000 point lights, every light against K picked from the light tree\n" );
+	printf( "  --environment PREFIX  diffuse spheres under the SkyBox<n>.bmp sky at PREFIX (e.g. ../A6/SkyBox),\n" );
+	printf( "                        RMSE of uniform, cdf and mixed sampling for 1 to 64 samples\n" );
+	printf( "  --terrain N [M]       fractal heightfields of 256 up to N cells a side (default 4096) against\n" );
+	printf( "                        the same terrain as a triangle mesh up to M cells (default 1024)\n" );
+	printf( "  --samplers [NAME]     path trace a generated scene (default cornell) with random, halton and sobol\n" );
+	printf( "                        samples at 1 to 64 spp, RMSE against a 1024 spp reference\n" );
+	printf( "  --kernels [NAME]      generated scenes (default all) shaded by the generic kernel and by the ones\n" );
+	printf( "                        specialized per material, time and branch misses (Linux perf events)\n" );
+	printf( "  --tile-order [NAME]   generated scenes (default textured) traced in scanline rows and in Hilbert\n" );
+	printf( "                        ordered tiles with Morton pixels, time and LLC misses (Linux perf events)\n" );
+	printf( "  --texture-filter      the textured scene with point texture lookups and resampling against mip lookups\n" );
+	printf( "                        over the ray cones, rays and PSNR against a 4x4 supersampled render\n" );
+	printf( "  --csg [N]             generated bored tubes as CSG differences against triangle meshes of 16 up to N\n" );
+	printf( "                        segments (default 256), time per nearest hit on a tube and PSNR against CSG\n" );
+	printf( "  --image-output [N]    N frames (default 3) of the cubes scene at 3840x2160 unless --size, written as bmp\n" );
+	printf( "                        and QOI, synchronously and by the background writer, render thread time saved\n" );
+	printf( "  --animate FRAMES      move 1%% and 10%% of the primitives for FRAMES frames, BVH refit against rebuild\n" );
+	printf( "  checksums are only reproducible with --threads 1\n" );
+	printf( "golden images:\n" );
+	printf( "  --golden DIR          render the benchmark scenes (16 primitives, 160x90, 1 thread unless given)\n" );
+	printf( "                        and compare them with DIR/<scene>.bmp, exit code 3 on failures\n" );
+	printf( "  --update-golden       store the renders in the --golden directory instead\n" );
+	printf( "  --compare REF IMAGE   compare two bmps, --diff FILE writes the difference\n" );
+	printf( "  --pixel-tolerance N   channel difference in 0..255 still counted as equal (default 8)\n" );
+	printf( "  --pixel-fraction F    share of pixels allowed above the tolerance (default 0.01)\n" );
+	printf( "  --min-psnr DB         (default 30)\n" );
+	printf( "  --min-ssim S          (default 0.95)\n" );
+}
+
+int main( int argc , char** argv ) {
 	Raytracer* raytracer = new Raytracer;
-	raytracer->SetInput( "scene.txt" );
-	//raytracer->SetOutput( "picture.bmp" );
-	raytracer->SetOutput( "pictureT4.bmp" );
-	//raytracer->Run();
-	raytracer->MultiThreadRun();
-	//raytracer->DebugRun(740,760,410,430);
+	std::string input = "scene.txt";
+	std::string output = "pictureT4.bmp";
+	std::string engine = "whitted";
+	std::string stats , sequence;
+	std::string benchmark , baseline , save_baseline;
+	std::string golden , compare_reference , compare_image , diff;
+	std::string environment , samplers , kernels , tile_order;
+	bool update_golden = false , texture_filter = false;
+	Benchmark bench;
+	ImageCompare compare;
+	int threads = 0 , spp = 0;
+	double deadline = 0;
+	int count = 0 , bench_W = 0 , bench_H = 0 , animate = 0 , many_lights = 0 , image_output = 0 , csg = 0;
+	int workers = 0 , crash_after = -1;
+	int terrain = 0 , terrain_mesh = 1024;
+	bool worker = false;
+	std::string worker_cmd , seed , region;
+
+	for ( int k = 1 ; k < argc ; k++ ) {
+		std::string arg = argv[k];
+		bool has_value = k + 1 < argc;
+		if ( arg == "--scene" && has_value ) input = argv[++k]; else
+		if ( arg == "--output" && has_value ) output = argv[++k]; else
+		if ( arg == "--hdr" && has_value ) raytracer->SetHdrOutput( argv[++k] ); else
+		if ( arg == "--aov" && has_value ) raytracer->SetAovOutput( argv[++k] ); else
+		if ( arg == "--engine" && has_value ) engine = argv[++k]; else
+		if ( arg == "--threads" && has_value ) threads = atoi( argv[++k] ); else
+		if ( arg == "--spp" && has_value ) spp = atoi( argv[++k] ); else
+		if ( arg == "--deadline" && has_value ) deadline = atof( argv[++k] ); else
+		if ( arg == "--seed" && has_value ) {
+			seed = argv[++k];
+			raytracer->SetSeed( atoi( seed.c_str() ) );
+		} else
+		if ( arg == "--workers" && has_value ) workers = atoi( argv[++k] ); else
+		if ( arg == "--worker-cmd" && has_value ) worker_cmd = argv[++k]; else
+		if ( arg == "--worker" ) worker = true; else
+		if ( arg == "--worker-crash-after" && has_value ) crash_after = atoi( argv[++k] ); else
+		if ( arg == "--stats" && has_value ) stats = argv[++k]; else
+		if ( arg == "--sequence" && has_value ) sequence = argv[++k]; else
+		if ( arg == "--no-irradiance-cache" ) raytracer->SetIrradianceCache( false ); else
+		if ( arg == "--async-output" ) raytracer->SetAsyncOutput( true ); else
+		if ( arg == "--benchmark" && has_value ) benchmark = argv[++k]; else
+		if ( arg == "--count" && has_value ) count = atoi( argv[++k] ); else
+		if ( arg == "--animate" && has_value ) animate = atoi( argv[++k] ); else
+		if ( arg == "--many-lights" && has_value ) many_lights = atoi( argv[++k] ); else
+		if ( arg == "--environment" && has_value ) environment = argv[++k]; else
+		if ( arg == "--samplers" ) samplers = ( has_value && argv[k + 1][0] != '-' ) ? argv[++k] : "cornell"; else
+		if ( arg == "--texture-filter" ) texture_filter = true; else
+		if ( arg == "--csg" ) csg = ( has_value && argv[k + 1][0] != '-' ) ? atoi( argv[++k] ) : 256; else
+		if ( arg == "--image-output" ) image_output = ( has_value && argv[k + 1][0] != '-' ) ? atoi( argv[++k] ) : 3; else
+		if ( arg == "--tile-order" ) tile_order = ( has_value && argv[k + 1][0] != '-' ) ? argv[++k] : "textured"; else
+		if ( arg == "--kernels" ) kernels = ( has_value && argv[k + 1][0] != '-' ) ? argv[++k] : "all"; else
+		if ( arg == "--terrain" ) {
+			terrain = 4096;
+			if ( has_value && argv[k + 1][0] != '-' ) terrain = atoi( argv[++k] );
+			if ( k + 1 < argc && argv[k + 1][0] != '-' ) terrain_mesh = atoi( argv[++k] );
+		} else
+		if ( arg == "--baseline" && has_value ) baseline = argv[++k]; else
+		if ( arg == "--save-baseline" && has_value ) save_baseline = argv[++k]; else
+		if ( arg == "--tolerance" && has_value ) bench.SetTolerance( atof( argv[++k] ) ); else
+		if ( arg == "--size" && k + 2 < argc ) {
+			bench_W = atoi( argv[k + 1] );
+			bench_H = atoi( argv[k + 2] );
+			k += 2;
+		} else
+		if ( arg == "--golden" && has_value ) golden = argv[++k]; else
+		if ( arg == "--update-golden" ) update_golden = true; else
+		if ( arg == "--diff" && has_value ) diff = argv[++k]; else
+		if ( arg == "--pixel-tolerance" && has_value ) compare.SetPixelTolerance( atof( argv[++k] ) ); else
+		if ( arg == "--pixel-fraction" && has_value ) compare.SetPixelFraction( atof( argv[++k] ) ); else
+		if ( arg == "--min-psnr" && has_value ) compare.SetMinPsnr( atof( argv[++k] ) ); else
+		if ( arg == "--min-ssim" && has_value ) compare.SetMinSsim( atof( argv[++k] ) ); else
+		if ( arg == "--compare" && k + 2 < argc ) {
+			compare_reference = argv[k + 1];
+			compare_image = argv[k + 2];
+			k += 2;
+		} else
+		if ( arg == "--region" && k + 4 < argc ) {
+			int x0 = atoi( argv[k + 1] ) , x1 = atoi( argv[k + 2] ) , y0 = atoi( argv[k + 3] ) , y1 = atoi( argv[k + 4] );
+			raytracer->SetRegion( x0 , x1 , y0 , y1 );
+			region = std::string( argv[k + 1] ) + " " + argv[k + 2] + " " + argv[k + 3] + " " + argv[k + 4];
+			k += 4;
+		} else {
+			Usage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+	if ( engine != "whitted" && engine != "wavefront" && engine != "path" ) {
+		Usage();
+		return 1;
+	}
+
+	if ( compare_reference != "" ) {
+		delete raytracer;
+		Bmp* reference = new Bmp;
+		Bmp* image = new Bmp;
+		Bmp* difference = new Bmp;
+		reference->Input( compare_reference );
+		image->Input( compare_image );
+		ImageDiff result = compare.Compare( reference , image , difference );
+		if ( !result.same_size ) printf( "size %dx%d against %dx%d\n" , image->GetW() , image->GetH() , reference->GetW() , reference->GetH() );
+		else printf( "max %d, %.2f%% above tolerance, PSNR %.2f dB, SSIM %.4f :: %s\n" , result.max_diff , result.bad_fraction * 100 ,
+			std::min( result.psnr , 999.99 ) , result.ssim , result.passed ? "ok" : "FAILED" );
+		if ( diff != "" && result.same_size ) difference->Output( diff );
+		delete reference;
+		delete image;
+		delete difference;
+		return result.passed ? 0 : 3;
+	}
+
+	if ( golden != "" ) {
+		if ( benchmark == "" ) benchmark = "all";
+		if ( count == 0 ) count = 16;
+		if ( bench_W == 0 ) { bench_W = 160; bench_H = 90; }
+		if ( threads == 0 ) threads = 1;
+	}
+
+	//the measurement modes share one setup :: threads, --count and --size go to every one of them
+	bool measurement = many_lights > 0 || terrain > 0 || samplers != "" || tile_order != "" || kernels != "" ||
+	                   csg > 0 || image_output > 0 || texture_filter || environment != "";
+	if ( measurement || benchmark != "" ) {
+		delete raytracer;
+		if ( image_output > 0 && bench_W == 0 ) { bench_W = 3840; bench_H = 2160; }
+		bench.SetThreads( threads );
+		if ( count > 0 ) bench.SetCount( count );
+		if ( bench_W > 0 && bench_H > 0 ) bench.SetSize( bench_W , bench_H );
+	}
+
+	if ( measurement ) {
+		bool known = true;
+		if ( many_lights > 0 ) bench.ManyLights( many_lights ); else
+		if ( terrain > 0 ) bench.Terrain( terrain , terrain_mesh ); else
+		if ( samplers != "" ) known = bench.SamplerConvergence( samplers ); else
+		if ( tile_order != "" ) known = bench.TileOrders( tile_order ); else
+		if ( kernels != "" ) known = bench.ShadingKernels( kernels ); else
+		if ( csg > 0 ) bench.CsgTubes( csg ); else
+		if ( image_output > 0 ) bench.ImageOutput( image_output ); else
+		if ( texture_filter ) bench.TextureFilter(); else
+			bench.EnvironmentConvergence( environment );
+		if ( !known ) {
+			Usage();
+			return 1;
+		}
+		bench.Print();
+		return 0;
+	}
+
+	if ( benchmark != "" ) {
+		bench.SetEngine( engine );
+		bench.SetSpp( spp );
+		if ( animate > 0 ) {
+			if ( !bench.Animate( benchmark , animate ) ) {
+				Usage();
+				return 1;
+			}
+			bench.Print();
+			return 0;
+		}
+		if ( !bench.Run( benchmark ) ) {
+			Usage();
+			return 1;
+		}
+		bench.Print();
+		if ( golden != "" ) return ( bench.Golden( golden , update_golden , &compare ) == 0 ) ? 0 : 3;
+		if ( save_baseline != "" ) bench.Output( save_baseline );
+		if ( baseline == "" ) return 0;
+		int regressions = bench.Compare( baseline );
+		if ( regressions < 0 ) printf( "cannot read baseline %s\n" , baseline.c_str() );
+		return ( regressions == 0 ) ? 0 : 2;
+	}
+
+	raytracer->SetInput( input );
+	raytracer->SetOutput( output );
+	raytracer->SetThreads( threads );
+	raytracer->SetSpp( spp );
+
+	if ( worker ) {
+		raytracer->WorkerRun( crash_after );
+		delete raytracer;
+		return 0;
+	}
+
+	if ( workers > 0 ) {
+		//workers get the scene, seed, region and thread count, one thread each unless given
+		std::vector<std::string> command;
+		std::stringstream fin( worker_cmd );
+		std::string word;
+		while ( fin >> word ) command.push_back( word );
+		if ( command.empty() ) command.push_back( argv[0] );
+		command.push_back( "--worker" );
+		command.push_back( "--scene" );
+		command.push_back( input );
+		command.push_back( "--threads" );
+		command.push_back( std::to_string( ( threads > 0 ) ? threads : 1 ) );
+		if ( seed != "" ) {
+			command.push_back( "--seed" );
+			command.push_back( seed );
+		}
+		if ( region != "" ) {
+			std::stringstream fin2( region );
+			command.push_back( "--region" );
+			while ( fin2 >> word ) command.push_back( word );
+		}
+		engine = "distributed";
+		raytracer->SetThreads( 1 );
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		raytracer->DistributedRun( command , workers , crash_after );
+		double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+		printf( "%s -> %s :: distributed, %d workers, %.3fs total\n" , input.c_str() , output.c_str() , workers , seconds );
+		delete raytracer;
+		return 0;
+	}
+
+	if ( sequence != "" ) {
+		raytracer->SequenceRun( sequence , engine );
+		StatsPrint();
+		if ( stats != "" ) StatsOutputJson( stats );
+		delete raytracer;
+		return 0;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if ( deadline > 0 ) {
+		raytracer->DeadlineRun( deadline );
+		engine = "path";
+	} else {
+		if ( engine == "whitted" ) raytracer->MultiThreadRun();
+		if ( engine == "wavefront" ) raytracer->WavefrontRun();
+		if ( engine == "path" ) raytracer->PathTraceRun();
+	}
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	Camera* camera = raytracer->GetCamera();
+	printf( "%s -> %s :: %s engine, %dx%d, %d threads, %.3fs total (%.3f MRays/s)\n" , input.c_str() , output.c_str() , engine.c_str() ,
+		camera->GetW() , camera->GetH() , raytracer->GetThreadPool()->GetThreads() , seconds , raytracer->GetTracedRays() / seconds / 1e6 );
+	StatsPrint();
+	if ( stats != "" ) StatsOutputJson( stats );
+	delete raytracer;
 	return 0;
 }
@@ -0,0 +1,366 @@
+#include"raytracer.h"
+#include"tile.h"
+#include<cstdio>
+#include<cstdlib>
+#include<cmath>
+#include<chrono>
+#include<algorithm>
+#include<atomic>
+
+const int RUSSIAN_ROULETTE_DEP = 3;
+const int DEADLINE_FIRST_SPP = 2; //quick passes over the whole image, one sample each, enough for a first variance estimate
+const double DEADLINE_REFINE_SHARE = 0.25; //tiles refined per round, the ones with the largest error
+
+static double PowerHeuristic( double pdf_a , double pdf_b ) {
+	return pdf_a * pdf_a / ( pdf_a * pdf_a + pdf_b * pdf_b );
+}
+
+//the non-delta part of the material :: lambert plus the highlight term of CalnDiffusion, times cos
+static Color BrdfCos( Material* material , Color color , double dot ) {
+	return color * ( material->diff * dot + material->spec * pow( dot , SPEC_POWER ) ) / PI;
+}
+
+Light* Raytracer::FindLight( Primitive* light_primitive ) {
+	for ( Light* light = light_head ; light != NULL ; light = light->GetNext() )
+		if ( light->GetLightPrimitive() == light_primitive ) return light;
+	return NULL;
+}
+
+Color Raytracer::SampleLights( CollidePrimitive collide_primitive , Color color , double p_diff ) {
+	Material* material = collide_primitive.collide_primitive->GetMaterial();
+	Color ret;
+
+	for ( Light* light = light_head ; light != NULL ; light = light->GetNext() ) {
+		Vector3 NL;
+		int d = thread_sampler.Reserve( 2 );
+		double u = thread_sampler.Get( d ) , v = thread_sampler.Get( d + 1 );
+		Vector3 P = light->Sample( collide_primitive.C , u , v , NL );
+		Vector3 R = P - collide_primitive.C;
+		double dist2 = R.Module2();
+		R = R.GetUnitVector();
+		double dot = R.Dot( collide_primitive.N );
+		if ( dot <= EPS ) continue;
+
+		//point lights keep the distance-independent intensity of CalnDiffusion
+		if ( light->IsPointLight() ) {
+			if ( light->Visible( collide_primitive.C , P , &scene ) < EPS ) continue;
+			ret += BrdfCos( material , color , dot ) * light->GetColor() * PI;
+			continue;
+		}
+
+		double cos_l = -R.Dot( NL );
+		if ( cos_l <= EPS ) continue;
+		if ( light->Visible( collide_primitive.C , P , &scene ) < EPS ) continue;
+		double pdf_light = dist2 / ( cos_l * light->GetArea() );
+		double pdf_brdf = p_diff * dot / PI;
+		ret += BrdfCos( material , color , dot ) * light->GetColor() * ( PowerHeuristic( pdf_light , pdf_brdf ) / pdf_light );
+	}
+
+	return ret;
+}
+
+Color Raytracer::PathTracing( Vector3 ray_O , Vector3 ray_V , AovSample* aov_sample ) {
+	Color ret , beta( 1 , 1 , 1 );
+	double pdf_brdf = 0; //solid angle pdf of the last bounce, 0 after the camera or a delta lobe
+	ray_V = ray_V.GetUnitVector();
+
+	for ( int dep = 1 ; dep <= MAX_RAYTRACING_DEP ; dep++ ) {
+		thread_rays++;
+		if ( dep == 1 ) STAT_INC( STAT_PRIMARY_RAYS );
+		CollidePrimitive collide_primitive = scene.FindNearestPrimitiveGetCollide( ray_O , ray_V );
+		if ( !collide_primitive.isCollide ) {
+			if ( environment != NULL ) ret += beta * environment->Lookup( ray_V );
+			break;
+		}
+		Primitive* primitive = collide_primitive.collide_primitive;
+		Material* material = primitive->GetMaterial();
+		if ( dep == 1 && aov_sample != NULL ) aov_sample->Set( collide_primitive );
+
+		if ( primitive->IsLightPrimitive() ) {
+			double weight = 1;
+			Light* light = FindLight( primitive );
+			if ( pdf_brdf > 0 && light != NULL ) {
+				double cos_l = -ray_V.Dot( collide_primitive.N );
+				double pdf_light = collide_primitive.dist * collide_primitive.dist / ( std::max( cos_l , EPS ) * light->GetArea() );
+				weight = PowerHeuristic( pdf_brdf , pdf_light );
+			}
+			ret += beta * material->color * weight;
+			break;
+		}
+
+		Color color = material->color;
+		if ( material->texture != NULL ) color = color * collide_primitive.GetTexture();
+
+		//pick one lobe with probability proportional to its weight
+		double w_diff = ( material->diff > EPS || material->spec > EPS ) ? material->diff + material->spec : 0;
+		double w_refl = ( material->refl > EPS ) ? material->refl : 0;
+		double w_refr = ( material->refr > EPS ) ? material->refr : 0;
+		double total = w_diff + w_refl + w_refr;
+		if ( total < EPS ) break;
+		double p_diff = w_diff / total;
+
+		if ( w_diff > 0 ) ret += beta * SampleLights( collide_primitive , color , p_diff );
+
+		double r = thread_sampler.Next() * total;
+		int d = thread_sampler.Reserve( 2 );
+		if ( r < w_diff ) {
+			double u = thread_sampler.Get( d ) , v = thread_sampler.Get( d + 1 );
+			ray_V = collide_primitive.N.Diffuse( u , v );
+			STAT_INC( STAT_DIFFUSE_RAYS );
+			double dot = ray_V.Dot( collide_primitive.N );
+			if ( dot < EPS ) break;
+			pdf_brdf = p_diff * dot / PI;
+			beta = beta * BrdfCos( material , color , dot ) / pdf_brdf;
+		} else
+		if ( r < w_diff + w_refl ) {
+			ray_V = ray_V.Reflect( collide_primitive.N );
+			STAT_INC( STAT_REFLECTION_RAYS );
+			pdf_brdf = 0;
+			beta = beta * color * total;
+		} else {
+			double n = material->rindex;
+			if ( collide_primitive.front ) n = 1 / n;
+			ray_V = ray_V.Refract( collide_primitive.N , n ).GetUnitVector();
+			STAT_INC( STAT_REFRACTION_RAYS );
+			pdf_brdf = 0;
+			if ( !collide_primitive.front ) {
+				Color absor = material->absor * -collide_primitive.dist;
+				beta = beta * Color( exp( absor.r ) , exp( absor.g ) , exp( absor.b ) );
+			}
+			beta = beta * total;
+		}
+		ray_O = collide_primitive.C;
+
+		if ( dep >= RUSSIAN_ROULETTE_DEP ) {
+			double q = std::max( 0.05 , 1 - std::max( beta.r , std::max( beta.g , beta.b ) ) );
+			if ( thread_sampler.Next() < q ) break;
+			beta /= 1 - q;
+		}
+	}
+
+	return ret;
+}
+
+void Raytracer::PathTraceRun() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CreateAll();
+	traced_rays = 0;
+
+	int H = camera->GetH() , W = camera->GetW();
+	int passes = camera->GetSpp();
+	std::vector<Color> accum( H * W );
+	aov.Initialize( H , W );
+	TileScheduler scheduler( i0 , i1 , j0 , j1 );
+
+	std::chrono::steady_clock::time_point trace_start = std::chrono::steady_clock::now();
+	for ( int pass = 1 ; pass <= passes ; pass++ ) {
+		STAT_PHASE( PHASE_SAMPLE );
+		scheduler.Run( GetThreadPool() , [&]( Tile& tile ) {
+			thread_rays = 0;
+			tile.ForEachPixel( [&]( int i , int j ) {
+				//pass k is point k of the pixel's sequence
+				thread_sampler.Start( camera->GetSampler() , i * W + j , pass - 1 );
+				double di = thread_sampler.Get( 0 ) - 0.5 , dj = thread_sampler.Get( 1 ) - 0.5;
+				Vector3 ray_O , ray_V;
+				camera->EmitLens( i , j , di , dj , pass - 1 , ray_O , ray_V );
+				AovSample aov_sample;
+				accum[i * W + j] += PathTracing( ray_O , ray_V , &aov_sample );
+				aov.Add( i , j , aov_sample );
+			} );
+			traced_rays += thread_rays;
+		} );
+		STAT_PHASE_STOP();
+
+		//write the running estimate after passes 1, 2, 4, 8, ... so the image on disk converges progressively
+		if ( ( pass & ( pass - 1 ) ) == 0 || pass == passes ) {
+			std::vector<float> color[3];
+			for ( int c = 0 ; c < 3 ; c++ )
+				color[c].resize( H * W );
+			for ( int k = 0 ; k < H * W ; k++ ) {
+				color[0][k] = ( float ) ( accum[k].r / pass );
+				color[1][k] = ( float ) ( accum[k].g / pass );
+				color[2][k] = ( float ) ( accum[k].b / pass );
+			}
+			if ( denoiser != NULL ) {
+				STAT_PHASE( PHASE_DENOISE );
+				denoiser->Run( GetThreadPool() , aov , color );
+			}
+
+			for ( int i = i0 ; i < i1 ; i++ )
+				for ( int j = j0 ; j < j1 ; j++ ) {
+					int k = i * W + j;
+					camera->SetColor( i , j , Color( color[0][k] , color[1][k] , color[2][k] ) );
+				}
+			OutputImage();
+
+			double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - trace_start ).count();
+			printf( "Path tracing: %d/%d spp, %.0f samples/s\n" , pass , passes , ( double ) ( i1 - i0 ) * ( j1 - j0 ) * pass / seconds );
+		}
+	}
+
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	printf( "Path tracing: %lld rays in %.3fs (%.3f MRays/s)\n" , ( long long ) traced_rays , seconds , traced_rays / seconds / 1e6 );
+}
+
+//a quick pass of every tile, then rounds that add a sample to each pixel of the tiles whose mean has the largest error
+//workers look at the clock before every pixel, so a round stops within a pixel's time of the deadline
+//pixels the deadline left without a sample copy the nearest sampled pixel in their row, rows without one copy the nearest such row
+static int FillUnsampled( std::vector<float> color[3] , std::vector<int>& samples , int W , int i0 , int i1 , int j0 , int j1 ) {
+	int holes = 0;
+	std::vector<int> row_source( i1 - i0 , -1 );
+	std::vector<int> left( j1 - j0 ) , right( j1 - j0 );
+	for ( int i = i0 ; i < i1 ; i++ ) {
+		int last = -1;
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			if ( samples[i * W + j] > 0 ) last = j;
+			left[j - j0] = last;
+		}
+		last = -1;
+		for ( int j = j1 - 1 ; j >= j0 ; j-- ) {
+			if ( samples[i * W + j] > 0 ) last = j;
+			right[j - j0] = last;
+		}
+		if ( last < 0 ) continue;
+		row_source[i - i0] = i;
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			if ( samples[i * W + j] > 0 ) continue;
+			int l = left[j - j0] , r = right[j - j0];
+			int from = ( r < 0 || ( l >= 0 && j - l <= r - j ) ) ? l : r;
+			for ( int c = 0 ; c < 3 ; c++ )
+				color[c][i * W + j] = color[c][i * W + from];
+			holes++;
+		}
+	}
+
+	int last = -1;
+	std::vector<int> above( i1 - i0 );
+	for ( int i = i0 ; i < i1 ; i++ ) {
+		if ( row_source[i - i0] >= 0 ) last = i;
+		above[i - i0] = last;
+	}
+	if ( last < 0 ) return 0;
+	last = -1;
+	for ( int i = i1 - 1 ; i >= i0 ; i-- ) {
+		if ( row_source[i - i0] >= 0 ) { last = i; continue; }
+		int a = above[i - i0] , from = ( last < 0 || ( a >= 0 && i - a <= last - i ) ) ? a : last;
+		for ( int j = j0 ; j < j1 ; j++ )
+			for ( int c = 0 ; c < 3 ; c++ )
+				color[c][i * W + j] = color[c][from * W + j];
+		holes += j1 - j0;
+	}
+	return holes;
+}
+
+void Raytracer::DeadlineRun( double budget_ms ) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point deadline = start + std::chrono::microseconds( ( long long ) ( budget_ms * 1000 ) );
+	CreateAll();
+	traced_rays = 0;
+
+	int H = camera->GetH() , W = camera->GetW();
+	std::vector<Color> accum( H * W );
+	std::vector<double> lum( H * W ) , lum2( H * W );
+	std::vector<int> samples( H * W );
+	aov.Initialize( H , W );
+	TileScheduler scheduler( i0 , i1 , j0 , j1 );
+	std::atomic<bool> expired( false );
+	std::atomic<int> unfinished( 0 );
+
+	//spp more samples for every pixel of the tile, counted as unfinished when the deadline cuts it short
+	auto refine = [&]( Tile& tile , int spp ) {
+		thread_rays = 0;
+		bool cut = false;
+		tile.ForEachPixel( [&]( int i , int j ) {
+			if ( cut ) return;
+			if ( expired || std::chrono::steady_clock::now() >= deadline ) {
+				expired = cut = true;
+				return;
+			}
+			int k = i * W + j;
+			for ( int s = 0 ; s < spp ; s++ ) {
+				thread_sampler.Start( camera->GetSampler() , k , samples[k] );
+				double di = thread_sampler.Get( 0 ) - 0.5 , dj = thread_sampler.Get( 1 ) - 0.5;
+				Vector3 ray_O , ray_V;
+				camera->EmitLens( i , j , di , dj , samples[k] , ray_O , ray_V );
+				AovSample aov_sample;
+				Color color = PathTracing( ray_O , ray_V , &aov_sample );
+				aov.Add( i , j , aov_sample );
+				double l = ( color.r + color.g + color.b ) / 3;
+				accum[k] += color;
+				lum[k] += l;
+				lum2[k] += l * l;
+				samples[k]++;
+				STAT_INC( STAT_PIXEL_SAMPLES );
+			}
+		} );
+		if ( cut ) {
+			unfinished++;
+			STAT_INC( STAT_UNFINISHED_TILES );
+		}
+		traced_rays += thread_rays;
+	};
+
+	//every tile gets its first sample before any gets a second, so an early deadline leaves no tile untouched
+	STAT_PHASE( PHASE_SAMPLE );
+	for ( int pass = 0 ; pass < DEADLINE_FIRST_SPP && !expired ; pass++ )
+		scheduler.Run( GetThreadPool() , [&]( Tile& tile ) { refine( tile , 1 ); } );
+
+	STAT_PHASE_NEXT( PHASE_RESAMPLE );
+	int rounds = 0;
+	while ( !expired && std::chrono::steady_clock::now() < deadline ) {
+		//squared standard error of the luminance mean, summed over the tile
+		std::vector< std::pair<double , int> > error;
+		for ( int t = 0 ; t < scheduler.GetTileCount() ; t++ ) {
+			Tile& tile = scheduler.GetTile( t );
+			double e = 0;
+			for ( int i = tile.i0 ; i < tile.i1 ; i++ )
+				for ( int j = tile.j0 ; j < tile.j1 ; j++ ) {
+					int k = i * W + j , n = samples[k];
+					if ( n < 2 ) continue;
+					double mean = lum[k] / n;
+					e += std::max( lum2[k] / n - mean * mean , 0.0 ) / n;
+				}
+			error.push_back( std::make_pair( -e , t ) );
+		}
+		std::sort( error.begin() , error.end() );
+		if ( error.empty() || error[0].first >= 0 ) break;
+
+		int batch = std::max( ( int ) ( error.size() * DEADLINE_REFINE_SHARE ) , 1 );
+		GetThreadPool()->ParallelFor( batch , [&]( int k ) { refine( scheduler.GetTile( error[k].second ) , 1 ); } );
+		rounds++;
+	}
+	STAT_PHASE_STOP();
+
+	std::vector<float> color[3];
+	for ( int c = 0 ; c < 3 ; c++ )
+		color[c].resize( H * W );
+	long long total = 0;
+	int min_spp = -1 , max_spp = 0;
+	for ( int i = i0 ; i < i1 ; i++ )
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			int k = i * W + j , n = std::max( samples[k] , 1 );
+			color[0][k] = ( float ) ( accum[k].r / n );
+			color[1][k] = ( float ) ( accum[k].g / n );
+			color[2][k] = ( float ) ( accum[k].b / n );
+			total += samples[k];
+			if ( min_spp < 0 || samples[k] < min_spp ) min_spp = samples[k];
+			max_spp = std::max( max_spp , samples[k] );
+		}
+	int holes = FillUnsampled( color , samples , W , i0 , i1 , j0 , j1 );
+	if ( denoiser != NULL ) {
+		STAT_PHASE( PHASE_DENOISE );
+		denoiser->Run( GetThreadPool() , aov , color );
+	}
+	for ( int i = i0 ; i < i1 ; i++ )
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			int k = i * W + j;
+			camera->SetColor( i , j , Color( color[0][k] , color[1][k] , color[2][k] ) );
+		}
+	double rendered = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	OutputImage();
+
+	long long pixels = std::max( ( long long ) ( i1 - i0 ) * ( j1 - j0 ) , 1LL );
+	printf( "Deadline: %.0f ms budget, image ready after %.0f ms, %d refinement rounds, %.2f spp (min %d, max %d), %d unfinished tiles, %d pixels filled in\n" ,
+		budget_ms , rendered * 1000 , rounds , ( double ) total / pixels , std::max( min_spp , 0 ) , max_spp , ( int ) unfinished , holes );
+	printf( "Path tracing: %lld rays in %.3fs (%.3f MRays/s)\n" , ( long long ) traced_rays , rendered , traced_rays / rendered / 1e6 );
+}
@@ -6,6 +6,7 @@
 #include<iostream>
 #include<cstdlib>
 #include<algorithm>
+#include<deque>
 #define ran() ( double( rand() % 32768 ) / 32768 )
 
 const int BEZIER_MAX_DEGREE = 5;
@@ -20,6 +21,44 @@ const int Combination[BEZIER_MAX_DEGREE + 1][BEZIER_MAX_DEGREE + 1] =
 
 const int MAX_COLLIDE_TIMES = 10;
 const int MAX_COLLIDE_RANDS = 10;
+const int HEIGHTFIELD_STACK = 96; //3 per mip level and one, enough for 2^31 cells a side
+
+static Vector3 AbsVector( Vector3 v ) {
+	return Vector3( fabs( v.x ) , fabs( v.y ) , fabs( v.z ) );
+}
+
+//box around the segment O1-O2 grown by R on every axis
+static void SegmentBounds( Vector3 O1 , Vector3 O2 , double R , Vector3& lo , Vector3& hi ) {
+	lo = Vector3( std::min( O1.x , O2.x ) - R , std::min( O1.y , O2.y ) - R , std::min( O1.z , O2.z ) - R );
+	hi = Vector3( std::max( O1.x , O2.x ) + R , std::max( O1.y , O2.y ) + R , std::max( O1.z , O2.z ) + R );
+}
+
+//Moller-Trumbore, t along the unit ray_V
+static bool HitTriangle( const Vector3& P1 , const Vector3& P2 , const Vector3& P3 , Vector3 ray_O , Vector3 ray_V , double& t ) {
+	Vector3 E1 = P2 - P1 , E2 = P3 - P1;
+	Vector3 p = ray_V * E2;
+	double det = E1.Dot( p );
+	if ( fabs( det ) < 1e-12 ) return false;
+	double inv = 1 / det;
+	Vector3 s = ray_O - P1;
+	double u = s.Dot( p ) * inv;
+	if ( u < 0 || u > 1 ) return false;
+	Vector3 q = s * E1;
+	double v = ray_V.Dot( q ) * inv;
+	if ( v < 0 || u + v > 1 ) return false;
+	t = E2.Dot( q ) * inv;
+	return t > EPS;
+}
+
+static void SetTriangleHit( CollidePrimitive& ret , Primitive* primitive , const Vector3& P1 , const Vector3& P2 , const Vector3& P3 , Vector3 ray_O , Vector3 ray_V , double t ) {
+	Vector3 N = ( ( P2 - P1 ) * ( P3 - P1 ) ).GetUnitVector();
+	ret.dist = t;
+	ret.C = ray_O + ray_V * t;
+	ret.front = ( N.Dot( ray_V ) < 0 );
+	ret.N = ret.front ? N : -N;
+	ret.isCollide = true;
+	ret.collide_primitive = primitive;
+}
 
 
 std::pair<double, double> ExpBlur::GetXY()
@@ -39,6 +78,13 @@ Material::Material() {
 	drefl = 0;
 	texture = NULL;
 	blur = new ExpBlur();
+	features = 0;
+}
+
+void Material::Classify( bool emissive ) {
+	features = emissive ? MATERIAL_EMISSIVE : 0;
+	for ( int feature = 1 ; feature < MATERIAL_KERNELS ; feature <<= 1 )
+		if ( Test( feature ) ) features |= feature;
 }
 
 void Material::Input( std::string var , std::stringstream& fin ) {
@@ -54,6 +100,7 @@ void Material::Input( std::string var , std::stringstream& fin ) {
 		std::string file; fin >> file;
 		texture = new Bmp;
 		texture->Input( file );
+		texture->BuildMipmaps();
 	}
 	if ( var == "blur=" ) {
 		std::string blurname; fin >> blurname;
@@ -64,6 +111,7 @@ void Material::Input( std::string var , std::stringstream& fin ) {
 
 Primitive::Primitive() {
 	sample = rand();
+	index = 0;
 	material = new Material;
 	next = NULL;
 }
@@ -79,6 +127,7 @@ Primitive::~Primitive() {
 }
 
 void Primitive::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "name=" ) fin >> name;
 	material->Input( var , fin );
 }
 
@@ -95,7 +144,18 @@ void Sphere::Input( std::string var , std::stringstream& fin ) {
 	Primitive::Input( var , fin );
 }
 
+bool Sphere::GetBounds( Vector3& lo , Vector3& hi ) {
+	lo = O - Vector3( R , R , R );
+	hi = O + Vector3( R , R , R );
+	return true;
+}
+
+void Sphere::Translate( Vector3 D ) {
+	O += D;
+}
+
 CollidePrimitive Sphere::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_SPHERE );
 	ray_V = ray_V.GetUnitVector();
 	Vector3 P = ray_O - O;
 	double b = -P.Dot( ray_V );
@@ -125,13 +185,31 @@ CollidePrimitive Sphere::Collide( Vector3 ray_O , Vector3 ray_V ) {
 	return ret;
 }
 
-Color Sphere::GetTexture(Vector3 crash_C) {
+void Sphere::GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret ) {
+	Vector3 P = ray_O - O;
+	double b = -P.Dot( ray_V );
+	double det = b * b - P.Module2() + R * R;
+	if ( det <= 0 ) return;
+	det = sqrt( det );
+
+	CsgInterval I;
+	I.in.dist = b - det;
+	I.out.dist = b + det;
+	I.in.N = ( P + ray_V * I.in.dist ) / R;
+	I.out.N = ( P + ray_V * I.out.dist ) / R;
+	I.in.surface = I.out.surface = this;
+	ret.push_back( I );
+}
+
+Color Sphere::GetTexture(Vector3 crash_C , double footprint) {
 	Vector3 I = ( crash_C - O ).GetUnitVector();
 	double a = acos( -I.Dot( De ) );
 	double b = acos( std::min( std::max( I.Dot( Dc ) / sin( a ) , -1.0 ) , 1.0 ) );
 	double u = a / PI , v = b / 2 / PI;
 	if ( I.Dot( Dc * De ) < 0 ) v = 1 - v;
-	return material->texture->GetSmoothColor( u , v );
+	//a spans half a great circle, b a parallel of radius R sin a
+	double du = footprint / ( PI * R ) , dv = footprint / ( 2 * PI * R * std::max( sin( a ) , EPS ) );
+	return material->texture->GetSmoothColor( u , v , du , dv );
 }
 
 
@@ -143,7 +221,16 @@ void Plane::Input( std::string var , std::stringstream& fin ) {
 	Primitive::Input( var , fin );
 }
 
+bool Plane::GetBounds( Vector3& , Vector3& ) {
+	return false;
+}
+
+void Plane::Translate( Vector3 D ) {
+	R += D.Dot( N.GetUnitVector() );
+}
+
 CollidePrimitive Plane::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_PLANE );
 	ray_V = ray_V.GetUnitVector();
 	N = N.GetUnitVector();
 	double d = N.Dot( ray_V );
@@ -161,10 +248,10 @@ CollidePrimitive Plane::Collide( Vector3 ray_O , Vector3 ray_V ) {
 	return ret;
 }
 
-Color Plane::GetTexture(Vector3 crash_C) {
+Color Plane::GetTexture(Vector3 crash_C , double footprint) {
 	double u = crash_C.Dot( Dx ) / Dx.Module2();
 	double v = crash_C.Dot( Dy ) / Dy.Module2();
-	return material->texture->GetSmoothColor( u , v );
+	return material->texture->GetSmoothColor( u , v , footprint / Dx.Module() , footprint / Dy.Module() );
 }
 
 void Square::Input( std::string var , std::stringstream& fin ) {
@@ -174,7 +261,19 @@ void Square::Input( std::string var , std::stringstream& fin ) {
 	Primitive::Input( var , fin );
 }
 
+bool Square::GetBounds( Vector3& lo , Vector3& hi ) {
+	Vector3 E = AbsVector( Dx ) + AbsVector( Dy ) + Vector3( EPS , EPS , EPS );
+	lo = O - E;
+	hi = O + E;
+	return true;
+}
+
+void Square::Translate( Vector3 D ) {
+	O += D;
+}
+
 CollidePrimitive Square::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_SQUARE );
 	//NEED TO IMPLEMENT
 	CollidePrimitive ret;
 	ray_V = ray_V.GetUnitVector();
@@ -210,10 +309,10 @@ CollidePrimitive Square::Collide( Vector3 ray_O , Vector3 ray_V ) {
 	return ret;
 }
 
-Color Square::GetTexture(Vector3 crash_C) {
+Color Square::GetTexture(Vector3 crash_C , double footprint) {
 	double u = (crash_C - O).Dot( Dx ) / Dx.Module2() / 2 + 0.5;
 	double v = (crash_C - O).Dot( Dy ) / Dy.Module2() / 2 + 0.5;
-	return material->texture->GetSmoothColor( u , v );
+	return material->texture->GetSmoothColor( u , v , footprint / Dx.Module() / 2 , footprint / Dy.Module() / 2 );
 }
 
 
@@ -227,7 +326,20 @@ void Cube::Input(std::string var, std::stringstream& fin) {
 	Primitive::Input(var, fin);
 }
 
+bool Cube::GetBounds( Vector3& lo , Vector3& hi ) {
+	Vector3 X = Dx.GetUnitVector() , Y = Dy.GetUnitVector();
+	Vector3 E = AbsVector( X * x ) + AbsVector( Y * y ) + AbsVector( ( X * Y ).GetUnitVector() * z ) + Vector3( EPS , EPS , EPS );
+	lo = O - E;
+	hi = O + E;
+	return true;
+}
+
+void Cube::Translate( Vector3 D ) {
+	O += D;
+}
+
 CollidePrimitive Cube::Collide(Vector3 ray_O, Vector3 ray_V) {
+	STAT_INC( STAT_COLLIDE_CUBE );
 	//NEED TO IMPLEMENT
 	
 	ray_V = ray_V.GetUnitVector();
@@ -443,7 +555,37 @@ CollidePrimitive Cube::Collide(Vector3 ray_O, Vector3 ray_V) {
 	return ret;
 }
 
-Color Cube::GetTexture(Vector3 crash_C) {
+//slabs along the three edge directions, the entering and leaving faces kept for their normals
+void Cube::GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret ) {
+	Vector3 X = Dx.GetUnitVector() , Y = Dy.GetUnitVector();
+	Vector3 A[3] = { X , Y , ( X * Y ).GetUnitVector() };
+	double half[3] = { x , y , z };
+	Vector3 P = ray_O - O;
+
+	CsgInterval I;
+	I.in.dist = -BIG_DIST;
+	I.out.dist = BIG_DIST;
+	for ( int k = 0 ; k < 3 ; k++ ) {
+		double o = P.Dot( A[k] ) , d = ray_V.Dot( A[k] );
+		if ( fabs( d ) < 1e-12 ) {
+			if ( fabs( o ) > half[k] ) return;
+			continue;
+		}
+		double t0 = ( -half[k] - o ) / d , t1 = ( half[k] - o ) / d;
+		Vector3 N0 = -A[k] , N1 = A[k];
+		if ( t0 > t1 ) {
+			std::swap( t0 , t1 );
+			std::swap( N0 , N1 );
+		}
+		if ( t0 > I.in.dist ) { I.in.dist = t0; I.in.N = N0; }
+		if ( t1 < I.out.dist ) { I.out.dist = t1; I.out.N = N1; }
+	}
+	if ( I.in.dist >= I.out.dist ) return;
+	I.in.surface = I.out.surface = this;
+	ret.push_back( I );
+}
+
+Color Cube::GetTexture(Vector3 crash_C , double footprint) {
 	Dx = Dx.GetUnitVector() * x;
 	Dy = Dy.GetUnitVector() * y;
 	Vector3 X, Y;
@@ -517,7 +659,7 @@ Color Cube::GetTexture(Vector3 crash_C) {
 
 	double u = (crash_C - O).Dot(X) / X.Module2() / 2 + 0.5;
 	double v = (crash_C - O).Dot(Y) / Y.Module2() / 2 + 0.5;
-	return material->texture->GetSmoothColor(u, v);
+	return material->texture->GetSmoothColor(u, v, footprint / X.Module() / 2, footprint / Y.Module() / 2);
 }
 
 
@@ -530,9 +672,21 @@ void Cylinder::Input( std::string var , std::stringstream& fin ) {
 	Primitive::Input( var , fin );
 }
 
+bool Cylinder::GetBounds( Vector3& lo , Vector3& hi ) {
+	SegmentBounds( O1 , O2 , R , lo , hi );
+	return true;
+}
+
+void Cylinder::Translate( Vector3 D ) {
+	O1 += D;
+	O2 += D;
+}
+
 CollidePrimitive Cylinder::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_CYLINDER );
 	CollidePrimitive ret;
 	//NEED TO IMPLEMENT
+	ray_V = ray_V.GetUnitVector();
 	Vector3 N2 = (O2 - O1).GetUnitVector();
 	Vector3 N1 = (O1 - O2).GetUnitVector();
 	Vector3 OD = ray_V * N2;
@@ -604,8 +758,51 @@ CollidePrimitive Cylinder::Collide( Vector3 ray_O , Vector3 ray_V ) {
 	return ret;
 }
 
-Color Cylinder::GetTexture(Vector3 crash_C) {
+//the infinite cylinder clipped to the slab between the caps
+void Cylinder::GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret ) {
+	Vector3 A = O2 - O1;
+	double L = A.Module();
+	A = A / L;
+	Vector3 P = ray_O - O1;
+	double o = P.Dot( A ) , d = ray_V.Dot( A );
+	Vector3 w = P - A * o , u = ray_V - A * d; //across the axis
+
+	CsgInterval I;
+	double a = u.Module2() , b = w.Dot( u ) , c = w.Module2() - R * R;
+	if ( a < 1e-12 ) {
+		if ( c > 0 ) return;
+		I.in.dist = -BIG_DIST;
+		I.out.dist = BIG_DIST;
+	} else {
+		double det = b * b - a * c;
+		if ( det <= 0 ) return;
+		det = sqrt( det );
+		I.in.dist = ( -b - det ) / a;
+		I.out.dist = ( -b + det ) / a;
+		I.in.N = ( w + u * I.in.dist ) / R;
+		I.out.N = ( w + u * I.out.dist ) / R;
+	}
+
+	if ( fabs( d ) < 1e-12 ) {
+		if ( o < 0 || o > L ) return;
+	} else {
+		double t0 = -o / d , t1 = ( L - o ) / d;
+		Vector3 N0 = -A , N1 = A;
+		if ( t0 > t1 ) {
+			std::swap( t0 , t1 );
+			std::swap( N0 , N1 );
+		}
+		if ( t0 > I.in.dist ) { I.in.dist = t0; I.in.N = N0; }
+		if ( t1 < I.out.dist ) { I.out.dist = t1; I.out.N = N1; }
+	}
+	if ( I.in.dist >= I.out.dist ) return;
+	I.in.surface = I.out.surface = this;
+	ret.push_back( I );
+}
+
+Color Cylinder::GetTexture(Vector3 crash_C , double footprint) {
 	double u = 0.5 ,v = 0.5;
+	double du = footprint / R , dv = footprint / R;
 	//NEED TO IMPLEMENT
 	Vector3 N2 = (O2 - O1).GetUnitVector();
 
@@ -630,8 +827,10 @@ Color Cylinder::GetTexture(Vector3 crash_C) {
 		if (vertical.Dot((crash_C - O1) * N2) < 0)
 			v = 1 - v;
 		u = u / (O2 - O1).Module();
+		du = footprint / (O2 - O1).Module();
+		dv = footprint / ( 2 * PI * R );
 	}
-	return material->texture->GetSmoothColor( u , v );
+	return material->texture->GetSmoothColor( u , v , du , dv );
 }
 
 void Bezier::Input( std::string var , std::stringstream& fin ) {
@@ -657,15 +856,558 @@ void Bezier::Input( std::string var , std::stringstream& fin ) {
 	Primitive::Input( var , fin );
 }
 
+void Bezier::Evaluate( double t , double& z , double& r , double& dz , double& dr ) {
+	z = r = dz = dr = 0;
+	for ( int i = 0 ; i <= degree ; i++ ) {
+		double b = Combination[degree][i] * pow( t , i ) * pow( 1 - t , degree - i );
+		z += b * Z[i];
+		r += b * R[i];
+		if ( i == degree ) continue;
+		double d = degree * Combination[degree - 1][i] * pow( t , i ) * pow( 1 - t , degree - 1 - i );
+		dz += d * ( Z[i + 1] - Z[i] );
+		dr += d * ( R[i + 1] - R[i] );
+	}
+}
+
+bool Bezier::GetBounds( Vector3& lo , Vector3& hi ) {
+	double maxR = 0;
+	for ( int i = 0 ; i < ( int ) R.size() ; i++ )
+		maxR = std::max( maxR , R[i] );
+	SegmentBounds( O1 , O2 , maxR , lo , hi );
+	return true;
+}
+
+void Bezier::Translate( Vector3 D ) {
+	O1 += D;
+	O2 += D;
+	if ( boundingCylinder != NULL ) boundingCylinder->Translate( D );
+}
+
 CollidePrimitive Bezier::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_BEZIER );
 	CollidePrimitive ret;
-	//NEED TO IMPLEMENT
+	if ( degree < 1 || degree > BEZIER_MAX_DEGREE ) return ret;
+
+	ray_V = ray_V.GetUnitVector();
+	Vector3 A = ( O2 - O1 ).GetUnitVector();
+	double L = ( O2 - O1 ).Module();
+	double maxR = 0;
+	for ( int i = 0 ; i <= degree ; i++ )
+		maxR = std::max( maxR , R[i] );
+
+	//clip the ray to the bounding cylinder :: P + s * V split into the axis part and the radial part
+	Vector3 P = ray_O - O1;
+	double pa = P.Dot( A ) , va = ray_V.Dot( A );
+	Vector3 Pr = P - A * pa , Vr = ray_V - A * va;
+	double a = Vr.Module2() , b = Pr.Dot( Vr ) , c = Pr.Module2() - maxR * maxR;
+	double s0 = EPS , s1 = BIG_DIST;
+	if ( a < EPS ) {
+		if ( c > 0 ) return ret;
+	} else {
+		double det = b * b - a * c;
+		if ( det < 0 ) return ret;
+		det = sqrt( det );
+		s0 = std::max( s0 , ( -b - det ) / a );
+		s1 = std::min( s1 , ( -b + det ) / a );
+	}
+	if ( fabs( va ) < EPS ) {
+		if ( pa < 0 || pa > L ) return ret;
+	} else {
+		double t0 = -pa / va , t1 = ( L - pa ) / va;
+		if ( t0 > t1 ) std::swap( t0 , t1 );
+		s0 = std::max( s0 , t0 );
+		s1 = std::min( s1 , t1 );
+	}
+	if ( s0 > s1 ) return ret;
+
+	//newton on ( s , t ) :: Z(t) * L is the height of the ray point and R(t)^2 its squared distance to the axis
+	double best_s = BIG_DIST , best_t = 0;
+	for ( int k = 0 ; k < MAX_COLLIDE_RANDS ; k++ ) {
+		double s = s0 + ( s1 - s0 ) * ( k + 0.5 ) / MAX_COLLIDE_RANDS;
+		double t = std::min( std::max( ( pa + s * va ) / L , 0.0 ) , 1.0 );
+		for ( int iter = 0 ; iter < MAX_COLLIDE_TIMES ; iter++ ) {
+			double z , r , dz , dr;
+			Evaluate( t , z , r , dz , dr );
+			Vector3 Q = Pr + Vr * s;
+			double f1 = z * L - ( pa + s * va );
+			double f2 = r * r - Q.Module2();
+			double j11 = dz * L , j12 = -va;
+			double j21 = 2 * r * dr , j22 = -2 * Q.Dot( Vr );
+			double det = j11 * j22 - j12 * j21;
+			if ( fabs( det ) < 1e-12 ) break;
+			t -= ( f1 * j22 - f2 * j12 ) / det;
+			s -= ( j11 * f2 - j21 * f1 ) / det;
+			if ( t < -0.1 || t > 1.1 ) break;
+		}
+		if ( t < 0 || t > 1 || s < EPS || s > best_s ) continue;
+		double z , r , dz , dr;
+		Evaluate( t , z , r , dz , dr );
+		if ( fabs( z * L - ( pa + s * va ) ) > 1e-6 || fabs( r - ( Pr + Vr * s ).Module() ) > 1e-6 ) continue;
+		best_s = s;
+		best_t = t;
+	}
+	if ( best_s == BIG_DIST ) return ret;
+
+	double z , r , dz , dr;
+	Evaluate( best_t , z , r , dz , dr );
+	Vector3 U = ( Pr + Vr * best_s ).GetUnitVector();
+	Vector3 N = U * ( dz * L ) - A * dr;
+	if ( dz < 0 ) N = -N;
+	N = N.GetUnitVector();
+
+	ret.dist = best_s;
+	ret.C = ray_O + ray_V * best_s;
+	ret.front = ( N.Dot( ray_V ) < 0 );
+	ret.N = ret.front ? N : -N;
+	ret.isCollide = true;
+	ret.collide_primitive = this;
 	return ret;
 }
 
-Color Bezier::GetTexture(Vector3 crash_C) {
-	double u = 0.5 ,v = 0.5;
-	//NEED TO IMPLEMENT
-	return material->texture->GetSmoothColor( u , v );
+Color Bezier::GetTexture(Vector3 crash_C , double footprint) {
+	Vector3 A = ( O2 - O1 ).GetUnitVector();
+	Vector3 P = crash_C - O1;
+	double u = P.Dot( A ) / ( O2 - O1 ).Module();
+	Vector3 Pr = P - A * P.Dot( A );
+	double v = atan2( Pr.Dot( Ny ) , Pr.Dot( Nx ) ) / PI / 2 + 0.5;
+	double du = footprint / ( O2 - O1 ).Module() , dv = footprint / ( 2 * PI * std::max( Pr.Module() , EPS ) );
+	return material->texture->GetSmoothColor( u , v , du , dv );
+}
+
+Triangle::Triangle() : Primitive() {
+	U[0] = 0; V[0] = 0;
+	U[1] = 1; V[1] = 0;
+	U[2] = 0; V[2] = 1;
+}
+
+void Triangle::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "P1=" ) P1.Input( fin );
+	if ( var == "P2=" ) P2.Input( fin );
+	if ( var == "P3=" ) P3.Input( fin );
+	Primitive::Input( var , fin );
+}
+
+bool Triangle::GetBounds( Vector3& lo , Vector3& hi ) {
+	lo = Vector3( std::min( P1.x , std::min( P2.x , P3.x ) ) , std::min( P1.y , std::min( P2.y , P3.y ) ) , std::min( P1.z , std::min( P2.z , P3.z ) ) ) - Vector3( EPS , EPS , EPS );
+	hi = Vector3( std::max( P1.x , std::max( P2.x , P3.x ) ) , std::max( P1.y , std::max( P2.y , P3.y ) ) , std::max( P1.z , std::max( P2.z , P3.z ) ) ) + Vector3( EPS , EPS , EPS );
+	return true;
+}
+
+void Triangle::Translate( Vector3 D ) {
+	P1 += D;
+	P2 += D;
+	P3 += D;
+}
+
+CollidePrimitive Triangle::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_TRIANGLE );
+	CollidePrimitive ret;
+	ray_V = ray_V.GetUnitVector();
+	double t;
+	if ( HitTriangle( P1 , P2 , P3 , ray_O , ray_V , t ) ) SetTriangleHit( ret , this , P1 , P2 , P3 , ray_O , ray_V , t );
+	return ret;
+}
+
+Color Triangle::GetTexture(Vector3 crash_C , double footprint) {
+	//barycentric weights of P2 and P3 from the normal equations
+	Vector3 E1 = P2 - P1 , E2 = P3 - P1 , P = crash_C - P1;
+	double a = E1.Dot( E1 ) , b = E1.Dot( E2 ) , c = E2.Dot( E2 ) , d = P.Dot( E1 ) , e = P.Dot( E2 );
+	double det = a * c - b * b;
+	double w2 = ( fabs( det ) > 1e-12 ) ? ( c * d - b * e ) / det : 0;
+	double w3 = ( fabs( det ) > 1e-12 ) ? ( a * e - b * d ) / det : 0;
+	double u = U[0] * ( 1 - w2 - w3 ) + U[1] * w2 + U[2] * w3;
+	double v = V[0] * ( 1 - w2 - w3 ) + V[1] * w2 + V[2] * w3;
+	//texture coordinates per unit length, from the ratio of the uv area to the area of the triangle
+	double uv_area = fabs( ( U[1] - U[0] ) * ( V[2] - V[0] ) - ( U[2] - U[0] ) * ( V[1] - V[0] ) );
+	double scale = ( det > 1e-12 ) ? sqrt( uv_area / sqrt( det ) ) : 0;
+	return material->texture->GetSmoothColor( v , u , footprint * scale , footprint * scale );
+}
+
+void Heightfield::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "O=" ) O.Input( fin );
+	if ( var == "size=" ) fin >> size_x >> size_y;
+	if ( var == "height=" ) fin >> height;
+	if ( var == "file=" ) {
+		std::string file; fin >> file;
+		Load( file );
+	}
+	if ( var == "fractal=" ) {
+		int n , seed; fin >> n >> seed;
+		Fractal( n , seed );
+	}
+	if ( var == "tessellate=" ) fin >> tessellate;
+	Primitive::Input( var , fin );
+}
+
+//grey levels of a bmp, the first row at O.y
+void Heightfield::Load( std::string file ) {
+	Bmp bmp;
+	bmp.Input( file );
+	W = bmp.GetW();
+	H = bmp.GetH();
+	Z.assign( W * H , 0 );
+	for ( int j = 0 ; j < H ; j++ )
+		for ( int i = 0 ; i < W ; i++ ) {
+			Color c = bmp.GetColor( j , i );
+			Z[j * W + i] = ( float ) ( ( c.r + c.g + c.b ) / 3 );
+		}
+	BuildMips();
+}
+
+static double LatticeValue( int x , int y , int seed ) {
+	unsigned int h = ( unsigned int ) x * 374761393u + ( unsigned int ) y * 668265263u + ( unsigned int ) seed * 2246822519u;
+	h = ( h ^ ( h >> 13 ) ) * 1274126177u;
+	return ( ( h ^ ( h >> 16 ) ) & 0xffffff ) / double( 0xffffff );
+}
+
+static double ValueNoise( double x , double y , int seed ) {
+	int ix = ( int ) floor( x ) , iy = ( int ) floor( y );
+	double fx = x - ix , fy = y - iy;
+	fx = fx * fx * ( 3 - 2 * fx );
+	fy = fy * fy * ( 3 - 2 * fy );
+	double a = LatticeValue( ix , iy , seed ) * ( 1 - fx ) + LatticeValue( ix + 1 , iy , seed ) * fx;
+	double b = LatticeValue( ix , iy + 1 , seed ) * ( 1 - fx ) + LatticeValue( ix + 1 , iy + 1 , seed ) * fx;
+	return a * ( 1 - fy ) + b * fy;
+}
+
+//n x n cells of value noise, octaves down to the sample spacing, heights in 0..1
+void Heightfield::Fractal( int n , int seed ) {
+	W = H = n + 1;
+	Z.assign( W * H , 0 );
+	for ( int j = 0 ; j < H ; j++ )
+		for ( int i = 0 ; i < W ; i++ ) {
+			double sum = 0 , amplitude = 1 , total = 0;
+			for ( double frequency = 4 ; frequency <= n ; frequency *= 2 ) {
+				sum += ValueNoise( i * frequency / n , j * frequency / n , seed ) * amplitude;
+				total += amplitude;
+				amplitude /= 2;
+			}
+			Z[j * W + i] = ( float ) ( ( total > 0 ) ? sum / total : 0 );
+		}
+	BuildMips();
+}
+
+//level 1 holds 2 x 2 cells and reads the samples, every level above it 2 x 2 nodes of the one below
+void Heightfield::BuildMips() {
+	Z_min.clear();
+	Z_max.clear();
+	level_offset.assign( 1 , 0 );
+	level_W.assign( 1 , std::max( W - 1 , 0 ) );
+	level_H.assign( 1 , std::max( H - 1 , 0 ) );
+	if ( W < 2 || H < 2 ) return;
+	for ( int level = 1 ; level_W[level - 1] > 1 || level_H[level - 1] > 1 ; level++ ) {
+		int w = ( level_W[level - 1] + 1 ) / 2 , h = ( level_H[level - 1] + 1 ) / 2;
+		int offset = ( int ) Z_min.size();
+		level_offset.push_back( offset );
+		level_W.push_back( w );
+		level_H.push_back( h );
+		Z_min.resize( offset + w * h );
+		Z_max.resize( offset + w * h );
+		for ( int j = 0 ; j < h ; j++ )
+			for ( int i = 0 ; i < w ; i++ ) {
+				float lo = 1e30f , hi = -1e30f;
+				if ( level == 1 ) {
+					for ( int y = 2 * j ; y <= std::min( 2 * j + 2 , H - 1 ) ; y++ )
+						for ( int x = 2 * i ; x <= std::min( 2 * i + 2 , W - 1 ) ; x++ ) {
+							lo = std::min( lo , Z[y * W + x] );
+							hi = std::max( hi , Z[y * W + x] );
+						}
+				} else {
+					int below = level_offset[level - 1] , below_W = level_W[level - 1];
+					for ( int y = 2 * j ; y < std::min( 2 * j + 2 , level_H[level - 1] ) ; y++ )
+						for ( int x = 2 * i ; x < std::min( 2 * i + 2 , below_W ) ; x++ ) {
+							lo = std::min( lo , Z_min[below + y * below_W + x] );
+							hi = std::max( hi , Z_max[below + y * below_W + x] );
+						}
+				}
+				Z_min[offset + j * w + i] = lo;
+				Z_max[offset + j * w + i] = hi;
+			}
+	}
 }
 
+void Heightfield::NodeRange( int level , int i , int j , double& lo , double& hi ) {
+	if ( level == 0 ) {
+		float a = Z[j * W + i] , b = Z[j * W + i + 1] , c = Z[( j + 1 ) * W + i] , d = Z[( j + 1 ) * W + i + 1];
+		lo = std::min( std::min( a , b ) , std::min( c , d ) );
+		hi = std::max( std::max( a , b ) , std::max( c , d ) );
+	} else {
+		int k = level_offset[level] + j * level_W[level] + i;
+		lo = Z_min[k];
+		hi = Z_max[k];
+	}
+	lo = O.z + lo * height;
+	hi = O.z + hi * height;
+	if ( lo > hi ) std::swap( lo , hi );
+}
+
+long long Heightfield::GetMemory() {
+	return ( long long ) ( Z.size() + Z_min.size() + Z_max.size() ) * sizeof( float );
+}
+
+bool Heightfield::GetBounds( Vector3& lo , Vector3& hi ) {
+	double z_lo = O.z , z_hi = O.z;
+	if ( W >= 2 && H >= 2 ) NodeRange( ( int ) level_W.size() - 1 , 0 , 0 , z_lo , z_hi );
+	lo = Vector3( O.x , O.y , z_lo ) - Vector3( EPS , EPS , EPS );
+	hi = Vector3( O.x + size_x , O.y + size_y , z_hi ) + Vector3( EPS , EPS , EPS );
+	return true;
+}
+
+void Heightfield::Translate( Vector3 D ) {
+	O += D;
+}
+
+//hierarchical 2D-DDA down the min/max mip :: a node's span of the ray is cut at its two mid lines into the spans of
+//the children it crosses, nearest last on the stack, and a child is entered only where the ray's height range meets its own
+CollidePrimitive Heightfield::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_HEIGHTFIELD );
+	CollidePrimitive ret;
+	if ( W < 2 || H < 2 ) return ret;
+	ray_V = ray_V.GetUnitVector();
+	double cell_x = size_x / ( W - 1 ) , cell_y = size_y / ( H - 1 );
+	double inv_x = ( fabs( ray_V.x ) > 1e-12 ) ? 1 / ray_V.x : ( ray_V.x < 0 ? -1e12 : 1e12 );
+	double inv_y = ( fabs( ray_V.y ) > 1e-12 ) ? 1 / ray_V.y : ( ray_V.y < 0 ? -1e12 : 1e12 );
+
+	//the span over the whole terrain rectangle
+	double ta = 0 , tb = BIG_DIST;
+	double a = ( O.x - ray_O.x ) * inv_x , b = ( O.x + size_x - ray_O.x ) * inv_x;
+	ta = std::max( ta , std::min( a , b ) ); tb = std::min( tb , std::max( a , b ) );
+	a = ( O.y - ray_O.y ) * inv_y; b = ( O.y + size_y - ray_O.y ) * inv_y;
+	ta = std::max( ta , std::min( a , b ) ); tb = std::min( tb , std::max( a , b ) );
+	if ( ta > tb ) return ret;
+
+	int near_x = ( ray_V.x < 0 ) ? 1 : 0 , near_y = ( ray_V.y < 0 ) ? 1 : 0;
+	struct Span { int level , i , j; double ta , tb; } stack[HEIGHTFIELD_STACK];
+	int top = 0;
+	stack[top].level = ( int ) level_W.size() - 1; stack[top].i = stack[top].j = 0;
+	stack[top].ta = ta; stack[top].tb = tb; top++;
+	while ( top > 0 ) {
+		Span span = stack[--top];
+		int level = span.level , i = span.i , j = span.j;
+		double lo , hi;
+		NodeRange( level , i , j , lo , hi );
+		double za = ray_O.z + ray_V.z * span.ta , zb = ray_O.z + ray_V.z * span.tb;
+		if ( std::max( za , zb ) < lo - EPS || std::min( za , zb ) > hi + EPS ) continue;
+
+		if ( level == 0 ) {
+			Vector3 P00 = GetPoint( i , j ) , P10 = GetPoint( i + 1 , j ) , P01 = GetPoint( i , j + 1 ) , P11 = GetPoint( i + 1 , j + 1 );
+			double t , best = BIG_DIST;
+			bool first = false;
+			if ( HitTriangle( P00 , P10 , P11 , ray_O , ray_V , t ) ) { best = t; first = true; }
+			if ( HitTriangle( P00 , P11 , P01 , ray_O , ray_V , t ) && t < best ) { best = t; first = false; }
+			if ( best == BIG_DIST ) continue;
+			if ( first ) SetTriangleHit( ret , this , P00 , P10 , P11 , ray_O , ray_V , best );
+				else SetTriangleHit( ret , this , P00 , P11 , P01 , ray_O , ray_V , best );
+			return ret;
+		}
+
+		//where the ray crosses the mid lines, the child it starts in, then one step per crossing
+		int half = 1 << ( level - 1 );
+		double tx = ( O.x + cell_x * ( 2 * i + 1 ) * half - ray_O.x ) * inv_x;
+		double ty = ( O.y + cell_y * ( 2 * j + 1 ) * half - ray_O.y ) * inv_y;
+		int qx = ( tx <= span.ta ) ? 1 - near_x : near_x , qy = ( ty <= span.ta ) ? 1 - near_y : near_y;
+		double cut[3];
+		int child[3][2] , n = 0;
+		double t_prev = span.ta;
+		for ( int step = 0 ; step < 3 ; step++ ) {
+			double t_next = span.tb;
+			//>= :: a ray through the centre crosses both lines at once, the second step is empty
+			bool cross_x = tx >= t_prev && tx < span.tb && qx == near_x;
+			bool cross_y = ty >= t_prev && ty < span.tb && qy == near_y;
+			if ( cross_x ) t_next = tx;
+			if ( cross_y && ty < t_next ) { t_next = ty; cross_x = false; } else cross_y = false;
+			child[n][0] = 2 * i + qx; child[n][1] = 2 * j + qy; cut[n] = t_next; n++;
+			if ( !cross_x && !cross_y ) break;
+			if ( cross_x ) qx = 1 - qx; else qy = 1 - qy;
+			t_prev = t_next;
+		}
+		for ( int k = n - 1 ; k >= 0 ; k-- ) {
+			if ( child[k][0] >= level_W[level - 1] || child[k][1] >= level_H[level - 1] ) continue;
+			Span& next = stack[top++];
+			next.level = level - 1; next.i = child[k][0]; next.j = child[k][1];
+			next.ta = ( k == 0 ) ? span.ta : cut[k - 1];
+			next.tb = cut[k];
+		}
+	}
+	return ret;
+}
+
+Color Heightfield::GetTexture(Vector3 crash_C , double footprint) {
+	double u = ( crash_C.x - O.x ) / size_x;
+	double v = ( crash_C.y - O.y ) / size_y;
+	return material->texture->GetSmoothColor( v , u , footprint / size_y , footprint / size_x );
+}
+
+Primitive* Heightfield::Tessellate( Primitive* next ) {
+	Primitive* head = next;
+	for ( int j = 0 ; j + 1 < H ; j++ )
+		for ( int i = 0 ; i + 1 < W ; i++ ) {
+			int corner[2][3][2] = { { { 0 , 0 } , { 1 , 0 } , { 1 , 1 } } , { { 0 , 0 } , { 1 , 1 } , { 0 , 1 } } };
+			for ( int half = 0 ; half < 2 ; half++ ) {
+				Triangle* triangle = new Triangle( GetPoint( i + corner[half][0][0] , j + corner[half][0][1] ) ,
+				                                   GetPoint( i + corner[half][1][0] , j + corner[half][1][1] ) ,
+				                                   GetPoint( i + corner[half][2][0] , j + corner[half][2][1] ) );
+				for ( int k = 0 ; k < 3 ; k++ )
+					triangle->SetTextureCoords( k , ( double ) ( i + corner[half][k][0] ) / ( W - 1 ) , ( double ) ( j + corner[half][k][1] ) / ( H - 1 ) );
+				*triangle->GetMaterial() = *material;
+				triangle->SetSample( sample ); //one surface for the resampling hash
+				triangle->SetNext( head );
+				head = triangle;
+			}
+		}
+	return head;
+}
+
+//per thread and nesting depth, the operand intervals of a node being combined
+static thread_local std::deque< std::vector<CsgInterval> > csg_scratch;
+static thread_local int csg_depth = 0;
+
+Csg::~Csg() {
+	delete operand[0];
+	delete operand[1];
+}
+
+void Csg::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "operation=" ) {
+		std::string name; fin >> name;
+		if ( name == "union" ) operation = CSG_UNION; else
+		if ( name == "intersection" ) operation = CSG_INTERSECTION; else
+		if ( name == "difference" ) operation = CSG_DIFFERENCE; else
+			fprintf( stderr , "csg :: unknown operation %s\n" , name.c_str() );
+	}
+	if ( var == "a=" ) fin >> operand_name[0];
+	if ( var == "b=" ) fin >> operand_name[1];
+	Primitive::Input( var , fin );
+}
+
+bool Csg::Contains( Primitive* primitive ) {
+	for ( int k = 0 ; k < 2 ; k++ ) {
+		if ( operand[k] == NULL ) continue;
+		if ( operand[k] == primitive ) return true;
+		Csg* csg = dynamic_cast<Csg*>( operand[k] );
+		if ( csg != NULL && csg->Contains( primitive ) ) return true;
+	}
+	return false;
+}
+
+void Csg::ShareTexture( Bmp* texture ) {
+	for ( int k = 0 ; k < 2 ; k++ ) {
+		if ( operand[k] == NULL ) continue;
+		Material* operand_material = operand[k]->GetMaterial();
+		if ( operand_material->texture != NULL && operand_material->texture != texture ) delete operand_material->texture;
+		operand_material->texture = texture;
+		Csg* csg = dynamic_cast<Csg*>( operand[k] );
+		if ( csg != NULL ) csg->ShareTexture( texture );
+	}
+}
+
+bool Csg::GetBounds( Vector3& lo , Vector3& hi ) {
+	Vector3 l[2] , h[2];
+	bool has[2];
+	for ( int k = 0 ; k < 2 ; k++ )
+		has[k] = operand[k] != NULL && operand[k]->GetBounds( l[k] , h[k] );
+
+	//a difference stays inside its first operand, an intersection inside both
+	if ( operation == CSG_UNION ) {
+		if ( !has[0] && !has[1] ) return false;
+		if ( !has[0] || !has[1] ) {
+			lo = has[0] ? l[0] : l[1];
+			hi = has[0] ? h[0] : h[1];
+			return true;
+		}
+		lo = Vector3( std::min( l[0].x , l[1].x ) , std::min( l[0].y , l[1].y ) , std::min( l[0].z , l[1].z ) );
+		hi = Vector3( std::max( h[0].x , h[1].x ) , std::max( h[0].y , h[1].y ) , std::max( h[0].z , h[1].z ) );
+		return true;
+	}
+	if ( !has[0] ) return false;
+	lo = l[0];
+	hi = h[0];
+	if ( operation == CSG_INTERSECTION && has[1] ) {
+		lo = Vector3( std::max( l[0].x , l[1].x ) , std::max( l[0].y , l[1].y ) , std::max( l[0].z , l[1].z ) );
+		hi = Vector3( std::min( h[0].x , h[1].x ) , std::min( h[0].y , h[1].y ) , std::min( h[0].z , h[1].z ) );
+		hi = Vector3( std::max( hi.x , lo.x ) , std::max( hi.y , lo.y ) , std::max( hi.z , lo.z ) );
+	}
+	return true;
+}
+
+void Csg::Translate( Vector3 D ) {
+	for ( int k = 0 ; k < 2 ; k++ )
+		if ( operand[k] != NULL ) operand[k]->Translate( D );
+}
+
+static CsgHit& Boundary( std::vector<CsgInterval>& list , int k ) {
+	return ( k % 2 == 0 ) ? list[k / 2].in : list[k / 2].out;
+}
+
+//one sweep over the boundaries of both operands in ray order, opening and closing stretches as the operation's truth changes
+void Csg::Combine( std::vector<CsgInterval>& a , std::vector<CsgInterval>& b , std::vector<CsgInterval>& ret ) {
+	int ia = 0 , ib = 0 , na = 2 * ( int ) a.size() , nb = 2 * ( int ) b.size();
+	bool in_a = false , in_b = false , inside = false;
+	CsgInterval I;
+	while ( ia < na || ib < nb ) {
+		//past the last stretch of a only a union has anything left
+		if ( ia >= na && operation != CSG_UNION ) break;
+		bool from_a = ( ib >= nb ) || ( ia < na && Boundary( a , ia ).dist <= Boundary( b , ib ).dist );
+		CsgHit hit = from_a ? Boundary( a , ia++ ) : Boundary( b , ib++ );
+		if ( from_a ) in_a = !in_a; else in_b = !in_b;
+
+		bool now = ( operation == CSG_UNION ) ? ( in_a || in_b ) : ( operation == CSG_INTERSECTION ) ? ( in_a && in_b ) : ( in_a && !in_b );
+		if ( now == inside ) continue;
+		inside = now;
+		//the cutter's surface faces into the hollow it leaves
+		if ( !from_a && operation == CSG_DIFFERENCE ) hit.N = -hit.N;
+		if ( inside ) {
+			I.in = hit;
+			continue;
+		}
+		I.out = hit;
+		//coincident surfaces leave slivers of no thickness
+		if ( I.out.dist - I.in.dist > EPS ) ret.push_back( I );
+	}
+}
+
+void Csg::GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret ) {
+	//growing a deque keeps the references the outer nodes hold
+	if ( ( int ) csg_scratch.size() < 2 * csg_depth + 2 ) csg_scratch.resize( 2 * csg_depth + 2 );
+	std::vector<CsgInterval>& a = csg_scratch[2 * csg_depth];
+	std::vector<CsgInterval>& b = csg_scratch[2 * csg_depth + 1];
+	a.clear();
+	b.clear();
+
+	csg_depth++;
+	if ( operand[0] != NULL ) operand[0]->GetIntervals( ray_O , ray_V , a );
+	//nothing of an empty first operand survives an intersection or a difference
+	if ( operand[1] != NULL && ( !a.empty() || operation == CSG_UNION ) ) operand[1]->GetIntervals( ray_O , ray_V , b );
+	csg_depth--;
+	Combine( a , b , ret );
+}
+
+//the first boundary ahead of the ray origin :: entering a stretch is a front hit, leaving it a back hit
+CollidePrimitive Csg::Collide( Vector3 ray_O , Vector3 ray_V ) {
+	STAT_INC( STAT_COLLIDE_CSG );
+	static thread_local std::vector<CsgInterval> intervals;
+	CollidePrimitive ret;
+	ray_V = ray_V.GetUnitVector();
+	intervals.clear();
+	GetIntervals( ray_O , ray_V , intervals );
+
+	for ( int k = 0 ; k < ( int ) intervals.size() ; k++ ) {
+		bool front = intervals[k].in.dist > EPS;
+		if ( !front && intervals[k].out.dist <= EPS ) continue;
+		CsgHit& hit = front ? intervals[k].in : intervals[k].out;
+		ret.dist = hit.dist;
+		ret.front = front;
+		ret.C = ray_O + ray_V * ret.dist;
+		ret.N = front ? hit.N : -hit.N;
+		ret.isCollide = true;
+		ret.collide_primitive = this;
+		ret.surface = hit.surface;
+		return ret;
+	}
+	return ret;
+}
+
+//hits carry the operand they lie on, this only serves callers without one
+Color Csg::GetTexture(Vector3 crash_C , double footprint) {
+	return ( operand[0] != NULL ) ? operand[0]->GetTexture( crash_C , footprint ) : material->color;
+}
@@ -4,6 +4,7 @@
 #include"color.h"
 #include"vector3.h"
 #include"bmp.h"
+#include"stats.h"
 #include<iostream>
 #include<sstream>
 #include<string>
@@ -23,6 +24,14 @@ public:
 	std::pair<double, double> GetXY();
 };
 
+//what a material does, one kernel per combination of the first five
+enum MaterialFeature {
+	MATERIAL_DIFFUSE = 1 , MATERIAL_SPECULAR = 2 , MATERIAL_REFLECTIVE = 4 , MATERIAL_REFRACTIVE = 8 , MATERIAL_TEXTURED = 16 ,
+	MATERIAL_KERNELS = 32 ,
+	MATERIAL_EMISSIVE = 32 , //a light's own surface, shown as its colour
+	MATERIAL_GENERIC = 64 //not a feature :: the kernel that tests the material at run time
+};
+
 class Material {
 public:
 	Color color , absor;
@@ -32,18 +41,45 @@ public:
 	double drefl;
 	Bmp* texture;
 	Blur* blur;
+	int features; //MaterialFeature bits, set by Classify once the scene is read
 
 	Material();
 	~Material() {}
 
 	void Input( std::string , std::stringstream& );
+	void Classify( bool emissive );
+	bool Test( int feature ) { //from the parameters, as the generic kernel shades
+		switch ( feature ) {
+			case MATERIAL_DIFFUSE: return diff > EPS;
+			case MATERIAL_SPECULAR: return spec > EPS;
+			case MATERIAL_REFLECTIVE: return refl > EPS;
+			case MATERIAL_REFRACTIVE: return refr > EPS;
+			case MATERIAL_TEXTURED: return texture != NULL;
+		}
+		return false;
+	}
 };
 
 struct CollidePrimitive;
+class Primitive;
+
+//where a ray crosses the boundary of a solid, dist along the unit ray and negative behind its origin
+struct CsgHit {
+	double dist;
+	Vector3 N; //outward
+	Primitive* surface; //whose parametrization textures the point
+};
+
+//a stretch of the ray inside a solid
+struct CsgInterval {
+	CsgHit in , out;
+};
 
 class Primitive {
 protected:
 	int sample;
+	int index;
+	std::string name;
 	Material* material;
 	Primitive* next;
 
@@ -51,16 +87,25 @@ public:
 
 	Primitive();
 	Primitive( const Primitive& );
-	~Primitive();
+	virtual ~Primitive();
 	
 	int GetSample() { return sample; }
+	void SetSample( int s ) { sample = s; }
+	int GetIndex() { return index; }
+	void SetIndex( int id ) { index = id; }
+	std::string GetName() { return name; }
 	Material* GetMaterial() { return material; }
 	Primitive* GetNext() { return next; }
 	void SetNext( Primitive* primitive ) { next = primitive; }
 
 	virtual void Input( std::string , std::stringstream& );
 	virtual CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V ) = 0;
-	virtual Color GetTexture(Vector3 crash_C) = 0;
+	virtual Color GetTexture(Vector3 crash_C , double footprint) = 0; //footprint :: world width of the ray cone at crash_C, 0 for a point lookup
+	virtual double GetCurvature(){return 0;} //of the surface at the hit, spreads or focuses ray cones, 0 treats it as flat
+	virtual bool GetBounds( Vector3& lo , Vector3& hi ) = 0; //false if unbounded
+	virtual bool IsSolid(){return false;} //encloses a volume :: GetIntervals works and it can be a CSG operand
+	virtual void GetIntervals( Vector3 , Vector3 , std::vector<CsgInterval>& ) {} //appends, in order, the stretches of the whole line along the unit ray_V inside the solid
+	virtual void Translate( Vector3 D ) = 0;
 	virtual bool IsLightPrimitive(){return false;}
 };
 
@@ -70,8 +115,15 @@ struct CollidePrimitive {
 	Vector3 N , C;
 	double dist;
 	bool front;
-	CollidePrimitive(){isCollide = false; collide_primitive = NULL; dist = BIG_DIST;}
-	Color GetTexture(){return collide_primitive->GetTexture(C);}
+	double footprint; //width of the ray cone where it meets the surface, 0 when the ray carries none
+	Primitive* surface; //the CSG operand whose surface was hit, NULL for collide_primitive's own
+	CollidePrimitive(){isCollide = false; collide_primitive = NULL; dist = BIG_DIST; footprint = 0; surface = NULL;}
+	Color GetTexture(){STAT_INC( STAT_TEXTURE_FETCHES ); return ( surface != NULL ? surface : collide_primitive )->GetTexture(C , footprint);}
+	bool IsCloserThan( CollidePrimitive& other ) { //a tie goes to the primitive earlier in the scene list, as a linear scan would pick it
+		if ( !isCollide ) return false;
+		if ( dist != other.dist || !other.isCollide ) return dist < other.dist;
+		return collide_primitive->GetIndex() < other.collide_primitive->GetIndex();
+	}
 };
 
 class Sphere : public Primitive {
@@ -85,7 +137,12 @@ public:
 
 	void Input( std::string , std::stringstream& );
 	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
-	Color GetTexture(Vector3 crash_C);
+	Color GetTexture(Vector3 crash_C , double footprint);
+	double GetCurvature(){return 1 / R;}
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	bool IsSolid(){return true;}
+	void GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret );
+	void Translate( Vector3 D );
 };
 
 class SphereLightPrimitive : public Sphere{
@@ -106,7 +163,9 @@ public:
 
 	void Input( std::string , std::stringstream& );
 	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
-	Color GetTexture(Vector3 crash_C);
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	void Translate( Vector3 D );
 };
 
 class Square : public Primitive {
@@ -119,7 +178,9 @@ public:
 
 	void Input( std::string , std::stringstream& );
 	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
-	Color GetTexture(Vector3 crash_C);
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	void Translate( Vector3 D );
 };
 
 class Cube : public Primitive {
@@ -133,7 +194,11 @@ public:
 
 	void Input(std::string, std::stringstream&);
 	CollidePrimitive Collide(Vector3 ray_O, Vector3 ray_V);
-	Color GetTexture(Vector3 crash_C);
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	bool IsSolid(){return true;}
+	void GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret );
+	void Translate( Vector3 D );
 };
 
 
@@ -155,7 +220,11 @@ public:
 
 	void Input( std::string , std::stringstream& );
 	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
-	Color GetTexture(Vector3 crash_C);
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	bool IsSolid(){return true;}
+	void GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret );
+	void Translate( Vector3 D );
 };
 
 class Bezier : public Primitive {
@@ -166,13 +235,96 @@ class Bezier : public Primitive {
 	int degree;
 	Cylinder* boundingCylinder;
 
+	void Evaluate( double t , double& z , double& r , double& dz , double& dr ); //profile point and derivative at t
+
 public:
 	Bezier() : Primitive() {boundingCylinder = NULL; degree = -1;}
 	~Bezier() {}
 
 	void Input( std::string , std::stringstream& );
 	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
-	Color GetTexture(Vector3 crash_C);
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	void Translate( Vector3 D );
+};
+
+class Triangle : public Primitive {
+	Vector3 P1, P2, P3;
+	double U[3], V[3]; //texture coordinates of the corners
+
+public:
+	Triangle();
+	Triangle(Vector3 pP1, Vector3 pP2, Vector3 pP3) : Triangle() {P1 = pP1; P2 = pP2; P3 = pP3; }
+	~Triangle() {}
+
+	void SetTextureCoords( int k , double u , double v ) { U[k] = u; V[k] = v; }
+	void Input( std::string , std::stringstream& );
+	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	void Translate( Vector3 D );
+};
+
+//terrain over the xy rectangle O + [0,size_x] x [0,size_y], two triangles per cell of the height samples
+class Heightfield : public Primitive {
+	Vector3 O;
+	double size_x, size_y, height;
+	int W, H; //samples, W - 1 by H - 1 cells
+	std::vector<float> Z; //one float per sample in 0..1, scaled by height above O.z
+	//min/max mip over the cells from 2 x 2 cells up, the cells themselves read their four corners
+	std::vector<float> Z_min, Z_max;
+	std::vector<int> level_offset, level_W, level_H;
+	bool tessellate;
+
+	void Load( std::string file );
+	void Fractal( int n , int seed );
+	void BuildMips();
+	void NodeRange( int level , int i , int j , double& lo , double& hi );
+	Vector3 GetPoint( int i , int j ) { return Vector3( O.x + size_x * i / ( W - 1 ) , O.y + size_y * j / ( H - 1 ) , O.z + Z[j * W + i] * height ); }
+
+public:
+	Heightfield() : Primitive() {W = H = 0; size_x = size_y = height = 1; tessellate = false; }
+	~Heightfield() {}
+
+	bool IsTessellated() { return tessellate; }
+	int GetSampleCount() { return W * H; }
+	long long GetMemory(); //bytes of samples and mips
+	Primitive* Tessellate( Primitive* next ); //the same triangles as Triangle primitives linked before next
+
+	void Input( std::string , std::stringstream& );
+	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	void Translate( Vector3 D );
+};
+
+enum CsgOperation { CSG_UNION , CSG_INTERSECTION , CSG_DIFFERENCE };
+
+//union, intersection or difference of two solids named in the scene, which leave the primitive list for it
+//its material covers the whole solid, textures follow the surface of the operand that was hit
+class Csg : public Primitive {
+	CsgOperation operation;
+	std::string operand_name[2];
+	Primitive* operand[2]; //NULL :: an empty solid, for a name that did not resolve
+
+	void Combine( std::vector<CsgInterval>& a , std::vector<CsgInterval>& b , std::vector<CsgInterval>& ret );
+
+public:
+	Csg() : Primitive() {operation = CSG_UNION; operand[0] = operand[1] = NULL;}
+	~Csg();
+
+	std::string GetOperandName( int k ) { return operand_name[k]; }
+	void SetOperand( int k , Primitive* primitive ) { operand[k] = primitive; }
+	bool Contains( Primitive* primitive ); //anywhere in its operand tree
+	void ShareTexture( Bmp* texture ); //the operands map this texture, their own are dropped
+
+	void Input( std::string , std::stringstream& );
+	CollidePrimitive Collide( Vector3 ray_O , Vector3 ray_V );
+	Color GetTexture(Vector3 crash_C , double footprint);
+	bool GetBounds( Vector3& lo , Vector3& hi );
+	bool IsSolid(){return true;}
+	void GetIntervals( Vector3 ray_O , Vector3 ray_V , std::vector<CsgInterval>& ret );
+	void Translate( Vector3 D );
 };
 
 #endif
@@ -2,6 +2,11 @@
 #include<cstdlib>
 #include<iostream>
 #include<thread>
+#include<chrono>
+#include<algorithm>
+#include<cstdio>
+#include<map>
+#include<set>
 #define ran() ( double( rand() % 32768 ) / 32768 )
 
 const double SPEC_POWER = 20;
@@ -9,101 +14,423 @@ const int MAX_DREFL_DEP = 2;
 const int MAX_RAYTRACING_DEP = 10;
 const int HASH_FAC = 7;
 const int HASH_MOD = 10000007;
+const double ENVIRONMENT_DISTANCE = 1e6; //shadow rays towards the environment end here
+const int LENS_BATCH = 4; //a defocused pixel checks its error after every this many lens samples
+const int LENS_DEFOCUSED = -1; //sample hash of a pixel already integrated over lens and pixel, never resampled
+const double RAY_CONE_MIN_COS = 0.05; //grazing hits stretch the footprint by 1 / cos up to this
+const double TEXTURE_ALIAS_THRESHOLD = 0.05; //unfiltered, a texel this far from the footprint mean counts as aliased
+
+thread_local long long thread_rays = 0;
+static thread_local bool gathering = false; //inside a hemisphere gather, whose hits get direct light only
+
+//the cone widens along the ray, and its footprint stretches on surfaces seen at a slant
+double RayCone::Hit( double dist , double cos ) {
+	width += spread * dist;
+	return fabs( width ) / sqrt( std::max( cos , RAY_CONE_MIN_COS ) );
+}
+
+//a convex mirror spreads the cone by twice its curvature times the width, seen from inside it focuses
+void RayCone::Reflect( double curvature ) {
+	if ( !IsEmpty() ) spread += 2 * curvature * width;
+}
+
+//paraxial :: the angles shrink by n, and a curved interface bends the cone like a thin lens of power ( 1 - n ) * curvature
+void RayCone::Refract( double n , double curvature ) {
+	if ( !IsEmpty() ) spread = spread * n - ( 1 - n ) * curvature * width;
+}
 
 Raytracer::Raytracer() {
 	light_head = NULL;
 	background_color = Color();
+	environment = NULL;
 	camera = new Camera;
+	thread_pool = NULL;
+	threads = 0;
+	spp = 0;
+	seed = 1995 - 05 - 12;
+	region_x0 = region_y0 = 0;
+	region_x1 = region_y1 = -1;
+	i0 = i1 = j0 = j1 = 0;
+	denoiser = NULL;
+	animation = NULL;
+	irradiance_cache = NULL;
+	use_irradiance_cache = true;
+	specialized_shading = true;
+	tile_order = TILE_HILBERT;
+	async_output = false;
+	image_writer = NULL;
+	output_seconds = 0;
+	traced_rays = 0;
+	gathers = 0;
+	created = false;
 }
 
+Raytracer::~Raytracer() {
+	if ( image_writer != NULL ) delete image_writer;
+	while ( light_head != NULL ) {
+		Light* next_head = light_head->GetNext();
+		delete light_head;
+		light_head = next_head;
+	}
+	delete camera;
+	if ( thread_pool != NULL ) delete thread_pool;
+	if ( denoiser != NULL ) delete denoiser;
+	if ( animation != NULL ) delete animation;
+	if ( irradiance_cache != NULL ) delete irradiance_cache;
+	if ( environment != NULL ) delete environment;
+}
+
+ThreadPool* Raytracer::GetThreadPool() {
+	if ( thread_pool == NULL ) thread_pool = new ThreadPool( threads );
+	return thread_pool;
+}
+
+//MATERIAL_KERNELS entries from kernel<f> on
+#define KERNELS_8( kernel , f ) &Raytracer::kernel<f> , &Raytracer::kernel<f + 1> , &Raytracer::kernel<f + 2> , &Raytracer::kernel<f + 3> , \
+	&Raytracer::kernel<f + 4> , &Raytracer::kernel<f + 5> , &Raytracer::kernel<f + 6> , &Raytracer::kernel<f + 7>
+
+const Raytracer::DiffusionKernel Raytracer::diffusion_kernels[MATERIAL_KERNELS] = {
+	KERNELS_8( CalnDiffusion , 0 ) , KERNELS_8( CalnDiffusion , 8 ) , KERNELS_8( CalnDiffusion , 16 ) , KERNELS_8( CalnDiffusion , 24 )
+};
+
+const Raytracer::ShadeKernel Raytracer::shade_kernels[MATERIAL_KERNELS] = {
+	KERNELS_8( Shade , 0 ) , KERNELS_8( Shade , 8 ) , KERNELS_8( Shade , 16 ) , KERNELS_8( Shade , 24 )
+};
+
+template<int F>
+Color Raytracer::CalnLight( Light* light , CollidePrimitive& collide_primitive , Material* material , Color color , int* hash ) {
+	Color ret;
+	double shade = light->CalnShade( collide_primitive.C , &scene , camera->GetShadeQuality() );
+	if ( shade < EPS ) return ret;
+	
+	Vector3 R = ( light->GetO() - collide_primitive.C ).GetUnitVector();
+	double dot = R.Dot( collide_primitive.N );
+	if ( dot > EPS ) {
+		if ( hash != NULL && light->IsPointLight() ) *hash = ( *hash + light->GetSample() ) & HASH_MOD;
+
+		if ( Has<F>( material , MATERIAL_DIFFUSE ) ) {
+			double diff = material->diff * dot * shade;
+			ret += color * light->GetColor() * diff;
+		}
+		if ( Has<F>( material , MATERIAL_SPECULAR ) ) {
+			double spec = material->spec * pow( dot , SPEC_POWER ) * shade;
+			ret += color * light->GetColor() * spec;
+		}
+	}
+	return ret;
+}
+
+template<int F>
 Color Raytracer::CalnDiffusion(CollidePrimitive collide_primitive , int* hash ) {
 	
-	Primitive* primitive = collide_primitive.collide_primitive;
-	Color color = primitive->GetMaterial()->color;
-	if ( primitive->GetMaterial()->texture != NULL ) color = color * collide_primitive.GetTexture();
+	Material* material = collide_primitive.collide_primitive->GetMaterial();
+	Color color = material->color;
+	if ( Has<F>( material , MATERIAL_TEXTURED ) ) {
+		double footprint = collide_primitive.footprint;
+		if ( !camera->GetTextureFilter() ) collide_primitive.footprint = 0;
+		Color texel = collide_primitive.GetTexture();
+		color = color * texel;
+
+		//a point lookup that strays from the mean over the footprint aliases :: its colour goes into the hash, so the resampler takes the pixel
+		if ( hash != NULL && !camera->GetTextureFilter() && footprint > 0 ) {
+			collide_primitive.footprint = footprint;
+			Color diff = collide_primitive.GetTexture() - texel;
+			if ( fabs( diff.r ) + fabs( diff.g ) + fabs( diff.b ) > 3 * TEXTURE_ALIAS_THRESHOLD )
+				*hash = ( *hash + 1 + ( int ) ( ( texel.r + texel.g * 3 + texel.b * 7 ) * 255 ) ) % HASH_MOD;
+			collide_primitive.footprint = 0;
+		}
+	}
 	
-	Color ret = color * background_color * primitive->GetMaterial()->diff;
+	//the environment takes the place of the constant ambient term
+	Color ret;
+	if ( environment != NULL && environment->GetSamples() > 0 ) {
+		if ( Has<F>( material , MATERIAL_DIFFUSE ) ) ret = color * CalnEnvironment( collide_primitive ) * material->diff;
+	} else
+		ret = color * background_color * material->diff;
+
+	int light_samples = camera->GetLightSamples();
+	if ( light_samples > 0 ) {
+		//a few lights drawn from the light tree, weighted by 1 / pdf :: only certain picks go into the hash, random ones differ between neighbours
+		for ( int k = 0 ; k < light_samples ; k++ ) {
+			double pdf;
+			Light* light = light_tree.Sample( collide_primitive.C , collide_primitive.N , pdf );
+			if ( light == NULL ) break;
+			ret += CalnLight<F>( light , collide_primitive , material , color , ( pdf >= 1 && k == 0 ) ? hash : NULL ) / ( pdf * light_samples );
+		}
+	} else
+		for ( Light* light = light_head ; light != NULL ; light = light->GetNext() )
+			ret += CalnLight<F>( light , collide_primitive , material , color , hash );
 
-	for ( Light* light = light_head ; light != NULL ; light = light->GetNext() ) {
-		double shade = light->CalnShade( collide_primitive.C , scene.GetPrimitiveHead() , camera->GetShadeQuality() );
-		if ( shade < EPS ) continue;
-		
-		Vector3 R = ( light->GetO() - collide_primitive.C ).GetUnitVector();
-		double dot = R.Dot( collide_primitive.N );
-		if ( dot > EPS ) {
-			if ( hash != NULL && light->IsPointLight() ) *hash = ( *hash + light->GetSample() ) & HASH_MOD;
-
-			if ( primitive->GetMaterial()->diff > EPS ) {
-				double diff = primitive->GetMaterial()->diff * dot * shade;
-				ret += color * light->GetColor() * diff;
-			}
-			if ( primitive->GetMaterial()->spec > EPS ) {
-				double spec = primitive->GetMaterial()->spec * pow( dot , SPEC_POWER ) * shade;
-				ret += color * light->GetColor() * spec;
+	if ( !gathering && camera->GetIndirectQuality() > 0 && Has<F>( material , MATERIAL_DIFFUSE ) )
+		ret += color * CalnIndirect( collide_primitive ) * material->diff;
+
+	return ret;
+}
+
+//the diffuse and specular lobes through the material's kernel, nothing for a pure mirror or glass
+Color Raytracer::CalnLocal( CollidePrimitive collide_primitive , int* hash ) {
+	Material* material = collide_primitive.collide_primitive->GetMaterial();
+	if ( !specialized_shading ) {
+		if ( material->diff > EPS || material->spec > EPS ) return CalnDiffusion<MATERIAL_GENERIC>( collide_primitive , hash );
+	} else
+	if ( material->features & ( MATERIAL_DIFFUSE | MATERIAL_SPECULAR ) )
+		return ( this->*diffusion_kernels[material->features & ( MATERIAL_KERNELS - 1 )] )( collide_primitive , hash );
+	return Color();
+}
+
+//stratified cosine-weighted gather over M x N cells, with Ward and Heckbert's irradiance gradients
+void Raytracer::GatherIrradiance( Vector3 C , Vector3 N , IrradianceRecord& record ) {
+	int s = std::max( ( int ) ceil( sqrt( ( double ) camera->GetIndirectQuality() ) ) , 1 );
+	int M = 2 * s , K = 8 * s;
+	double min_spacing = ( irradiance_cache != NULL ) ? irradiance_cache->GetMinSpacing() : STD_IRRADIANCE_MIN_SPACING;
+	double max_spacing = ( irradiance_cache != NULL ) ? irradiance_cache->GetMaxSpacing() : STD_IRRADIANCE_MAX_SPACING;
+	Vector3 U = N.GetAnVerticalVector() , V = N * U;
+	std::vector<Color> L( M * K );
+	std::vector<double> r( M * K ) , tan_theta( M * K );
+	gathers++;
+
+	gathering = true;
+	double inv_dist = 0;
+	for ( int j = 0 ; j < M ; j++ )
+		for ( int k = 0 ; k < K ; k++ ) {
+			double sin2 = ( j + ran() ) / M , phi = 2 * PI * ( k + ran() ) / K;
+			double sin_theta = sqrt( sin2 ) , cos_theta = sqrt( 1 - sin2 );
+			Vector3 dir = ( U * cos( phi ) + V * sin( phi ) ) * sin_theta + N * cos_theta;
+			thread_rays++;
+			STAT_INC( STAT_DIFFUSE_RAYS );
+
+			//lights are left to the direct term
+			CollidePrimitive hit = scene.FindNearestPrimitiveGetCollide( C , dir );
+			int c = j * K + k;
+			r[c] = hit.isCollide ? std::max( hit.dist , min_spacing ) : max_spacing;
+			tan_theta[c] = sin_theta / std::max( cos_theta , 1e-3 );
+			if ( hit.isCollide && !hit.collide_primitive->IsLightPrimitive() ) {
+				L[c] = CalnLocal( hit , NULL );
 			}
+			inv_dist += 1 / r[c];
+		}
+	gathering = false;
+
+	record.P = C;
+	record.N = N;
+	record.E = Color();
+	for ( int c = 0 ; c < M * K ; c++ )
+		record.E += L[c] / ( M * K );
+	record.R = std::min( std::max( M * K / inv_dist , min_spacing ) , max_spacing );
+
+	Vector3 grad_r[3] , grad_t[3];
+	for ( int k = 0 ; k < K ; k++ ) {
+		double phi = 2 * PI * ( k + 0.5 ) / K , phi_lo = 2 * PI * k / K;
+		Vector3 u = U * cos( phi ) + V * sin( phi );
+		Vector3 v = U * -sin( phi ) + V * cos( phi );
+		Vector3 v_lo = U * -sin( phi_lo ) + V * cos( phi_lo );
+		int prev = ( k + K - 1 ) % K;
+		Color rotation , radial , around;
+		for ( int j = 0 ; j < M ; j++ ) {
+			int c = j * K + k;
+			rotation -= L[c] * tan_theta[c];
+			double sin_lo = sqrt( ( double ) j / M ) , cos_lo = sqrt( 1 - ( double ) j / M ) , cos_hi = sqrt( 1 - ( double ) ( j + 1 ) / M );
+			if ( j > 0 ) radial += ( L[c] - L[c - K] ) * ( sin_lo * cos_lo * cos_lo / std::min( r[c] , r[c - K] ) );
+			around += ( L[c] - L[j * K + prev] ) * ( ( cos_lo - cos_hi ) / ( sqrt( ( j + 0.5 ) / M ) * std::min( r[c] , r[j * K + prev] ) ) );
 		}
+		//the sums above estimate irradiance gradients, divide by pi to match E
+		rotation = rotation / ( M * K );
+		radial = radial * ( 2.0 / K );
+		around = around / PI;
+		grad_r[0] += v * rotation.r; grad_r[1] += v * rotation.g; grad_r[2] += v * rotation.b;
+		grad_t[0] += u * radial.r + v_lo * around.r;
+		grad_t[1] += u * radial.g + v_lo * around.g;
+		grad_t[2] += u * radial.b + v_lo * around.b;
 	}
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		record.grad_r[c] = grad_r[c];
+		record.grad_t[c] = grad_t[c];
+	}
+}
 
-	return ret;
+//indirect irradiance over pi at the hit, from the cache when a record is close enough
+Color Raytracer::CalnIndirect( CollidePrimitive collide_primitive ) {
+	Color E;
+	bool cached = irradiance_cache != NULL && use_irradiance_cache;
+	if ( cached && irradiance_cache->Lookup( collide_primitive.C , collide_primitive.N , E ) ) return E;
+
+	IrradianceRecord record;
+	GatherIrradiance( collide_primitive.C , collide_primitive.N , record );
+	if ( cached ) irradiance_cache->Add( record );
+	return record.E;
+}
+
+//environment irradiance over pi, directions drawn from its texel cdf and tested for occlusion
+Color Raytracer::CalnEnvironment( CollidePrimitive collide_primitive ) {
+	Vector3 C = collide_primitive.C , N = collide_primitive.N;
+	int n = environment->GetSamples();
+	Color E;
+	for ( int k = 0 ; k < n ; k++ ) {
+		double pdf;
+		Vector3 dir = environment->Sample( N , pdf );
+		if ( pdf <= 0 ) break;
+		double dot = dir.Dot( N );
+		if ( dot <= EPS ) continue;
+		thread_rays++;
+		STAT_INC( STAT_SHADOW_RAYS );
+		if ( scene.FindOccluder( C , C + dir * ENVIRONMENT_DISTANCE , NULL ) != NULL ) continue;
+		E += environment->Lookup( dir ) * ( dot / ( pdf * PI * n ) );
+	}
+	return E;
 }
 
-Color Raytracer::CalnReflection(CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash ) {
+Color Raytracer::CalnReflection(CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash , RayCone cone ) {
 	
 	ray_V = ray_V.Reflect( collide_primitive.N );
 	Primitive* primitive = collide_primitive.collide_primitive;
+	STAT_INC( STAT_REFLECTION_RAYS );
+
+	cone.Reflect( collide_primitive.front ? primitive->GetCurvature() : -primitive->GetCurvature() );
 
 	if ( primitive->GetMaterial()->drefl < EPS || dep > MAX_DREFL_DEP )
-		return RayTracing( collide_primitive.C , ray_V , dep + 1 , hash ) * primitive->GetMaterial()->color * primitive->GetMaterial()->refl;
+		return RayTracing( collide_primitive.C , ray_V , dep + 1 , hash , NULL , cone ) * primitive->GetMaterial()->color * primitive->GetMaterial()->refl;
 	else
 	{
-		return RayTracing( collide_primitive.C , ray_V , dep + 1 , hash ) * primitive->GetMaterial()->color * primitive->GetMaterial()->refl;
+		return RayTracing( collide_primitive.C , ray_V , dep + 1 , hash , NULL , cone ) * primitive->GetMaterial()->color * primitive->GetMaterial()->refl;
 		//NEED TO IMPLEMENT
 		//ADD BLUR
 	}
 }
 
-Color Raytracer::CalnRefraction(CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash ) {
+Color Raytracer::CalnRefraction(CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash , RayCone cone ) {
 	
 	Primitive* primitive = collide_primitive.collide_primitive;
 	double n = primitive->GetMaterial()->rindex;
 	if ( collide_primitive.front ) n = 1 / n;
 	
 	ray_V = ray_V.Refract( collide_primitive.N , n );
+	STAT_INC( STAT_REFRACTION_RAYS );
+
+	cone.Refract( n , collide_primitive.front ? primitive->GetCurvature() : -primitive->GetCurvature() );
 	
-	Color rcol = RayTracing( collide_primitive.C , ray_V , dep + 1 , hash );
+	Color rcol = RayTracing( collide_primitive.C , ray_V , dep + 1 , hash , NULL , cone );
 	if ( collide_primitive.front ) return rcol * primitive->GetMaterial()->refr;
 	Color absor = primitive->GetMaterial()->absor * -collide_primitive.dist;
 	Color trans = Color( exp( absor.r ) , exp( absor.g ) , exp( absor.b ) );
 	return rcol * trans * primitive->GetMaterial()->refr;
 }
 
-Color Raytracer::RayTracing( Vector3 ray_O , Vector3 ray_V , int dep , int* hash ) {
+template<int F>
+Color Raytracer::Shade( CollidePrimitive& collide_primitive , Vector3 ray_V , int dep , int* hash , RayCone cone ) {
+	Material* material = collide_primitive.collide_primitive->GetMaterial();
+	Color ret;
+	if ( Has<F>( material , MATERIAL_DIFFUSE ) || Has<F>( material , MATERIAL_SPECULAR ) ) ret += CalnDiffusion<F>( collide_primitive , hash );
+	if ( Has<F>( material , MATERIAL_REFLECTIVE ) ) ret += CalnReflection( collide_primitive , ray_V , dep , hash , cone );
+	if ( Has<F>( material , MATERIAL_REFRACTIVE ) ) ret += CalnRefraction( collide_primitive , ray_V , dep , hash , cone );
+	return ret;
+}
+
+Color Raytracer::RayTracing( Vector3 ray_O , Vector3 ray_V , int dep , int* hash , AovSample* aov_sample , RayCone cone ) {
 	if ( dep > MAX_RAYTRACING_DEP ) return Color();
+	thread_rays++;
+	if ( dep == 1 ) STAT_INC( STAT_PRIMARY_RAYS );
 
 	Color ret;
 	CollidePrimitive collide_primitive = scene.FindNearestPrimitiveGetCollide( ray_O , ray_V );
 
 	if ( collide_primitive.isCollide) {
+		if ( !cone.IsEmpty() ) collide_primitive.footprint = cone.Hit( collide_primitive.dist , fabs( ray_V.GetUnitVector().Dot( collide_primitive.N ) ) );
+		if ( aov_sample != NULL ) aov_sample->Set( collide_primitive );
 		if ( hash != NULL ) *hash = ( *hash + collide_primitive.collide_primitive->GetSample() ) % HASH_MOD;
 		Primitive* primitive = collide_primitive.collide_primitive;
-		if ( primitive->IsLightPrimitive() ) 
-		{
-			ret += primitive->GetMaterial()->color;
-			//std::cout<<primitive->GetMaterial()->color.r;
-		}
+		Material* material = primitive->GetMaterial();
+		if ( !specialized_shading ) {
+			if ( primitive->IsLightPrimitive() ) ret += material->color;
+			else ret += Shade<MATERIAL_GENERIC>( collide_primitive , ray_V , dep , hash , cone );
+		} else
+		if ( material->features & MATERIAL_EMISSIVE )
+			ret += material->color;
 		else
-		{
-			if ( primitive->GetMaterial()->diff > EPS || primitive->GetMaterial()->spec > EPS ) ret += CalnDiffusion( collide_primitive , hash );
-			if ( primitive->GetMaterial()->refl > EPS ) ret += CalnReflection( collide_primitive , ray_V , dep , hash );
-			if ( primitive->GetMaterial()->refr > EPS ) ret += CalnRefraction( collide_primitive , ray_V , dep , hash );
-		}
-	}
+			ret += ( this->*shade_kernels[material->features] )( collide_primitive , ray_V , dep , hash , cone );
+	} else
+	if ( environment != NULL )
+		ret += environment->Lookup( ray_V );
 
 	if ( hash != NULL ) *hash = ( *hash * HASH_FAC ) % HASH_MOD;
-	ret.Confine();
 	return ret;
 }
 
+//camera ray of pixel (i,j) through the lens :: a pixel whose first hit is in focus keeps that one sample and the usual resampling,
+//a defocused one is integrated over the lens and the pixel area until the luminance mean settles
+//only the first hit is judged, so a sharp mirror keeps its defocused reflection sharp too
+Color Raytracer::TraceLens( int i , int j , int* hash , AovSample* aov_sample ) {
+	int pixel = i * camera->GetW() + j;
+	Vector3 ray_O , ray_V;
+	thread_sampler.Start( camera->GetSampler() , pixel , 0 );
+	camera->EmitLens( i , j , 0 , 0 , 0 , ray_O , ray_V );
+	AovSample first;
+	RayCone cone( 0 , camera->GetPixelSpread() );
+	Color ret = RayTracing( ray_O , ray_V , 1 , hash , &first , cone );
+	if ( aov_sample != NULL ) *aov_sample = first;
+	if ( camera->CircleOfConfusion( i , j , ( first.primitive >= 0 ) ? first.depth : 0 ) < 0.5 ) return ret;
+
+	STAT_INC( STAT_DEFOCUSED_PIXELS );
+	if ( hash != NULL ) *hash = LENS_DEFOCUSED;
+	double lum = ( ret.r + ret.g + ret.b ) / 3 , sum = lum , sum2 = lum * lum;
+	int n = 1 , limit = std::max( camera->GetLensSamples() , 1 );
+	while ( n < limit ) {
+		double u[4];
+		camera->LensSample( i , j , n , u );
+		camera->EmitLens( i , j , u[2] - 0.5 , u[3] - 0.5 , n , ray_O , ray_V );
+		thread_sampler.Start( camera->GetSampler() , pixel , n );
+		Color color = RayTracing( ray_O , ray_V , 1 , NULL , NULL , cone );
+		STAT_INC( STAT_LENS_RAYS );
+		ret += color;
+		lum = ( color.r + color.g + color.b ) / 3;
+		sum += lum;
+		sum2 += lum * lum;
+		n++;
+		if ( n % LENS_BATCH != 0 || n < 2 * LENS_BATCH ) continue;
+		double mean = sum / n , var = std::max( sum2 / n - mean * mean , 0.0 );
+		if ( sqrt( var / n ) < camera->GetLensThreshold() ) break;
+	}
+	return ret / n;
+}
+
+Color Raytracer::TracePixel( int i , int j , int* hash , AovSample* aov_sample ) {
+	if ( camera->HasLens() ) return TraceLens( i , j , hash , aov_sample );
+	thread_sampler.Start( camera->GetSampler() , i * camera->GetW() + j , 0 );
+	return RayTracing( camera->GetO() , camera->Emit( i , j ) , 1 , hash , aov_sample , RayCone( 0 , camera->GetPixelSpread() ) );
+}
+
+//focus_dist 0 :: focus on whatever the centre pixel sees, the far distance when it sees nothing
+void Raytracer::AutoFocus() {
+	if ( !camera->HasLens() || !camera->IsAutoFocus() ) return;
+	int i = camera->GetH() / 2 , j = camera->GetW() / 2;
+	Vector3 ray_V = camera->Emit( i , j );
+	CollidePrimitive collide_primitive = scene.FindNearestPrimitiveGetCollide( camera->GetO() , ray_V );
+	double dist = collide_primitive.isCollide ? collide_primitive.dist : ENVIRONMENT_DISTANCE;
+	camera->SetFocusDist( dist * ray_V.GetUnitVector().Dot( camera->GetN() ) );
+}
+
+//asynchronous, only the copy of the framebuffer stays on the calling thread
+void Raytracer::OutputImage() {
+	STAT_PHASE( PHASE_OUTPUT );
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if ( async_output && image_writer == NULL ) image_writer = new ImageWriter;
+	ImageJob* job = async_output ? image_writer->NewJob() : new ImageJob;
+	job->H = camera->GetH();
+	job->W = camera->GetW();
+	camera->GetFramebuffer( job->color );
+	job->tonemapper = tonemapper;
+	job->output = output;
+	job->hdr_output = hdr_output;
+	if ( async_output ) {
+		image_writer->Submit( job );
+	} else {
+		ImageWriter::Write( *job );
+		delete job;
+	}
+
+	if ( aov_output != "" ) aov.Output( aov_output );
+	output_seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
 Primitive* Raytracer::CreateAndLinkLightPrimitive(Primitive* primitive_head)
 {
 	Light* light_iter = light_head;
@@ -119,14 +446,78 @@ Primitive* Raytracer::CreateAndLinkLightPrimitive(Primitive* primitive_head)
 	return primitive_head;
 }
 
-void Raytracer::CreateAll()
-{
-	srand( 1995 - 05 - 12 );
+//terrain asked for as a mesh is swapped for its triangles, the list keeps its order otherwise
+static Primitive* TessellateHeightfields( Primitive* primitive_head ) {
+	Primitive* head = NULL;
+	Primitive* last = NULL;
+	for ( Primitive* now = primitive_head ; now != NULL ; ) {
+		Primitive* next = now->GetNext();
+		Primitive* part = now;
+		Heightfield* heightfield = dynamic_cast<Heightfield*>( now );
+		if ( heightfield != NULL && heightfield->IsTessellated() ) {
+			part = heightfield->Tessellate( NULL );
+			delete heightfield;
+		} else
+			now->SetNext( NULL );
+		now = next;
+		if ( part == NULL ) continue;
+		if ( last == NULL ) head = part; else last->SetNext( part );
+		for ( last = part ; last->GetNext() != NULL ; last = last->GetNext() );
+	}
+	return head;
+}
+
+//csg nodes take the solids they name out of the list, an operand that does not resolve stays an empty solid
+static Primitive* LinkCsgOperands( Primitive* primitive_head ) {
+	std::map<std::string , Primitive*> named;
+	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() )
+		if ( now->GetName() != "" && named.find( now->GetName() ) == named.end() ) named[now->GetName()] = now;
+
+	std::set<Primitive*> used;
+	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() ) {
+		Csg* csg = dynamic_cast<Csg*>( now );
+		if ( csg == NULL ) continue;
+		for ( int k = 0 ; k < 2 ; k++ ) {
+			std::string name = csg->GetOperandName( k );
+			std::map<std::string , Primitive*>::iterator iter = named.find( name );
+			Primitive* operand = ( iter != named.end() ) ? iter->second : NULL;
+			Csg* operand_csg = dynamic_cast<Csg*>( operand );
+			//each solid goes to one node, and never into its own tree
+			if ( operand == NULL || !operand->IsSolid() || operand == now || used.count( operand ) > 0 ||
+				( operand_csg != NULL && operand_csg->Contains( now ) ) ) {
+				fprintf( stderr , "csg :: operand \"%s\" is not an unused solid\n" , name.c_str() );
+				continue;
+			}
+			csg->SetOperand( k , operand );
+			used.insert( operand );
+		}
+	}
+
+	Primitive* head = NULL;
+	Primitive* last = NULL;
+	for ( Primitive* now = primitive_head ; now != NULL ; ) {
+		Primitive* next = now->GetNext();
+		now->SetNext( NULL );
+		if ( used.count( now ) == 0 ) {
+			Csg* csg = dynamic_cast<Csg*>( now );
+			if ( csg != NULL ) csg->ShareTexture( csg->GetMaterial()->texture );
+			if ( last == NULL ) head = now; else last->SetNext( now );
+			last = now;
+		}
+		now = next;
+	}
+	return head;
+}
+
+//image_only :: just the camera and the tone mapper, every other block is skipped
+Primitive* Raytracer::InputScene( bool image_only ) {
 	std::ifstream fin( input.c_str() );
+	STAT_PHASE( PHASE_PARSE );
 
 	std::string obj;
 	Primitive* primitive_head = NULL;
 	while ( fin >> obj ) {
+		if ( image_only && obj != "camera" && obj != "tonemap" ) continue;
 		Primitive* new_primitive = NULL;
 		Light* new_light = NULL;
 		if ( obj == "primitive" ) {
@@ -137,6 +528,9 @@ void Raytracer::CreateAll()
 			if ( type == "cylinder" ) new_primitive = new Cylinder;
 			if ( type == "cube" ) new_primitive = new Cube;
 			if ( type == "bezier" ) new_primitive = new Bezier;
+			if ( type == "triangle" ) new_primitive = new Triangle;
+			if ( type == "heightfield" ) new_primitive = new Heightfield;
+			if ( type == "csg" ) new_primitive = new Csg;
 			if ( new_primitive != NULL ) {
 				new_primitive->SetNext( primitive_head );
 				primitive_head = new_primitive;
@@ -152,7 +546,19 @@ void Raytracer::CreateAll()
 				light_head = new_light;
 			}
 		} else
-		if ( obj != "background" && obj != "camera" ) continue;
+		if ( obj == "denoise" ) {
+			if ( denoiser == NULL ) denoiser = new Denoiser;
+		} else
+		if ( obj == "animation" ) {
+			if ( animation == NULL ) animation = new Animation;
+		} else
+		if ( obj == "irradiance_cache" ) {
+			if ( irradiance_cache == NULL ) irradiance_cache = new IrradianceCache;
+		} else
+		if ( obj == "environment" ) {
+			if ( environment == NULL ) environment = new Environment;
+		} else
+		if ( obj != "background" && obj != "camera" && obj != "tonemap" ) continue;
 
 		fin.ignore( 1024 , '\n' );
 		
@@ -166,18 +572,68 @@ void Raytracer::CreateAll()
 			if ( obj == "primitive" && new_primitive != NULL ) new_primitive->Input( var , fin2 );
 			if ( obj == "light" && new_light != NULL ) new_light->Input( var , fin2 );
 			if ( obj == "camera" ) camera->Input( var , fin2 );
+			if ( obj == "denoise" ) denoiser->Input( var , fin2 );
+			if ( obj == "animation" ) animation->Input( var , fin2 );
+			if ( obj == "irradiance_cache" ) irradiance_cache->Input( var , fin2 );
+			if ( obj == "environment" ) environment->Input( var , fin2 );
+			if ( obj == "tonemap" ) tonemapper.Input( var , fin2 );
 		}
 	}
+	return primitive_head;
+}
 
-	scene.CreateScene(CreateAndLinkLightPrimitive(primitive_head));
+void Raytracer::InitializeCamera() {
+	if ( spp > 0 ) camera->SetSpp( spp );
 	camera->Initialize();
+
+	int H = camera->GetH() , W = camera->GetW();
+	int x1 = ( region_x1 < 0 ) ? W : region_x1 , y1 = ( region_y1 < 0 ) ? H : region_y1;
+	j0 = std::max( region_x0 , 0 ); j1 = std::max( std::min( x1 , W ) , j0 );
+	i0 = std::max( H - y1 , 0 ); i1 = std::max( std::min( H - region_y0 , H ) , i0 );
+}
+
+void Raytracer::CreateImage() {
+	InputScene( true );
+	InitializeCamera();
+}
+
+void Raytracer::CreateAll()
+{
+	//a sequence reuses the parsed scene for every frame
+	if ( created ) return;
+	created = true;
+	srand( seed );
+	StatsReset();
+	Primitive* primitive_head = InputScene( false );
+
+	STAT_PHASE_NEXT( PHASE_BUILD );
+	primitive_head = TessellateHeightfields( primitive_head );
+	primitive_head = LinkCsgOperands( primitive_head );
+	primitive_head = CreateAndLinkLightPrimitive( primitive_head );
+	for ( Primitive* primitive = primitive_head ; primitive != NULL ; primitive = primitive->GetNext() )
+		primitive->GetMaterial()->Classify( primitive->IsLightPrimitive() );
+	scene.CreateScene( primitive_head );
+	int slot = 0;
+	for ( Light* light = light_head ; light != NULL ; light = light->GetNext() )
+		light->SetSlot( slot++ );
+	Light::ClearOccluderCaches();
+	light_tree.Build( light_head );
+	if ( environment != NULL ) environment->Load();
+	InitializeCamera();
+	AutoFocus();
+}
+
+bool Raytracer::NeedResampling( int** sample , int i , int j ) {
+	if ( sample[i][j] == LENS_DEFOCUSED ) return false;
+	return !( ( i == i0 || sample[i][j] == sample[i - 1][j] ) && ( i == i1 - 1 || sample[i][j] == sample[i + 1][j] ) &&
+	          ( j == j0 || sample[i][j] == sample[i][j - 1] ) && ( j == j1 - 1 || sample[i][j] == sample[i][j + 1] ) );
 }
 
 void Raytracer::Run() {
 	CreateAll();
 
-	Vector3 ray_O = camera->GetO();
 	int H = camera->GetH() , W = camera->GetW();
+	aov.Initialize( H , W );
 	int** sample = new int*[H];
 	for ( int i = 0 ; i < H ; i++ ) {
 		sample[i] = new int[W];
@@ -185,25 +641,31 @@ void Raytracer::Run() {
 			sample[i][j] = 0;
 	}
 
+	STAT_PHASE( PHASE_SAMPLE );
 	//for ( int i = 0 ; i < H ; std::cout << "Sampling:   " << ++i << "/" << H << std::endl )
-	for(int i=0;i<H;i++)
-		for ( int j = 0 ; j < W ; j++ ) {
-			Vector3 ray_V = camera->Emit( i , j );
-			Color color = RayTracing( ray_O , ray_V , 1 , &sample[i][j] );
+	for(int i=i0;i<i1;i++)
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			AovSample aov_sample;
+			Color color = TracePixel( i , j , &sample[i][j] , &aov_sample );
 			camera->SetColor( i , j , color );
+			aov.Add( i , j , aov_sample );
 		}
 
+	STAT_PHASE_NEXT( PHASE_RESAMPLE );
 	//for ( int i = 0 ; i < H ; std::cout << "Resampling: " << ++i << "/" << H << std::endl )
-	for(int i=0;i<H;i++)
-		for ( int j = 0 ; j < W ; j++ ) {
-			if ( ( i == 0 || sample[i][j] == sample[i - 1][j] ) && ( i == H - 1 || sample[i][j] == sample[i + 1][j] ) &&
-			     ( j == 0 || sample[i][j] == sample[i][j - 1] ) && ( j == W - 1 || sample[i][j] == sample[i][j + 1] ) ) continue;
+	for(int i=i0;i<i1;i++)
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			if ( !NeedResampling( sample , i , j ) ) continue;
 
 			Color color;
 			for ( int r = -1 ; r <= 1 ; r++ )
 				for ( int c = -1 ; c <= 1 ; c++ ) {
-					Vector3 ray_V = camera->Emit( i + ( double ) r / 3 , j + ( double ) c / 3 );
-					color += RayTracing( ray_O , ray_V , 1 , NULL ) / 9;
+					Vector3 ray_O , ray_V;
+					camera->EmitLens( i , j , ( double ) r / 3 , ( double ) c / 3 , ( r + 1 ) * 3 + c + 2 , ray_O , ray_V );
+					thread_sampler.Start( camera->GetSampler() , i * W + j , ( r + 1 ) * 3 + c + 2 );
+					AovSample aov_sample;
+					color += RayTracing( ray_O , ray_V , 1 , NULL , &aov_sample , RayCone( 0 , camera->GetPixelSpread() / 3 ) ) / 9;
+					aov.Add( i , j , aov_sample );
 				}
 			camera->SetColor( i , j , color );
 		}
@@ -212,80 +674,59 @@ void Raytracer::Run() {
 		delete[] sample[i];
 	delete[] sample;
 
-	Bmp* bmp = new Bmp( H , W );
-	camera->Output( bmp );
-	bmp->Output( output );
-	delete bmp;
+	STAT_PHASE_STOP();
+	OutputImage();
 }
 
 void Raytracer::DebugRun(int w1, int w2, int h1, int h2)
 {
-	CreateAll();
-
-	Vector3 ray_O = camera->GetO();
-	int H = camera->GetH() , W = camera->GetW();
-	int** sample = new int*[H];
-	for ( int i = 0 ; i < H ; i++ ) {
-		sample[i] = new int[W];
-		for ( int j = 0 ; j < W ; j++ )
-			sample[i][j] = 0;
-	}
-	h1 = H - h1;
-	h2 = H - h2;
-	//for ( int i = 0 ; i < H ; std::cout << "Sampling:   " << ++i << "/" << H << std::endl )
-	for(int i=h2;i<h1;i++)
-		for ( int j = w1 ; j < w2 ; j++ ) {
-			Vector3 ray_V = camera->Emit( i , j );
-			Color color = RayTracing( ray_O , ray_V , 1 , &sample[i][j] );
-			camera->SetColor( i , j , color );
-		}
-	
-	for ( int i = 0 ; i < H ; i++ )
-		delete[] sample[i];
-	delete[] sample;
-
-	Bmp* bmp = new Bmp( H , W );
-	camera->Output( bmp );
-	bmp->Output( output );
-	delete bmp;
+	SetRegion( w1 , w2 , h1 , h2 );
+	Run();
 }
 
-void Raytracer::MultiThreadFuncCalColor(int i, int** sample)
+void Raytracer::MultiThreadFuncCalColor(Tile& tile, int** sample)
 {
-	srand(i);
-	Vector3 ray_O = camera->GetO();
-	int W = camera->GetW();
-	for ( int j = 0 ; j < W ; j++ ) {
-		Vector3 ray_V = camera->Emit( i , j );
-		Color color = RayTracing( ray_O , ray_V , 1 , &sample[i][j] );
+	srand( seed + tile.i0 * camera->GetW() + tile.j0 );
+	thread_rays = 0;
+	tile.ForEachPixel( [&]( int i , int j ) {
+		AovSample aov_sample;
+		Color color = TracePixel( i , j , &sample[i][j] , &aov_sample );
 		camera->SetColor( i , j , color );
-	}
+		aov.Add( i , j , aov_sample );
+	} );
+	traced_rays += thread_rays;
 }
 
-void Raytracer::MultiThreadFuncResampling(int i, int** sample)
+void Raytracer::MultiThreadFuncResampling(Tile& tile, int** sample)
 {
-	Vector3 ray_O = camera->GetO();
-	int H = camera->GetH() , W = camera->GetW();
-	for ( int j = 0 ; j < W ; j++ ) {
-		if ( ( i == 0 || sample[i][j] == sample[i - 1][j] ) && ( i == H - 1 || sample[i][j] == sample[i + 1][j] ) &&
-			    ( j == 0 || sample[i][j] == sample[i][j - 1] ) && ( j == W - 1 || sample[i][j] == sample[i][j + 1] ) ) continue;
+	thread_rays = 0;
+	tile.ForEachPixel( [&]( int i , int j ) {
+		if ( !NeedResampling( sample , i , j ) ) return;
 
 		Color color;
 		for ( int r = -1 ; r <= 1 ; r++ )
 			for ( int c = -1 ; c <= 1 ; c++ ) {
-				Vector3 ray_V = camera->Emit( i + ( double ) r / 3 , j + ( double ) c / 3 );
-				color += RayTracing( ray_O , ray_V , 1 , NULL ) / 9;
+				Vector3 ray_O , ray_V;
+				camera->EmitLens( i , j , ( double ) r / 3 , ( double ) c / 3 , ( r + 1 ) * 3 + c + 2 , ray_O , ray_V );
+				thread_sampler.Start( camera->GetSampler() , i * camera->GetW() + j , ( r + 1 ) * 3 + c + 2 );
+				AovSample aov_sample;
+				color += RayTracing( ray_O , ray_V , 1 , NULL , &aov_sample , RayCone( 0 , camera->GetPixelSpread() / 3 ) ) / 9;
+				aov.Add( i , j , aov_sample );
 			}
 		camera->SetColor( i , j , color );
-	}
+	} );
+	traced_rays += thread_rays;
 }
 
 
 void Raytracer::MultiThreadRun() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	CreateAll();
+	traced_rays = 0;
 
 	Vector3 ray_O = camera->GetO();
 	int H = camera->GetH() , W = camera->GetW();
+	aov.Initialize( H , W );
 	int** sample = new int*[H];
 	for ( int i = 0 ; i < H ; i++ ) {
 		sample[i] = new int[W];
@@ -293,35 +734,50 @@ void Raytracer::MultiThreadRun() {
 			sample[i][j] = 0;
 	}
 
-	std::vector<std::thread> threads(H);
-	//for ( int i = 0 ; i < H ; std::cout << "Sampling:   " << ++i << "/" << H << std::endl )
-	for(int i=0;i<H;i++)
-	{
-		threads[i] = std::thread(&Raytracer::MultiThreadFuncCalColor, this, i, sample);
-	}
-	for(int i=0;i<H;i++)
-	{
-		threads[i].join();
-	}
-
-	//for ( int i = 0 ; i < H ; std::cout << "Resampling: " << ++i << "/" << H << std::endl )
-	for(int i=0;i<H;i++)
-	{
-		threads[i] = std::thread(&Raytracer::MultiThreadFuncResampling, this, i, sample);
-	}
-	for(int i=0;i<H;i++)
-	{
-		threads[i].join();
+	bool indirect = camera->GetIndirectQuality() > 0;
+	bool cached = indirect && irradiance_cache != NULL && use_irradiance_cache;
+	gathers = 0;
+	if ( cached ) irradiance_cache->ResetCounters();
+
+	//a sparse grid of camera rays fills the irradiance cache before the image is sampled
+	STAT_PHASE( PHASE_PREPASS );
+	if ( cached && irradiance_cache->GetPrepass() > 0 ) {
+		int stride = irradiance_cache->GetPrepass();
+		GetThreadPool()->ParallelFor( ( i1 - i0 + stride - 1 ) / stride , [&]( int k ) {
+			int i = i0 + k * stride;
+			srand( seed - i );
+			thread_rays = 0;
+			for ( int j = j0 ; j < j1 ; j += stride ) {
+				thread_sampler.Start( camera->GetSampler() , i * W + j , 0 );
+				RayTracing( ray_O , camera->Emit( i , j ) , 1 , NULL , NULL );
+			}
+			traced_rays += thread_rays;
+		} );
 	}
+	int prepass_gathers = gathers;
+
+	//one tile per task, handed out to the pool workers in curve order so neighbouring threads share BVH nodes and texels
+	TileScheduler scheduler( i0 , i1 , j0 , j1 , STD_TILE_SIZE , tile_order );
+	STAT_PHASE_NEXT( PHASE_SAMPLE );
+	scheduler.Run( GetThreadPool() , [&]( Tile& tile ) { MultiThreadFuncCalColor( tile , sample ); } );
+	STAT_PHASE_NEXT( PHASE_RESAMPLE );
+	scheduler.Run( GetThreadPool() , [&]( Tile& tile ) { MultiThreadFuncResampling( tile , sample ); } );
+	STAT_PHASE_STOP();
 	
 	for ( int i = 0 ; i < H ; i++ )
 		delete[] sample[i];
 	delete[] sample;
 
-	Bmp* bmp = new Bmp( H , W );
-	camera->Output( bmp );
-	bmp->Output( output );
-	delete bmp;
+	OutputImage();
+
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	printf( "Recursive: %lld rays in %.3fs (%.3f MRays/s)\n" , ( long long ) traced_rays , seconds , traced_rays / seconds / 1e6 );
+	if ( cached ) {
+		long long lookups = irradiance_cache->GetLookups() , hits = irradiance_cache->GetHits();
+		printf( "Irradiance cache: %d records, %lld lookups, %.1f%% hits, %d gathers (%d in the prepass) instead of %lld brute force\n" ,
+			irradiance_cache->GetRecordCount() , lookups , 100.0 * hits / std::max( lookups , 1LL ) , ( int ) gathers , prepass_gathers , lookups );
+	} else
+	if ( indirect ) printf( "Indirect: %d brute force gathers\n" , ( int ) gathers );
 }
 
 
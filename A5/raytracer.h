@@ -3,39 +3,132 @@
 
 #include"scene.h"
 #include"bmp.h"
+#include"threadpool.h"
+#include"aov.h"
+#include"denoiser.h"
+#include"animation.h"
+#include"irradiancecache.h"
+#include"lighttree.h"
+#include"environment.h"
+#include"tile.h"
+#include"imagewriter.h"
 #include<string>
 #include<vector>
+#include<atomic>
 
 extern const double SPEC_POWER;
 extern const int MAX_DREFL_DEP;
 extern const int MAX_RAYTRACING_DEP;
 extern const int HASH_FAC;
 extern const int HASH_MOD;
+extern const int RUSSIAN_ROULETTE_DEP;
+extern const int LENS_DEFOCUSED;
+extern thread_local long long thread_rays; //rays traced by the calling thread
+
+class RayQueue;
+
+//ray cone :: an isotropic ray differential, the footprint width at the ray origin and its growth per unit length (negative while focusing)
+struct RayCone {
+	double width , spread;
+	RayCone( double w = 0 , double s = 0 ) : width( w ) , spread( s ) {}
+	bool IsEmpty() { return width == 0 && spread == 0; }
+	double Hit( double dist , double cos ); //widens the cone to a hit seen at this cosine, returns the footprint there
+	void Reflect( double curvature );
+	void Refract( double n , double curvature );
+};
 
 class Raytracer {
-	std::string input , output;
+	std::string input , output , hdr_output , aov_output;
 	Scene scene;
 	Light* light_head;
+	LightTree light_tree;
 	Color background_color;
+	Environment* environment;
 	Camera* camera;
-	Color CalnDiffusion( CollidePrimitive collide_primitive , int* hash );
-	Color CalnReflection( CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash );
-	Color CalnRefraction( CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash );
-	Color RayTracing( Vector3 ray_O , Vector3 ray_V , int dep , int* hash );
+	ThreadPool* thread_pool;
+	int threads , spp , seed;
+	int region_x0 , region_x1 , region_y0 , region_y1; //columns [x0,x1), rows [y0,y1) counted from the top
+	int i0 , i1 , j0 , j1; //the region in camera rows and columns
+	Denoiser* denoiser;
+	Animation* animation;
+	bool created; //CreateAll has run
+	IrradianceCache* irradiance_cache;
+	bool use_irradiance_cache; //off :: gather at every diffuse hit
+	std::atomic<int> gathers;
+	AovBuffer aov;
+	ToneMapper tonemapper;
+	std::atomic<long long> traced_rays;
+	bool specialized_shading; //off :: every hit goes through the generic kernel, for comparison
+	TileOrder tile_order; //of the recursive engine's passes
+	bool async_output; //frames go to image_writer and the next one starts while they are written
+	ImageWriter* image_writer;
+	double output_seconds; //the calling thread spent in OutputImage
+	//shading specialized on MaterialFeature bits F, MATERIAL_GENERIC tests the material instead
+	template<int F> Color CalnLight( Light* light , CollidePrimitive& collide_primitive , Material* material , Color color , int* hash );
+	template<int F> Color CalnDiffusion( CollidePrimitive collide_primitive , int* hash );
+	template<int F> Color Shade( CollidePrimitive& collide_primitive , Vector3 ray_V , int dep , int* hash , RayCone cone ); //every lobe of the hit
+	template<int F> static bool Has( Material* material , int feature ) { return ( F & MATERIAL_GENERIC ) ? material->Test( feature ) : ( F & feature ) != 0; }
+	typedef Color ( Raytracer::*DiffusionKernel )( CollidePrimitive , int* );
+	typedef Color ( Raytracer::*ShadeKernel )( CollidePrimitive& , Vector3 , int , int* , RayCone );
+	static const DiffusionKernel diffusion_kernels[MATERIAL_KERNELS];
+	static const ShadeKernel shade_kernels[MATERIAL_KERNELS];
+	Color CalnLocal( CollidePrimitive collide_primitive , int* hash ); //the diffusion kernel of the hit's material, shared by the wavefront engine
+	Color CalnIndirect( CollidePrimitive collide_primitive );
+	Color CalnEnvironment( CollidePrimitive collide_primitive );
+	void GatherIrradiance( Vector3 C , Vector3 N , IrradianceRecord& record );
+	Color CalnReflection( CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash , RayCone cone );
+	Color CalnRefraction( CollidePrimitive collide_primitive , Vector3 ray_V , int dep , int* hash , RayCone cone );
+	Color RayTracing( Vector3 ray_O , Vector3 ray_V , int dep , int* hash , AovSample* aov_sample , RayCone cone = RayCone() ); //an empty cone looks textures up at a point
+	Color TracePixel( int i , int j , int* hash , AovSample* aov_sample ); //the first sample of pixel (i,j), through the lens when there is one
+	Color TraceLens( int i , int j , int* hash , AovSample* aov_sample );
+	Primitive* InputScene( bool image_only );
+	void InitializeCamera();
+	void AutoFocus();
+	void OutputImage();
+	bool NeedResampling( int** sample , int i , int j );
+	void WavefrontTrace( RayQueue& queue , std::vector<Color>& color , std::vector<int>* sample , bool record_aov );
+	Light* FindLight( Primitive* light_primitive );
+	Color SampleLights( CollidePrimitive collide_primitive , Color color , double p_diff );
+	Color PathTracing( Vector3 ray_O , Vector3 ray_V , AovSample* aov_sample );
+	void RenderTile( Tile& tile , std::vector<float>& data );
 
 public:
 	Raytracer();
-	~Raytracer() {}
+	~Raytracer();
 	
 	void SetInput( std::string file ) { input = file; }
 	void SetOutput( std::string file ) { output = file; }
+	std::string GetOutput() { return output; }
+	void SetHdrOutput( std::string file ) { hdr_output = file; }
+	void SetAovOutput( std::string file ) { aov_output = file; }
+	void SetThreads( int n ) { threads = n; }
+	void SetSpp( int n ) { spp = n; }
+	void SetSeed( int s ) { seed = s; }
+	void SetIrradianceCache( bool on ) { use_irradiance_cache = on; }
+	void SetSpecializedShading( bool on ) { specialized_shading = on; }
+	void SetTileOrder( TileOrder order ) { tile_order = order; }
+	void SetAsyncOutput( bool on ) { async_output = on; }
+	void SetRegion( int x0 , int x1 , int y0 , int y1 ) { region_x0 = x0; region_x1 = x1; region_y0 = y0; region_y1 = y1; }
+	Camera* GetCamera() { return camera; }
+	Scene* GetScene() { return &scene; }
+	long long GetTracedRays() { return traced_rays; }
+	double GetOutputSeconds() { return output_seconds; }
+	ImageWriter* GetImageWriter() { return image_writer; } //NULL until the first asynchronous frame
 	void CreateAll();
+	void CreateImage(); //the camera and the region to render without the scene, for a coordinator that only composites tiles
 	Primitive* CreateAndLinkLightPrimitive(Primitive* primitive_head);
 	void Run();
 	void DebugRun(int w1, int w2, int h1, int h2);
 	void MultiThreadRun();
-	void MultiThreadFuncCalColor(int i, int** sample);
-	void MultiThreadFuncResampling(int i, int** sample);
+	void WavefrontRun(); //the same image from sorted ray waves :: scene.txt at 640x380 on 1 thread, 3% slower than MultiThreadRun at 3.5 times its memory
+	void PathTraceRun();
+	void DeadlineRun( double budget_ms ); //path traces until budget_ms after the call, refining the noisiest tiles
+	void WorkerRun( int crash_after ); //renders tiles requested on stdin, crash_after >= 0 exits after that many (testing)
+	void DistributedRun( std::vector<std::string> worker_command , int workers , int crash_after );
+	void SequenceRun( std::string pattern , std::string engine ); //pattern holds a printf field for the frame number
+	ThreadPool* GetThreadPool();
+	void MultiThreadFuncCalColor(Tile& tile, int** sample);
+	void MultiThreadFuncResampling(Tile& tile, int** sample);
 };
 
 #endif
@@ -0,0 +1,150 @@
+#include"sampler.h"
+#include<cstdlib>
+#include<vector>
+#include<algorithm>
+#define ran() ( double( rand() % 32768 ) / 32768 )
+
+const int SOBOL_DIMENSIONS = 16;
+const int HALTON_DIMENSIONS = 32;
+const int SAMPLER_CAMERA_DIMENSIONS = 4;
+const double SAMPLER_ONE_MINUS_EPS = 0.99999999999999989;
+
+thread_local Sampler thread_sampler;
+
+//primitive polynomial degree s, its inner coefficients a and the initial direction numbers m, from Joe and Kuo
+//the first dimension is the van der Corput sequence and has no entry
+static const int SOBOL_S[15] = { 1 , 2 , 3 , 3 , 4 , 4 , 5 , 5 , 5 , 5 , 5 , 5 , 6 , 6 , 6 };
+static const int SOBOL_A[15] = { 0 , 1 , 1 , 2 , 1 , 4 , 2 , 4 , 7 , 11 , 13 , 14 , 1 , 13 , 16 };
+static const int SOBOL_M[15][6] = {
+	{ 1 } , { 1 , 3 } , { 1 , 3 , 1 } , { 1 , 1 , 1 } , { 1 , 1 , 3 , 3 } , { 1 , 3 , 5 , 13 } ,
+	{ 1 , 1 , 5 , 5 , 17 } , { 1 , 1 , 5 , 5 , 5 } , { 1 , 1 , 7 , 11 , 19 } , { 1 , 1 , 5 , 1 , 1 } ,
+	{ 1 , 1 , 1 , 3 , 11 } , { 1 , 3 , 5 , 5 , 31 } , { 1 , 3 , 3 , 9 , 7 , 49 } , { 1 , 1 , 1 , 15 , 21 , 21 } ,
+	{ 1 , 3 , 1 , 13 , 27 , 49 }
+};
+
+static unsigned int Hash( unsigned int x ) {
+	x ^= x >> 16; x *= 0x7feb352d;
+	x ^= x >> 15; x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static unsigned int ReverseBits( unsigned int x ) {
+	x = ( x << 16 ) | ( x >> 16 );
+	x = ( ( x & 0x00ff00ff ) << 8 ) | ( ( x & 0xff00ff00 ) >> 8 );
+	x = ( ( x & 0x0f0f0f0f ) << 4 ) | ( ( x & 0xf0f0f0f0 ) >> 4 );
+	x = ( ( x & 0x33333333 ) << 2 ) | ( ( x & 0xcccccccc ) >> 2 );
+	x = ( ( x & 0x55555555 ) << 1 ) | ( ( x & 0xaaaaaaaa ) >> 1 );
+	return x;
+}
+
+//Owen scrambling :: every bit flips depending on the bits above it, Laine and Karras' hash on the reversed bits
+static unsigned int OwenScramble( unsigned int x , unsigned int seed ) {
+	x = ReverseBits( x );
+	x += seed;
+	x ^= x * 0x6c50b47c;
+	x ^= x * 0xb82f1e52;
+	x ^= x * 0xc7afe638;
+	x ^= x * 0x8d22f6e6;
+	return ReverseBits( x );
+}
+
+//generator matrices and digit permutations, built once at startup
+struct SamplerTables {
+	std::vector<unsigned int> sobol; //per dimension and index byte, the xor of the direction numbers its bits select
+	std::vector<int> halton_base , halton_digits , halton_offset;
+	std::vector<unsigned short> halton_perm; //one permutation of the base per digit of every dimension
+
+	SamplerTables();
+};
+
+SamplerTables::SamplerTables() {
+	//the 32 direction numbers of a dimension, lowest index bit first, folded into one table per index byte
+	sobol.assign( SOBOL_DIMENSIONS * 4 * 256 , 0 );
+	for ( int d = 0 ; d < SOBOL_DIMENSIONS ; d++ ) {
+		unsigned int v[32];
+		int s = ( d == 0 ) ? 0 : SOBOL_S[d - 1] , a = ( d == 0 ) ? 0 : SOBOL_A[d - 1];
+		for ( int k = 0 ; k < 32 ; k++ ) {
+			if ( d == 0 || k < s ) {
+				v[k] = ( unsigned int ) ( ( d == 0 ) ? 1 : SOBOL_M[d - 1][k] ) << ( 31 - k );
+				continue;
+			}
+			v[k] = v[k - s] ^ ( v[k - s] >> s );
+			for ( int j = 1 ; j < s ; j++ )
+				if ( ( a >> ( s - 1 - j ) ) & 1 ) v[k] ^= v[k - j];
+		}
+		for ( int b = 0 ; b < 4 ; b++ )
+			for ( int x = 0 ; x < 256 ; x++ )
+				for ( int k = 0 ; k < 8 ; k++ )
+					if ( ( x >> k ) & 1 ) sobol[( d * 4 + b ) * 256 + x] ^= v[b * 8 + k];
+	}
+
+	unsigned int state = 1;
+	for ( int b = 2 ; ( int ) halton_base.size() < HALTON_DIMENSIONS ; b++ ) {
+		bool prime = true;
+		for ( int q = 2 ; q * q <= b ; q++ )
+			if ( b % q == 0 ) prime = false;
+		if ( !prime ) continue;
+
+		//enough digits for every 32 bit index
+		int digits = 0;
+		for ( double span = 1 ; span < 4294967296.0 ; span *= b ) digits++;
+		halton_base.push_back( b );
+		halton_digits.push_back( digits );
+		halton_offset.push_back( ( int ) halton_perm.size() );
+		for ( int p = 0 ; p < digits ; p++ ) {
+			int start = ( int ) halton_perm.size();
+			for ( int k = 0 ; k < b ; k++ )
+				halton_perm.push_back( ( unsigned short ) k );
+			for ( int k = b - 1 ; k > 0 ; k-- )
+				std::swap( halton_perm[start + k] , halton_perm[start + Hash( state++ ) % ( k + 1 )] );
+		}
+	}
+}
+
+static const SamplerTables tables;
+
+bool Sampler::ParseType( std::string name , SamplerType& type ) {
+	if ( name == "random" ) type = SAMPLER_RANDOM; else
+	if ( name == "halton" ) type = SAMPLER_HALTON; else
+	if ( name == "sobol" ) type = SAMPLER_SOBOL; else
+		return false;
+	return true;
+}
+
+unsigned int Sampler::PixelSeed( int pixel ) {
+	return Hash( ( unsigned int ) pixel * 0x9e3779b9 + 0x85ebca6b );
+}
+
+double Sampler::Sample( SamplerType type , int dimension , unsigned int index , unsigned int seed ) {
+	if ( type == SAMPLER_RANDOM ) return ran();
+
+	if ( type == SAMPLER_HALTON ) {
+		int d = dimension % HALTON_DIMENSIONS , b = tables.halton_base[d];
+		const unsigned short* perm = &tables.halton_perm[tables.halton_offset[d]];
+		double inv = 1.0 / b , f = inv , ret = 0;
+		//every digit, the zeros past the last one included, goes through its permutation
+		for ( int p = 0 ; p < tables.halton_digits[d] ; p++ , index /= b , f *= inv , perm += b )
+			ret += perm[index % b] * f;
+		//a toroidal shift per pixel and dimension keeps neighbours apart
+		ret += Hash( seed ^ Hash( dimension ) ) / 4294967296.0;
+		if ( ret >= 1 ) ret -= 1;
+		return ( ret < SAMPLER_ONE_MINUS_EPS ) ? ret : SAMPLER_ONE_MINUS_EPS;
+	}
+
+	//the index is shuffled per pixel and group of dimensions (Burley), which keeps any 2^k samples of a pixel a net
+	int group = dimension / SOBOL_DIMENSIONS , d = dimension % SOBOL_DIMENSIONS;
+	index = OwenScramble( index , Hash( seed + group ) );
+	const unsigned int* t = &tables.sobol[d * 4 * 256];
+	unsigned int x = t[index & 255] ^ t[256 + ( ( index >> 8 ) & 255 )] ^ t[512 + ( ( index >> 16 ) & 255 )] ^ t[768 + ( index >> 24 )];
+	x = OwenScramble( x , Hash( seed ^ Hash( dimension + 1 ) ) );
+	double ret = x / 4294967296.0;
+	return ( ret < SAMPLER_ONE_MINUS_EPS ) ? ret : SAMPLER_ONE_MINUS_EPS;
+}
+
+void Sampler::Start( SamplerType sampler_type , int pixel , int sample_index ) {
+	type = sampler_type;
+	seed = PixelSeed( pixel );
+	index = ( unsigned int ) sample_index;
+	dimension = SAMPLER_CAMERA_DIMENSIONS;
+}
@@ -0,0 +1,38 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include<string>
+
+extern const int SOBOL_DIMENSIONS; //dimensions with their own generator matrix, later ones reuse them with fresh scrambles
+extern const int HALTON_DIMENSIONS; //one prime base each, later ones reuse them with fresh shifts
+extern const int SAMPLER_CAMERA_DIMENSIONS; //0 1 jitter the pixel, 2 3 pick the lens point
+
+//independent rand() draws, Halton with scrambled digits, or Sobol with Owen scrambling
+enum SamplerType { SAMPLER_RANDOM , SAMPLER_HALTON , SAMPLER_SOBOL };
+
+//points of a low discrepancy sequence indexed by pixel and sample number
+//Start() picks the point, Get() reads one of its dimensions, Reserve() hands out the dimensions after the camera ones in order
+class Sampler {
+	SamplerType type;
+	unsigned int seed; //scramble of the pixel
+	unsigned int index;
+	int dimension; //next free one
+
+public:
+	Sampler() : type( SAMPLER_RANDOM ) , seed( 0 ) , index( 0 ) , dimension( 0 ) {}
+	~Sampler() {}
+
+	static bool ParseType( std::string name , SamplerType& type ); //false for an unknown name
+	static unsigned int PixelSeed( int pixel );
+	static double Sample( SamplerType type , int dimension , unsigned int index , unsigned int seed ); //in [0,1), rand() for SAMPLER_RANDOM
+
+	bool IsRandom() { return type == SAMPLER_RANDOM; }
+	void Start( SamplerType sampler_type , int pixel , int sample_index );
+	int Reserve( int dims ) { dimension += dims; return dimension - dims; }
+	double Get( int dim , int sub = 0 , int count = 1 ) { return Sample( type , dim , index * count + sub , seed ); } //sub of count points drawn together stay stratified
+	double Next() { return Get( Reserve( 1 ) ); }
+};
+
+extern thread_local Sampler thread_sampler; //the point the calling thread is shading
+
+#endif
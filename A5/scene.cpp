@@ -4,34 +4,98 @@
 #include<sstream>
 #include<cstdlib>
 #include<ctime>
+#include<set>
 
 Scene::Scene() {
 	primitive_head = NULL;
+	primitive_count = 0;
+	dirty = false;
+	refit = true;
+	refits = rebuilds = 0;
 }
 
 Scene::~Scene() {
+	//the triangles of a tessellated heightfield share its texture
+	std::set<Bmp*> textures;
 	while ( primitive_head != NULL ) {
 		Primitive* next_head = primitive_head->GetNext();
 		if ( primitive_head->GetMaterial()->texture != NULL )
-			delete primitive_head->GetMaterial()->texture;
+			textures.insert( primitive_head->GetMaterial()->texture );
 		delete primitive_head;
 		primitive_head = next_head;
 	}
+	for ( std::set<Bmp*>::iterator iter = textures.begin() ; iter != textures.end() ; iter++ )
+		delete *iter;
 }
 
 void Scene::CreateScene(Primitive* primitive_head_p) {
 	primitive_head = primitive_head_p;
+	primitive_count = 0;
+	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() )
+		now->SetIndex( primitive_count++ );
+	BuildBvh();
+}
+
+void Scene::BuildBvh() {
+	std::vector<Primitive*> bounded;
+	unbounded.clear();
+	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() ) {
+		Vector3 lo , hi;
+		if ( now->GetBounds( lo , hi ) ) bounded.push_back( now );
+			else unbounded.push_back( now );
+	}
+	bvh.Build( bounded );
+	moved.clear();
+	dirty = false;
+}
+
+Primitive* Scene::FindPrimitive( std::string name ) {
+	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() )
+		if ( now->GetName() == name ) return now;
+	return NULL;
+}
+
+void Scene::Translate( Primitive* primitive , Vector3 D ) {
+	primitive->Translate( D );
+	moved.push_back( primitive );
+	dirty = true;
+}
+
+void Scene::Update() {
+	if ( !dirty ) return;
+	if ( refit ) {
+		bvh.Refit( moved );
+		moved.clear();
+		dirty = false;
+		if ( bvh.GetCost() <= bvh.GetBuildCost() * STD_BVH_REBUILD_RATIO ) {
+			refits++;
+			return;
+		}
+	}
+	BuildBvh();
+	rebuilds++;
 }
 
 CollidePrimitive Scene::FindNearestPrimitiveGetCollide( Vector3 ray_O , Vector3 ray_V ) {
 	CollidePrimitive ret;
 
-	for ( Primitive* now = primitive_head ; now != NULL ; now = now->GetNext() )
-	{
-		CollidePrimitive tmp = now->Collide(ray_O, ray_V);
-		if(tmp.dist < ret.dist)
-			ret = tmp;
+	bvh.Intersect( ray_O , ray_V , ret );
+	for ( int k = 0 ; k < ( int ) unbounded.size() ; k++ ) {
+		CollidePrimitive tmp = unbounded[k]->Collide( ray_O , ray_V );
+		if ( tmp.IsCloserThan( ret ) ) ret = tmp;
 	}
 
 	return ret;
 }
+
+Primitive* Scene::FindOccluder( Vector3 C , Vector3 P , Primitive* ignore ) {
+	Vector3 V = P - C;
+	double dist = V.Module();
+
+	for ( int k = 0 ; k < ( int ) unbounded.size() ; k++ ) {
+		if ( unbounded[k] == ignore ) continue;
+		CollidePrimitive tmp = unbounded[k]->Collide( C , V );
+		if ( EPS < dist - tmp.dist ) return unbounded[k];
+	}
+	return bvh.FindOccluder( C , V , dist , ignore );
+}
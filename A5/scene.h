@@ -6,21 +6,42 @@
 #include"primitive.h"
 #include"light.h"
 #include"camera.h"
+#include"bvh.h"
 #include<string>
 #include<fstream>
 #include<sstream>
+#include<vector>
 
 class Scene {
 	Primitive* primitive_head;
+	int primitive_count;
+	Bvh bvh;
+	std::vector<Primitive*> unbounded; //planes, tested one by one
+	std::vector<Primitive*> moved; //since the last Update
+	bool dirty;
+	bool refit; //Update refits the BVH instead of rebuilding it
+	int refits , rebuilds;
+
+	void BuildBvh();
 
 public:
 	Scene();
 	~Scene();
 	
 	Primitive* GetPrimitiveHead() { return primitive_head; }
+	int GetPrimitiveCount() { return primitive_count; }
+
+	Bvh* GetBvh() { return &bvh; }
+	Primitive* FindPrimitive( std::string name );
+	void SetRefit( bool r ) { refit = r; }
+	int GetRefits() { return refits; }
+	int GetRebuilds() { return rebuilds; }
 
 	void CreateScene(Primitive* primitive_head_p);
+	void Translate( Primitive* primitive , Vector3 D ); //the acceleration structure is stale until Update
+	void Update(); //refits for few moved primitives, rebuilds once the SAH cost has degraded
 	CollidePrimitive FindNearestPrimitiveGetCollide( Vector3 ray_O , Vector3 ray_V );
+	Primitive* FindOccluder( Vector3 C , Vector3 P , Primitive* ignore ); //anything but ignore between C and P, NULL for none
 };
 
 #endif
@@ -0,0 +1,107 @@
+#include"raytracer.h"
+#include<cstdio>
+#include<cstdlib>
+#include<chrono>
+#include<vector>
+#include<cstring>
+#include<cctype>
+
+//true if pattern holds exactly one integer conversion such as %d or %04d, and no other conversion but %%
+static bool IsFramePattern( std::string pattern ) {
+	int conversions = 0;
+	for ( int k = 0 ; k < ( int ) pattern.size() ; k++ ) {
+		if ( pattern[k] != '%' ) continue;
+		if ( ++k < ( int ) pattern.size() && pattern[k] == '%' ) continue;
+		while ( k < ( int ) pattern.size() && strchr( "-+ #0" , pattern[k] ) != NULL ) k++;
+		while ( k < ( int ) pattern.size() && isdigit( ( unsigned char ) pattern[k] ) ) k++;
+		if ( k >= ( int ) pattern.size() || strchr( "diuxXo" , pattern[k] ) == NULL ) return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+//renders every frame of the scene's animation block in one process :: the scene, textures and thread pool are
+//created once, each frame only moves the camera and the animated primitives
+void Raytracer::SequenceRun( std::string pattern , std::string engine ) {
+	if ( !IsFramePattern( pattern ) ) {
+		printf( "Sequence: %s needs exactly one integer conversion such as %%03d\n" , pattern.c_str() );
+		return;
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CreateAll();
+	GetThreadPool();
+	double setup = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	int frames = ( animation != NULL ) ? animation->GetFrames() : 1;
+	if ( frames < 1 ) {
+		printf( "Sequence: the animation has no frames\n" );
+		return;
+	}
+	Vector3 base_O = camera->GetO() , base_N = camera->GetN();
+	std::vector<std::string> names;
+	if ( animation != NULL ) names = animation->GetObjectNames();
+	std::vector<Primitive*> moving;
+	std::vector<Vector3> applied; //offset already applied to each moving primitive
+	for ( int k = 0 ; k < ( int ) names.size() ; k++ ) {
+		Primitive* primitive = scene.FindPrimitive( names[k] );
+		if ( primitive == NULL ) printf( "Sequence: no primitive named %s\n" , names[k].c_str() );
+		moving.push_back( primitive );
+		applied.push_back( Vector3() );
+	}
+
+	std::vector<double> frame_seconds;
+	double update_seconds = 0;
+	long long rays = 0;
+	for ( int frame = 0 ; frame < frames ; frame++ ) {
+		std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+		Vector3 O = base_O , N = base_N;
+		if ( animation != NULL ) {
+			animation->GetCameraO( frame , O );
+			animation->GetCameraN( frame , N );
+		}
+		camera->SetView( O , N );
+
+		bool moved = false;
+		for ( int k = 0 ; k < ( int ) moving.size() ; k++ ) {
+			Vector3 offset;
+			if ( moving[k] == NULL || !animation->GetOffset( frame , names[k] , offset ) ) continue;
+			if ( ( offset - applied[k] ).Module2() < EPS * EPS ) continue;
+			scene.Translate( moving[k] , offset - applied[k] );
+			applied[k] = offset;
+			moved = true;
+		}
+		scene.Update();
+		//a focus_dist of 0 follows whatever the centre pixel sees in this frame
+		AutoFocus();
+		//cached irradiance does not depend on the camera, so it carries over until something moves
+		if ( moved && irradiance_cache != NULL ) irradiance_cache->Clear();
+		update_seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - frame_start ).count();
+
+		char file[1024];
+		snprintf( file , sizeof( file ) , pattern.c_str() , frame );
+		output = file;
+		srand( seed + frame );
+		if ( engine == "whitted" ) MultiThreadRun();
+		if ( engine == "wavefront" ) WavefrontRun();
+		if ( engine == "path" ) PathTraceRun();
+		rays += traced_rays;
+
+		frame_seconds.push_back( std::chrono::duration<double>( std::chrono::steady_clock::now() - frame_start ).count() );
+		printf( "Sequence: frame %d/%d -> %s in %.3fs\n" , frame + 1 , frames , file , frame_seconds.back() );
+	}
+
+	//the last frames may still be queued
+	if ( image_writer != NULL ) image_writer->Flush();
+	double total = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count() , mean = 0;
+	for ( int k = 0 ; k < frames ; k++ )
+		mean += frame_seconds[k] / frames;
+	//a separate launch per frame pays the setup every time
+	double single = setup + mean;
+	printf( "Sequence: %d frames, setup %.3fs once, scene updates %.3fs, %.3fs total, %lld rays\n" , frames , setup , update_seconds , total , rays );
+	printf( "Sequence: output %.3fs per frame on the render thread" , output_seconds / frames );
+	if ( image_writer != NULL )
+		printf( ", writer %.3fs and %.0f kB per frame, %.3fs waited for it" , image_writer->GetWriteSeconds() / frames ,
+			image_writer->GetBytes() / 1024.0 / frames , image_writer->GetBlockedSeconds() );
+	printf( "\n" );
+	printf( "Sequence: %.3fs per frame amortized against %.3fs per single-frame launch (%.2fx)\n" , total / frames , single , single / ( total / frames ) );
+}
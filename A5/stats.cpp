@@ -0,0 +1,94 @@
+#include"stats.h"
+
+#ifdef RT_STATS
+
+#include<cstdio>
+#include<vector>
+#include<mutex>
+#include<atomic>
+#include<algorithm>
+
+static const char* COUNTER_NAME[STAT_COUNTERS] = {
+	"primary_rays" , "shadow_rays" , "reflection_rays" , "refraction_rays" , "diffuse_rays" ,
+	"collide_sphere" , "collide_plane" , "collide_square" , "collide_cube" , "collide_cylinder" , "collide_bezier" ,
+	"collide_triangle" , "collide_heightfield" , "collide_csg" ,
+	"bvh_nodes" , "texture_fetches" , "occluder_tests" , "occluder_hits" ,
+	"defocused_pixels" , "lens_rays" , "pixel_samples" , "unfinished_tiles"
+};
+
+static const char* PHASE_NAME[STAT_PHASES] = { "parse" , "build" , "prepass" , "sample" , "resample" , "denoise" , "output" };
+
+static std::mutex stat_mtx;
+static std::vector<StatBlock*> stat_blocks;
+static long long stat_retired[STAT_COUNTERS]; //counts of threads that already exited
+static std::atomic<long long> stat_phase_ns[STAT_PHASES];
+
+thread_local StatBlock stat_block;
+
+StatBlock::StatBlock() {
+	for ( int c = 0 ; c < STAT_COUNTERS ; c++ )
+		counter[c] = 0;
+	std::unique_lock<std::mutex> lock( stat_mtx );
+	stat_blocks.push_back( this );
+}
+
+StatBlock::~StatBlock() {
+	std::unique_lock<std::mutex> lock( stat_mtx );
+	for ( int c = 0 ; c < STAT_COUNTERS ; c++ )
+		stat_retired[c] += counter[c];
+	stat_blocks.erase( std::find( stat_blocks.begin() , stat_blocks.end() , this ) );
+}
+
+void StatPhaseTimer::Stop() {
+	if ( !running ) return;
+	running = false;
+	stat_phase_ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+static void Merge( long long total[STAT_COUNTERS] ) {
+	std::unique_lock<std::mutex> lock( stat_mtx );
+	for ( int c = 0 ; c < STAT_COUNTERS ; c++ ) {
+		total[c] = stat_retired[c];
+		for ( int k = 0 ; k < ( int ) stat_blocks.size() ; k++ )
+			total[c] += stat_blocks[k]->counter[c];
+	}
+}
+
+void StatsReset() {
+	std::unique_lock<std::mutex> lock( stat_mtx );
+	for ( int c = 0 ; c < STAT_COUNTERS ; c++ ) {
+		stat_retired[c] = 0;
+		for ( int k = 0 ; k < ( int ) stat_blocks.size() ; k++ )
+			stat_blocks[k]->counter[c] = 0;
+	}
+	for ( int p = 0 ; p < STAT_PHASES ; p++ )
+		stat_phase_ns[p] = 0;
+}
+
+void StatsPrint() {
+	long long total[STAT_COUNTERS];
+	Merge( total );
+	printf( "%-20s %16s\n" , "counter" , "value" );
+	for ( int c = 0 ; c < STAT_COUNTERS ; c++ )
+		printf( "%-20s %16lld\n" , COUNTER_NAME[c] , total[c] );
+	printf( "%-20s %16s\n" , "phase" , "seconds" );
+	for ( int p = 0 ; p < STAT_PHASES ; p++ )
+		printf( "%-20s %16.3f\n" , PHASE_NAME[p] , stat_phase_ns[p] / 1e9 );
+}
+
+void StatsOutputJson( std::string file ) {
+	long long total[STAT_COUNTERS];
+	Merge( total );
+	FILE* fout = fopen( file.c_str() , "w" );
+	if ( fout == NULL ) return;
+	fprintf( fout , "{\n  \"counters\": {\n" );
+	for ( int c = 0 ; c < STAT_COUNTERS ; c++ )
+		fprintf( fout , "    \"%s\": %lld%s\n" , COUNTER_NAME[c] , total[c] , ( c + 1 < STAT_COUNTERS ) ? "," : "" );
+	fprintf( fout , "  },\n  \"phases\": {\n" );
+	for ( int p = 0 ; p < STAT_PHASES ; p++ )
+		fprintf( fout , "    \"%s\": %.6f%s\n" , PHASE_NAME[p] , stat_phase_ns[p] / 1e9 , ( p + 1 < STAT_PHASES ) ? "," : "" );
+	fprintf( fout , "  }\n}\n" );
+	fclose( fout );
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include<string>
+#include<cstdio>
+
+//counters are on in debug builds (_DEBUG, the VS Debug configuration) and off otherwise; RT_STATS forces them on, RT_NO_STATS off
+#if !defined( RT_STATS ) && defined( _DEBUG ) && !defined( RT_NO_STATS )
+#define RT_STATS
+#endif
+
+enum StatCounter {
+	STAT_PRIMARY_RAYS , STAT_SHADOW_RAYS , STAT_REFLECTION_RAYS , STAT_REFRACTION_RAYS , STAT_DIFFUSE_RAYS ,
+	STAT_COLLIDE_SPHERE , STAT_COLLIDE_PLANE , STAT_COLLIDE_SQUARE , STAT_COLLIDE_CUBE , STAT_COLLIDE_CYLINDER , STAT_COLLIDE_BEZIER ,
+	STAT_COLLIDE_TRIANGLE , STAT_COLLIDE_HEIGHTFIELD , STAT_COLLIDE_CSG ,
+	STAT_BVH_NODES , STAT_TEXTURE_FETCHES , STAT_OCCLUDER_TESTS , STAT_OCCLUDER_HITS ,
+	STAT_DEFOCUSED_PIXELS , STAT_LENS_RAYS , STAT_PIXEL_SAMPLES , STAT_UNFINISHED_TILES ,
+	STAT_COUNTERS
+};
+
+enum StatPhase { PHASE_PARSE , PHASE_BUILD , PHASE_PREPASS , PHASE_SAMPLE , PHASE_RESAMPLE , PHASE_DENOISE , PHASE_OUTPUT , STAT_PHASES };
+
+#ifdef RT_STATS
+
+#include<chrono>
+
+//one block per thread, registered on first use and summed by the report
+struct StatBlock {
+	long long counter[STAT_COUNTERS];
+	StatBlock();
+	~StatBlock();
+};
+
+extern thread_local StatBlock stat_block;
+
+//adds wall time to the running phase until Next, Stop or the end of its scope
+class StatPhaseTimer {
+	StatPhase phase;
+	bool running;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	StatPhaseTimer( StatPhase p ) { phase = p; running = true; start = std::chrono::steady_clock::now(); }
+	~StatPhaseTimer() { Stop(); }
+
+	void Next( StatPhase p ) { Stop(); phase = p; running = true; start = std::chrono::steady_clock::now(); }
+	void Stop();
+};
+
+#define STAT_INC( c ) ( stat_block.counter[c]++ )
+#define STAT_ADD( c , n ) ( stat_block.counter[c] += ( n ) )
+#define STAT_PHASE( p ) StatPhaseTimer stat_phase_timer( p )
+#define STAT_PHASE_NEXT( p ) stat_phase_timer.Next( p )
+#define STAT_PHASE_STOP() stat_phase_timer.Stop()
+
+void StatsReset();
+void StatsPrint();
+void StatsOutputJson( std::string file );
+
+#else
+
+#define STAT_INC( c ) ( ( void ) 0 )
+#define STAT_ADD( c , n ) ( ( void ) 0 )
+#define STAT_PHASE( p ) ( ( void ) 0 )
+#define STAT_PHASE_NEXT( p ) ( ( void ) 0 )
+#define STAT_PHASE_STOP() ( ( void ) 0 )
+
+inline void StatsReset() {}
+inline void StatsPrint() {}
+inline void StatsOutputJson( std::string ) { fprintf( stderr , "counters are off in this build, define RT_STATS for --stats\n" ); }
+
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+#include"threadpool.h"
+
+ThreadPool::ThreadPool( int threads ) {
+	if ( threads <= 0 ) threads = std::thread::hardware_concurrency();
+	if ( threads <= 0 ) threads = 1;
+	next_index = 0;
+	task_size = 0;
+	generation = 0;
+	busy = 0;
+	stop = false;
+	for ( int i = 0 ; i < threads ; i++ )
+		workers.push_back( std::thread( &ThreadPool::WorkerLoop , this ) );
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock( mtx );
+		stop = true;
+	}
+	cv_task.notify_all();
+	for ( int i = 0 ; i < ( int ) workers.size() ; i++ )
+		workers[i].join();
+}
+
+void ThreadPool::WorkerLoop() {
+	int seen = 0;
+	while ( true ) {
+		{
+			std::unique_lock<std::mutex> lock( mtx );
+			cv_task.wait( lock , [&]() { return stop || generation != seen; } );
+			if ( stop ) return;
+			seen = generation;
+		}
+
+		for ( int i = next_index++ ; i < task_size ; i = next_index++ )
+			task( i );
+
+		std::unique_lock<std::mutex> lock( mtx );
+		if ( --busy == 0 ) cv_done.notify_all();
+	}
+}
+
+void ThreadPool::ParallelFor( int n , std::function<void( int )> func ) {
+	if ( n <= 0 ) return;
+	std::unique_lock<std::mutex> lock( mtx );
+	task = func;
+	task_size = n;
+	next_index = 0;
+	busy = ( int ) workers.size();
+	generation++;
+	cv_task.notify_all();
+	cv_done.wait( lock , [&]() { return busy == 0; } );
+}
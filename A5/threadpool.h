@@ -0,0 +1,32 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include<thread>
+#include<vector>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<atomic>
+
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable cv_task , cv_done;
+	std::function<void( int )> task;
+	std::atomic<int> next_index;
+	int task_size;
+	int generation;
+	int busy;
+	bool stop;
+
+	void WorkerLoop();
+
+public:
+	ThreadPool( int threads = 0 ); //0 :: one worker per hardware thread
+	~ThreadPool();
+
+	int GetThreads() { return ( int ) workers.size(); }
+	void ParallelFor( int n , std::function<void( int )> func ); //calls func(0..n-1) on the workers and waits
+};
+
+#endif
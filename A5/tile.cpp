@@ -0,0 +1,79 @@
+#include"tile.h"
+#include<algorithm>
+
+const int STD_TILE_SIZE = 16;
+
+//the bits of k in even positions, packed :: one coordinate of Morton index k
+static int EvenBits( int k ) {
+	k &= 0x55555555;
+	k = ( k | ( k >> 1 ) ) & 0x33333333;
+	k = ( k | ( k >> 2 ) ) & 0x0f0f0f0f;
+	k = ( k | ( k >> 4 ) ) & 0x00ff00ff;
+	k = ( k | ( k >> 8 ) ) & 0x0000ffff;
+	return k;
+}
+
+//distance of cell (x,y) along the Hilbert curve filling an n x n grid, n a power of two
+static long long HilbertIndex( int n , int x , int y ) {
+	long long d = 0;
+	for ( int s = n / 2 ; s > 0 ; s /= 2 ) {
+		int rx = ( x & s ) > 0 , ry = ( y & s ) > 0;
+		d += ( long long ) s * s * ( ( 3 * rx ) ^ ry );
+		//rotate the quadrant so the curve inside it starts where the last one ended
+		if ( ry == 0 ) {
+			if ( rx == 1 ) {
+				x = s - 1 - ( x & ( s - 1 ) );
+				y = s - 1 - ( y & ( s - 1 ) );
+			}
+			std::swap( x , y );
+		}
+	}
+	return d;
+}
+
+void Tile::ForEachPixel( std::function<void( int , int )> func ) {
+	if ( i1 - i0 == 1 ) {
+		for ( int j = j0 ; j < j1 ; j++ )
+			func( i0 , j );
+		return;
+	}
+	int n = 1;
+	while ( n < i1 - i0 || n < j1 - j0 ) n *= 2;
+	for ( int k = 0 ; k < n * n ; k++ ) {
+		int i = i0 + EvenBits( k >> 1 ) , j = j0 + EvenBits( k );
+		if ( i < i1 && j < j1 ) func( i , j );
+	}
+}
+
+TileScheduler::TileScheduler( int i0 , int i1 , int j0 , int j1 , int size , TileOrder order ) {
+	if ( order == TILE_SCANLINE ) {
+		for ( int i = i0 ; i < i1 ; i++ ) {
+			Tile tile;
+			tile.i0 = i; tile.i1 = i + 1;
+			tile.j0 = j0; tile.j1 = j1;
+			tiles.push_back( tile );
+		}
+		return;
+	}
+
+	std::vector< std::pair<long long , int> > key;
+	int rows = ( i1 - i0 + size - 1 ) / size , cols = ( j1 - j0 + size - 1 ) / size , n = 1;
+	while ( n < rows || n < cols ) n *= 2;
+	for ( int i = i0 ; i < i1 ; i += size )
+		for ( int j = j0 ; j < j1 ; j += size ) {
+			Tile tile;
+			tile.i0 = i; tile.i1 = std::min( i + size , i1 );
+			tile.j0 = j; tile.j1 = std::min( j + size , j1 );
+			key.push_back( std::make_pair( HilbertIndex( n , ( j - j0 ) / size , ( i - i0 ) / size ) , ( int ) tiles.size() ) );
+			tiles.push_back( tile );
+		}
+	std::sort( key.begin() , key.end() );
+	std::vector<Tile> sorted;
+	for ( int k = 0 ; k < ( int ) key.size() ; k++ )
+		sorted.push_back( tiles[key[k].second] );
+	tiles.swap( sorted );
+}
+
+void TileScheduler::Run( ThreadPool* pool , std::function<void( Tile& )> func ) {
+	pool->ParallelFor( GetTileCount() , [&]( int k ) { func( tiles[k] ); } );
+}
@@ -0,0 +1,32 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include"threadpool.h"
+#include<vector>
+#include<functional>
+
+extern const int STD_TILE_SIZE;
+
+//scanline :: whole rows from the top, hilbert :: square tiles along a Hilbert curve, their pixels in Morton order
+enum TileOrder { TILE_SCANLINE , TILE_HILBERT };
+
+struct Tile {
+	int i0 , i1; //rows [i0,i1)
+	int j0 , j1; //columns [j0,j1)
+
+	void ForEachPixel( std::function<void( int , int )> func ); //(i,j) of a row left to right, of a taller tile in Morton order
+};
+
+class TileScheduler {
+	std::vector<Tile> tiles;
+
+public:
+	TileScheduler( int i0 , int i1 , int j0 , int j1 , int size = STD_TILE_SIZE , TileOrder order = TILE_HILBERT );
+	~TileScheduler() {}
+
+	int GetTileCount() { return ( int ) tiles.size(); }
+	Tile& GetTile( int k ) { return tiles[k]; }
+	void Run( ThreadPool* pool , std::function<void( Tile& )> func ); //tiles are handed out to idle workers in order
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include"tonemap.h"
+#include<cmath>
+#include<string>
+#include<sstream>
+#include<algorithm>
+
+ToneMapper::ToneMapper() {
+	tone_operator = TONE_CLAMP;
+	exposure = 0;
+	gamma = 1;
+}
+
+void ToneMapper::Input( std::string var , std::stringstream& fin ) {
+	if ( var == "operator=" ) {
+		std::string name; fin >> name;
+		if ( name == "clamp" ) tone_operator = TONE_CLAMP;
+		if ( name == "reinhard" ) tone_operator = TONE_REINHARD;
+		if ( name == "aces" ) tone_operator = TONE_ACES;
+	}
+	if ( var == "exposure=" ) fin >> exposure;
+	if ( var == "gamma=" ) fin >> gamma;
+}
+
+void ToneMapper::Run( std::vector<float> color[3] ) {
+	float scale = ( float ) pow( 2.0 , exposure );
+	float inv_gamma = ( float ) ( 1 / gamma );
+
+	//branch-free loops over each plane so they vectorise
+	for ( int c = 0 ; c < 3 ; c++ ) {
+		int n = ( int ) color[c].size();
+		float* x = n > 0 ? &color[c][0] : NULL;
+		for ( int k = 0 ; k < n ; k++ )
+			x[k] = std::max( x[k] * scale , 0.0f );
+
+		if ( tone_operator == TONE_REINHARD )
+			for ( int k = 0 ; k < n ; k++ )
+				x[k] = x[k] / ( 1 + x[k] );
+		if ( tone_operator == TONE_ACES ) //Narkowicz's fit of the ACES filmic curve
+			for ( int k = 0 ; k < n ; k++ )
+				x[k] = ( x[k] * ( 2.51f * x[k] + 0.03f ) ) / ( x[k] * ( 2.43f * x[k] + 0.59f ) + 0.14f );
+
+		for ( int k = 0 ; k < n ; k++ )
+			x[k] = std::min( x[k] , 1.0f );
+		if ( gamma != 1 )
+			for ( int k = 0 ; k < n ; k++ )
+				x[k] = powf( x[k] , inv_gamma );
+	}
+}
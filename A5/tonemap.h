@@ -0,0 +1,24 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include<vector>
+#include<string>
+#include<sstream>
+
+enum ToneOperator { TONE_CLAMP , TONE_REINHARD , TONE_ACES };
+
+//maps linear radiance to displayable [0,1] values
+class ToneMapper {
+	ToneOperator tone_operator;
+	double exposure; //in stops
+	double gamma;
+
+public:
+	ToneMapper();
+	~ToneMapper() {}
+
+	void Input( std::string var , std::stringstream& fin );
+	void Run( std::vector<float> color[3] ); //in place
+};
+
+#endif
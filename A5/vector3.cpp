@@ -131,9 +131,14 @@ Vector3 Vector3::Refract( Vector3 N , double n ) {
 }
 
 Vector3 Vector3::Diffuse() {
+	double u = ran() , v = ran();
+	return Diffuse( u , v );
+}
+
+Vector3 Vector3::Diffuse( double u , double v ) {
 	Vector3 Vert = GetAnVerticalVector();
-	double theta = acos( sqrt( ran() ) );
-	double phi = ran() * 2 * PI;
+	double theta = acos( sqrt( u ) );
+	double phi = v * 2 * PI;
 	return Rotate( Vert , theta ).Rotate( *this , phi );
 }
 
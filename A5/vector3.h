@@ -41,6 +41,7 @@ public:
 	Vector3 Reflect( Vector3 N );
 	Vector3 Refract( Vector3 N , double n );
 	Vector3 Diffuse();
+	Vector3 Diffuse( double u , double v ); //cosine weighted around this normal from a point of the unit square
 	Vector3 Rotate( Vector3 axis , double theta );
 };
 
@@ -0,0 +1,269 @@
+#include"wavefront.h"
+#include"raytracer.h"
+#include<cstdio>
+#include<cmath>
+#include<chrono>
+#include<algorithm>
+
+const int WAVEFRONT_CHUNK = 4096;
+const int WAVEFRONT_BATCH = 1 << 20; //resampling rays queued before a wave is traced
+
+template<class T>
+static void PermuteVector( std::vector<T>& v , const std::vector<int>& order ) {
+	std::vector<T> tmp( order.size() );
+	for ( int k = 0 ; k < ( int ) order.size() ; k++ )
+		tmp[k] = v[order[k]];
+	v.swap( tmp );
+}
+
+template<class T>
+static void AppendVector( std::vector<T>& v , const std::vector<T>& term ) {
+	v.insert( v.end() , term.begin() , term.end() );
+}
+
+RayCone RayQueue::GetCone( int k ) {
+	return RayCone( cw[k] , cs[k] );
+}
+
+void RayQueue::Push( Vector3 O , Vector3 V , Color weight , RayCone cone , int pix , int h ) {
+	ox.push_back( O.x ); oy.push_back( O.y ); oz.push_back( O.z );
+	vx.push_back( V.x ); vy.push_back( V.y ); vz.push_back( V.z );
+	wr.push_back( weight.r ); wg.push_back( weight.g ); wb.push_back( weight.b );
+	cw.push_back( cone.width ); cs.push_back( cone.spread );
+	pixel.push_back( pix );
+	hash.push_back( h );
+}
+
+void RayQueue::Append( RayQueue& queue ) {
+	AppendVector( ox , queue.ox ); AppendVector( oy , queue.oy ); AppendVector( oz , queue.oz );
+	AppendVector( vx , queue.vx ); AppendVector( vy , queue.vy ); AppendVector( vz , queue.vz );
+	AppendVector( wr , queue.wr ); AppendVector( wg , queue.wg ); AppendVector( wb , queue.wb );
+	AppendVector( cw , queue.cw ); AppendVector( cs , queue.cs );
+	AppendVector( pixel , queue.pixel );
+	AppendVector( hash , queue.hash );
+}
+
+void RayQueue::Permute( const std::vector<int>& order ) {
+	PermuteVector( ox , order ); PermuteVector( oy , order ); PermuteVector( oz , order );
+	PermuteVector( vx , order ); PermuteVector( vy , order ); PermuteVector( vz , order );
+	PermuteVector( wr , order ); PermuteVector( wg , order ); PermuteVector( wb , order );
+	PermuteVector( cw , order ); PermuteVector( cs , order );
+	PermuteVector( pixel , order );
+	PermuteVector( hash , order );
+}
+
+void RayQueue::Reserve( int n ) {
+	ox.reserve( n ); oy.reserve( n ); oz.reserve( n );
+	vx.reserve( n ); vy.reserve( n ); vz.reserve( n );
+	wr.reserve( n ); wg.reserve( n ); wb.reserve( n );
+	cw.reserve( n ); cs.reserve( n );
+	pixel.reserve( n );
+	hash.reserve( n );
+}
+
+void RayQueue::Clear() {
+	ox.clear(); oy.clear(); oz.clear();
+	vx.clear(); vy.clear(); vz.clear();
+	wr.clear(); wg.clear(); wb.clear();
+	cw.clear(); cs.clear();
+	pixel.clear();
+	hash.clear();
+}
+
+void SortByKey( const std::vector<int>& key , int key_range , std::vector<int>& order ) {
+	std::vector<int> start( key_range + 1 , 0 );
+	for ( int k = 0 ; k < ( int ) key.size() ; k++ )
+		start[key[k] + 1]++;
+	for ( int i = 0 ; i < key_range ; i++ )
+		start[i + 1] += start[i];
+	order.resize( key.size() );
+	for ( int k = 0 ; k < ( int ) key.size() ; k++ )
+		order[start[key[k]]++] = k;
+}
+
+void Raytracer::WavefrontTrace( RayQueue& queue , std::vector<Color>& color , std::vector<int>* sample , bool record_aov ) {
+	int primitive_count = scene.GetPrimitiveCount();
+
+	std::vector<CollidePrimitive> hits;
+	std::vector<Color> emission;
+	std::vector<AovSample> first_hit;
+	std::vector<int> key , order;
+	RayQueue next;
+
+	for ( int dep = 1 ; dep <= MAX_RAYTRACING_DEP && queue.Size() > 0 ; dep++ ) {
+		int n = queue.Size();
+		int chunks = ( n + WAVEFRONT_CHUNK - 1 ) / WAVEFRONT_CHUNK;
+		traced_rays += n;
+		if ( dep == 1 ) STAT_ADD( STAT_PRIMARY_RAYS , n );
+
+		//phase 1 :: group by direction octant and intersect
+		key.resize( n );
+		for ( int k = 0 ; k < n ; k++ )
+			key[k] = queue.GetOctant( k );
+		SortByKey( key , 8 , order );
+		queue.Permute( order );
+
+		hits.resize( n );
+		GetThreadPool()->ParallelFor( chunks , [&]( int c ) {
+			int end = std::min( n , ( c + 1 ) * WAVEFRONT_CHUNK );
+			for ( int k = c * WAVEFRONT_CHUNK ; k < end ; k++ )
+				hits[k] = scene.FindNearestPrimitiveGetCollide( queue.GetO( k ) , queue.GetV( k ) );
+		} );
+
+		//phase 2 :: group by material, shade through the recursive engine's kernels and spawn secondary rays
+		for ( int k = 0 ; k < n ; k++ )
+			key[k] = hits[k].isCollide ? hits[k].collide_primitive->GetIndex() + 1 : 0;
+		SortByKey( key , primitive_count + 1 , order );
+		queue.Permute( order );
+		PermuteVector( hits , order );
+
+		emission.assign( n , Color() );
+		if ( record_aov && dep == 1 ) first_hit.assign( n , AovSample() );
+		std::vector<RayQueue> next_part( chunks );
+		GetThreadPool()->ParallelFor( chunks , [&]( int c ) {
+			//shadow, gather and environment rays of the shading count like the recursive engine's
+			thread_rays = 0;
+			int end = std::min( n , ( c + 1 ) * WAVEFRONT_CHUNK );
+			for ( int k = c * WAVEFRONT_CHUNK ; k < end ; k++ ) {
+				CollidePrimitive& collide_primitive = hits[k];
+				if ( !collide_primitive.isCollide ) {
+					if ( environment != NULL ) emission[k] = queue.GetWeight( k ) * environment->Lookup( queue.GetV( k ) );
+					continue;
+				}
+				RayCone cone = queue.GetCone( k );
+				Vector3 ray_V = queue.GetV( k );
+				if ( !cone.IsEmpty() ) collide_primitive.footprint = cone.Hit( collide_primitive.dist , fabs( ray_V.GetUnitVector().Dot( collide_primitive.N ) ) );
+				if ( record_aov && dep == 1 ) first_hit[k].Set( collide_primitive );
+				Primitive* primitive = collide_primitive.collide_primitive;
+				Material* material = primitive->GetMaterial();
+				Color weight = queue.GetWeight( k );
+				int pix = queue.pixel[k];
+				int h = ( queue.hash[k] + primitive->GetSample() ) % HASH_MOD;
+
+				if ( primitive->IsLightPrimitive() ) {
+					queue.hash[k] = h;
+					emission[k] = weight * material->color;
+					continue;
+				}
+
+				thread_sampler.Start( camera->GetSampler() , pix , k );
+				emission[k] = weight * CalnLocal( collide_primitive , &h );
+				queue.hash[k] = h;
+
+				int child_hash = ( int ) ( ( long long ) h * HASH_FAC % HASH_MOD );
+				double curvature = collide_primitive.front ? primitive->GetCurvature() : -primitive->GetCurvature();
+				if ( material->refl > EPS ) {
+					Vector3 V = ray_V.Reflect( collide_primitive.N );
+					RayCone refl_cone = cone;
+					refl_cone.Reflect( curvature );
+					STAT_INC( STAT_REFLECTION_RAYS );
+					next_part[c].Push( collide_primitive.C , V , weight * material->color * material->refl , refl_cone , pix , child_hash );
+				}
+				if ( material->refr > EPS ) {
+					double rindex = material->rindex;
+					if ( collide_primitive.front ) rindex = 1 / rindex;
+					Vector3 V = ray_V.Refract( collide_primitive.N , rindex );
+					RayCone refr_cone = cone;
+					refr_cone.Refract( rindex , curvature );
+					STAT_INC( STAT_REFRACTION_RAYS );
+					Color trans = Color( 1 , 1 , 1 );
+					if ( !collide_primitive.front ) {
+						Color absor = material->absor * -collide_primitive.dist;
+						trans = Color( exp( absor.r ) , exp( absor.g ) , exp( absor.b ) );
+					}
+					next_part[c].Push( collide_primitive.C , V , weight * trans * material->refr , refr_cone , pix , child_hash );
+				}
+			}
+			traced_rays += thread_rays;
+		} );
+
+		int W = camera->GetW();
+		for ( int k = 0 ; k < n ; k++ ) {
+			color[queue.pixel[k]] += emission[k];
+			if ( record_aov && dep == 1 ) aov.Add( queue.pixel[k] / W , queue.pixel[k] % W , first_hit[k] );
+			if ( sample != NULL && hits[k].isCollide )
+				( *sample )[queue.pixel[k]] = ( ( *sample )[queue.pixel[k]] + queue.hash[k] ) % HASH_MOD;
+		}
+
+		//phase 3 :: the spawned rays become the next wave
+		next.Clear();
+		for ( int c = 0 ; c < chunks ; c++ )
+			next.Append( next_part[c] );
+		std::swap( queue , next );
+	}
+}
+
+void Raytracer::WavefrontRun() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CreateAll();
+	traced_rays = 0;
+
+	Vector3 ray_O , ray_V;
+	int H = camera->GetH() , W = camera->GetW();
+	aov.Initialize( H , W );
+
+	STAT_PHASE( PHASE_SAMPLE );
+	RayQueue queue;
+	queue.Reserve( ( i1 - i0 ) * ( j1 - j0 ) );
+	for ( int i = i0 ; i < i1 ; i++ )
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			camera->EmitLens( i , j , 0 , 0 , 0 , ray_O , ray_V );
+			queue.Push( ray_O , ray_V , Color( 1 , 1 , 1 ) , RayCone( 0 , camera->GetPixelSpread() ) , i * W + j , 0 );
+		}
+
+	std::vector<Color> color( H * W );
+	std::vector<int> sample( H * W , 0 );
+	WavefrontTrace( queue , color , &sample , true );
+	for ( int i = i0 ; i < i1 ; i++ )
+		for ( int j = j0 ; j < j1 ; j++ )
+			camera->SetColor( i , j , color[i * W + j] );
+
+	STAT_PHASE_NEXT( PHASE_RESAMPLE );
+	queue.Clear();
+	color.assign( H * W , Color() );
+	std::vector<bool> resample( H * W , false );
+	for ( int i = i0 ; i < i1 ; i++ )
+		for ( int j = j0 ; j < j1 ; j++ ) {
+			//lens samples can outgrow memory in one wave, trace what is queued every so often
+			if ( queue.Size() >= WAVEFRONT_BATCH ) {
+				WavefrontTrace( queue , color , NULL , true );
+				queue.Clear();
+			}
+			//no per ray feedback in a wave :: a pixel whose first hit is out of focus takes all its lens samples at once
+			if ( camera->CircleOfConfusion( i , j , aov.depth[i * W + j] ) >= 0.5 ) {
+				int n = std::max( camera->GetLensSamples() , 1 );
+				resample[i * W + j] = true;
+				STAT_INC( STAT_DEFOCUSED_PIXELS );
+				STAT_ADD( STAT_LENS_RAYS , n );
+				for ( int k = 0 ; k < n ; k++ ) {
+					double u[4];
+					camera->LensSample( i , j , k , u );
+					camera->EmitLens( i , j , u[2] - 0.5 , u[3] - 0.5 , k , ray_O , ray_V );
+					queue.Push( ray_O , ray_V , Color( 1 , 1 , 1 ) / n , RayCone( 0 , camera->GetPixelSpread() ) , i * W + j , 0 );
+				}
+				continue;
+			}
+			int s = sample[i * W + j];
+			if ( ( i == i0 || s == sample[( i - 1 ) * W + j] ) && ( i == i1 - 1 || s == sample[( i + 1 ) * W + j] ) &&
+			     ( j == j0 || s == sample[i * W + j - 1] ) && ( j == j1 - 1 || s == sample[i * W + j + 1] ) ) continue;
+
+			resample[i * W + j] = true;
+			for ( int r = -1 ; r <= 1 ; r++ )
+				for ( int c = -1 ; c <= 1 ; c++ ) {
+					camera->EmitLens( i , j , ( double ) r / 3 , ( double ) c / 3 , ( r + 1 ) * 3 + c + 2 , ray_O , ray_V );
+					queue.Push( ray_O , ray_V , Color( 1 , 1 , 1 ) / 9 , RayCone( 0 , camera->GetPixelSpread() / 3 ) , i * W + j , 0 );
+				}
+		}
+
+	WavefrontTrace( queue , color , NULL , true );
+	for ( int i = i0 ; i < i1 ; i++ )
+		for ( int j = j0 ; j < j1 ; j++ )
+			if ( resample[i * W + j] )
+				camera->SetColor( i , j , color[i * W + j] );
+
+	STAT_PHASE_STOP();
+	OutputImage();
+
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	printf( "Wavefront: %lld rays in %.3fs (%.3f MRays/s)\n" , ( long long ) traced_rays , seconds , traced_rays / seconds / 1e6 );
+}
@@ -0,0 +1,39 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include"vector3.h"
+#include"color.h"
+#include<vector>
+
+extern const int WAVEFRONT_CHUNK; //rays handed to one worker at a time
+
+struct RayCone;
+
+//structure-of-arrays ray buffer, one slot per ray in flight
+class RayQueue {
+public:
+	std::vector<double> ox , oy , oz;
+	std::vector<double> vx , vy , vz;
+	std::vector<double> wr , wg , wb; //product of the reflectances along the path
+	std::vector<double> cw , cs; //ray cone width and spread, for texture footprints
+	std::vector<int> pixel;
+	std::vector<int> hash;
+
+	int Size() { return ( int ) pixel.size(); }
+	Vector3 GetO( int k ) { return Vector3( ox[k] , oy[k] , oz[k] ); }
+	Vector3 GetV( int k ) { return Vector3( vx[k] , vy[k] , vz[k] ); }
+	Color GetWeight( int k ) { return Color( wr[k] , wg[k] , wb[k] ); }
+	RayCone GetCone( int k );
+	int GetOctant( int k ) { return ( vx[k] < 0 ) | ( ( vy[k] < 0 ) << 1 ) | ( ( vz[k] < 0 ) << 2 ); }
+
+	void Push( Vector3 O , Vector3 V , Color weight , RayCone cone , int pix , int h );
+	void Append( RayQueue& queue );
+	void Permute( const std::vector<int>& order );
+	void Reserve( int n );
+	void Clear();
+};
+
+//stable counting sort of 0..key.size()-1 by key, keys in [0,key_range)
+void SortByKey( const std::vector<int>& key , int key_range , std::vector<int>& order );
+
+#endif